@@ -15,9 +15,9 @@ if [ "$CXX" = "" ]; then
 fi
 
 if [ $LIBNL3 -eq 1 ]; then
-	$CXX -std=c++0x $CXXFLAGS `pkg-config --cflags libnl-route-3.0` -DLIBNL3 -c -o $*
+	$CXX -std=c++0x -pthread $CXXFLAGS `pkg-config --cflags libnl-route-3.0` -DLIBNL3 -c -o $*
 elif [ $LIBNL2 -eq 1 ]; then
-	$CXX -std=c++0x $CXXFLAGS `pkg-config --cflags libnl-2.0` -DLIBNL2 -c -o $*
+	$CXX -std=c++0x -pthread $CXXFLAGS `pkg-config --cflags libnl-2.0` -DLIBNL2 -c -o $*
 else
 	echo "OpenVRRP requires libnl version 3 or 2" >&2
 	exit 1
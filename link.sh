@@ -15,9 +15,9 @@ if [ "$CXX" = "" ]; then
 fi
 
 if [ $LIBNL3 -eq 1 ]; then
-	$CXX -std=c++0x $LDFLAGS `pkg-config --libs libnl-route-3.0` -o $*
+	$CXX -std=c++0x -pthread $LDFLAGS `pkg-config --libs libnl-route-3.0` -o $*
 elif [ $LIBNL2 -eq 1 ]; then
-	$CXX -std=c++0x $LDFLAGS `pkg-config --libs libnl-2.0` -o $*
+	$CXX -std=c++0x -pthread $LDFLAGS `pkg-config --libs libnl-2.0` -o $*
 else
 	echo "OpenVRRP requires libnl version 3 or 2" >&2
 	exit 1
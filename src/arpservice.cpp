@@ -18,11 +18,11 @@
 
 #include "arpservice.h"
 #include "mainloop.h"
+#include "log.h"
 
 #include <cstring>
 
 #include <unistd.h>
-#include <syslog.h>
 #include <net/if_arp.h>
 #include <arpa/inet.h>
 #include <net/ethernet.h>
@@ -83,7 +83,7 @@ ArpService::ArpService (int interface)
 {
 	if (m_socket == -1)
 	{
-		syslog(LOG_ERR, "Error creating ARP socket: %s", std::strerror(errno));
+		LOG(LOG_ERR, "Error creating ARP socket: %s", std::strerror(errno));
 		return;
 	}
 
@@ -94,13 +94,13 @@ ArpService::ArpService (int interface)
 	addr.sll_ifindex = interface;
 	if (bind(m_socket, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1)
 	{
-		syslog(LOG_ERR, "Error binding ARP socket to interface: %s", std::strerror(errno));
+		LOG(LOG_ERR, "Error binding ARP socket to interface: %s", std::strerror(errno));
 		close(m_socket);
 		m_socket = -1;
 		return;
 	}
 
-	if (!MainLoop::addMonitor(m_socket, socketCallback, this))
+	if (!MainLoop::addMonitor(m_socket, socketCallback, this, MainLoop::ArpPriority))
 	{
 		close(m_socket);
 		m_socket = -1;
@@ -148,7 +148,7 @@ void ArpService::onArpPacket ()
 
 	if (size == -1)
 	{
-		syslog(LOG_ERR, "Error receiving ARP packet: %s", std::strerror(errno));
+		LOG(LOG_ERR, "Error receiving ARP packet: %s", std::strerror(errno));
 		return;
 	}
 
@@ -177,5 +177,5 @@ void ArpService::onArpPacket ()
 	} while (size == -1 && errno == EINTR);
 
 	if (size == -1)
-		syslog(LOG_ERR, "Error sending ARP packet: %s", std::strerror(errno));
+		LOG(LOG_ERR, "Error sending ARP packet: %s", std::strerror(errno));
 }
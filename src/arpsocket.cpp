@@ -17,11 +17,12 @@
  */
 
 #include "arpsocket.h"
+#include "netlink.h"
+#include "log.h"
 
 #include <cerrno>
 #include <cstring>
 
-#include <syslog.h>
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
 #include <net/if.h>
@@ -31,86 +32,202 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
-bool ArpSocket::sendGratuitiousArp (unsigned int interface, const IpAddress &address)
+ArpSocket::SocketMap ArpSocket::sockets;
+
+ArpSocket::ArpSocket (int interface) :
+	m_interface(interface),
+	m_socket(-1),
+	m_references(0),
+	m_monitored(false),
+	m_packets(MaxPackets),
+	m_iov(MaxPackets),
+	m_headers(MaxPackets)
 {
-	if (address.family() != AF_INET)
-		return false;
+	std::memset(m_hardwareAddress, 0, sizeof(m_hardwareAddress));
+
+	std::memset(&m_broadcastAddress, 0, sizeof(m_broadcastAddress));
+	m_broadcastAddress.sll_family = AF_PACKET;
+	m_broadcastAddress.sll_protocol = htons(ETH_P_ARP);
+	m_broadcastAddress.sll_ifindex = interface;
+	m_broadcastAddress.sll_halen = 6;
+	std::memset(&m_broadcastAddress.sll_addr, 0xFF, 6);
+
+	// Everything but the addresses is the same for all packets
+	for (unsigned int i = 0; i != MaxPackets; ++i)
+	{
+		ArpPacket &packet = m_packets[i];
+		packet.hardwareType = htons(ARPHRD_ETHER);
+		packet.protocolType = htons(ETHERTYPE_IP);
+		packet.hardwareAddressLength = 6;
+		packet.protocolAddressLength = 4;
+		packet.operation = htons(ARPOP_REPLY);
+		std::memset(&packet.targetHardwareAddress, 0, 6);
+
+		m_iov[i].iov_base = &packet;
+		m_iov[i].iov_len = sizeof(packet);
+
+		msghdr &hdr = m_headers[i].msg_hdr;
+		std::memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name = &m_broadcastAddress;
+		hdr.msg_namelen = sizeof(m_broadcastAddress);
+		hdr.msg_iov = &m_iov[i];
+		hdr.msg_iovlen = 1;
+	}
+}
+
+ArpSocket::~ArpSocket ()
+{
+	if (m_monitored)
+		Netlink::removeInterfaceMonitor(m_interface, interfaceCallback, this);
 
-	int s = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, htons(ETH_P_ARP));
-	if (s == -1)
+	if (m_socket != -1)
+		while (close(m_socket) == -1 && errno == EINTR);
+}
+
+bool ArpSocket::open ()
+{
+	m_socket = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, htons(ETH_P_ARP));
+	if (m_socket == -1)
 	{
-		syslog(LOG_ERR, "Error creating ARP socket: %s", std::strerror(errno));
+		LOG(LOG_ERR, "Error creating ARP socket: %s", std::strerror(errno));
 		return false;
 	}
 
 	// Bind to specific interface
 	sockaddr_ll addr;
+	std::memset(&addr, 0, sizeof(addr));
 	addr.sll_family = AF_PACKET;
 	addr.sll_protocol = htons(ETH_P_ARP);
-	addr.sll_ifindex = interface;
-	if (bind(s, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1)
+	addr.sll_ifindex = m_interface;
+	if (bind(m_socket, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1)
 	{
-		syslog(LOG_ERR, "Error binding ARP socket to interface: %s", std::strerror(errno));
-		close(s);
+		LOG(LOG_ERR, "Error binding ARP socket to interface: %s", std::strerror(errno));
 		return false;
 	}
 
 	// Disable packet reception
-	shutdown(s, SHUT_RD);
+	shutdown(m_socket, SHUT_RD);
 
 	// Enable broadcast
 	int val = 1;
-	setsockopt(s, SOL_SOCKET, SO_BROADCAST, &val, sizeof(val));
+	setsockopt(m_socket, SOL_SOCKET, SO_BROADCAST, &val, sizeof(val));
 
-	// Get MAC
+	return updateHardwareAddress();
+}
+
+bool ArpSocket::updateHardwareAddress ()
+{
 	ifreq req;
-	if_indextoname(interface, req.ifr_name);
-	if (ioctl(s, SIOCGIFHWADDR, &req) == -1)
+	if (if_indextoname(m_interface, req.ifr_name) == 0 || ioctl(m_socket, SIOCGIFHWADDR, &req) == -1)
 	{
-		syslog(LOG_ERR, "Error getting hardware address from interface: %s", std::strerror(errno));
-		close(s);
+		LOG(LOG_ERR, "Error getting hardware address from interface: %s", std::strerror(errno));
 		return false;
 	}
 
-	// Prepare ARP packet
+	if (std::memcmp(m_hardwareAddress, req.ifr_hwaddr.sa_data, 6) != 0)
+	{
+		std::memcpy(m_hardwareAddress, req.ifr_hwaddr.sa_data, 6);
+		for (unsigned int i = 0; i != MaxPackets; ++i)
+			std::memcpy(m_packets[i].senderHardwareAddress, m_hardwareAddress, 6);
+	}
 
-	struct ArpPacket
+	return true;
+}
+
+bool ArpSocket::send (const IpAddressSet &addresses)
+{
+	// Link changes leave ENETDOWN pending on the socket, which would otherwise fail the first packet
+	int error;
+	socklen_t errorSize = sizeof(error);
+	getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &error, &errorSize);
+
+	bool ret = true;
+	IpAddressSet::const_iterator address = addresses.begin();
+	while (address != addresses.end())
 	{
-		std::uint16_t hardwareType;
-		std::uint16_t protocolType;
-		std::uint8_t hardwareAddressLength;
-		std::uint8_t protocolAddressLength;
-		std::uint16_t operation;
-		std::uint8_t senderHardwareAddress[6];
-		std::uint8_t senderProtocolAddress[4];
-		std::uint8_t targetHardwareAddress[6];
-		std::uint8_t targetProtocolAddress[4];
-	} packet;
-
-	packet.hardwareType = htons(ARPHRD_ETHER);
-	packet.protocolType = htons(ETHERTYPE_IP);
-	packet.hardwareAddressLength = 6;
-	packet.protocolAddressLength = 4;
-	packet.operation = htons(ARPOP_REPLY);
-	std::memcpy(&packet.senderHardwareAddress, req.ifr_hwaddr.sa_data, 6);
-	std::memcpy(&packet.senderProtocolAddress, address.data(), 4);
-	std::memset(&packet.targetHardwareAddress, 0, 6);
-	std::memcpy(&packet.targetProtocolAddress, address.data(), 4);
-
-	// Broadcast packet
-	std::memset(&addr.sll_addr, 0xFF, 6);
-	addr.sll_halen = 6;
-
-	bool ret;
-	if (sendto(s, &packet, sizeof(packet), 0, reinterpret_cast<const struct sockaddr *>(&addr), sizeof(addr)) == -1)
+		unsigned int count = 0;
+		for (; address != addresses.end() && count != MaxPackets; ++address)
+		{
+			if (address->family() != AF_INET)
+			{
+				ret = false;
+				continue;
+			}
+
+			std::memcpy(m_packets[count].senderProtocolAddress, address->data(), 4);
+			std::memcpy(m_packets[count].targetProtocolAddress, address->data(), 4);
+			++count;
+		}
+
+		// Blocking like a single sendto() would be, so a short send buffer doesn't lose announcements
+		unsigned int sent = 0;
+		while (sent != count)
+		{
+			int result = sendmmsg(m_socket, &m_headers[sent], count - sent, 0);
+			if (result > 0)
+				sent += result;
+			else if (errno != EINTR)
+			{
+				LOG(LOG_ERR, "Error sending ARP packet: %s", std::strerror(errno));
+				return false;
+			}
+		}
+	}
+
+	return ret;
+}
+
+void ArpSocket::interfaceCallback (int, bool, void *userData)
+{
+	// Any change of the link may be a new hardware address. Refreshing here keeps the ioctl off the failover path
+	reinterpret_cast<ArpSocket *>(userData)->updateHardwareAddress();
+}
+
+bool ArpSocket::addInterface (int interface)
+{
+	SocketMap::iterator it = sockets.find(interface);
+	if (it != sockets.end())
 	{
-		syslog(LOG_ERR, "Error sending ARP packet: %s", std::strerror(errno));
-		ret = false;
+		++it->second->m_references;
+		return true;
 	}
-	else
-		ret = true;
 
-	close(s);
+	ArpSocket *socket = new ArpSocket(interface);
+	if (!socket->open())
+	{
+		delete socket;
+		return false;
+	}
 
-	return ret;
+	socket->m_monitored = Netlink::addInterfaceMonitor(interface, interfaceCallback, socket);
+	socket->m_references = 1;
+	sockets[interface] = socket;
+	return true;
+}
+
+void ArpSocket::removeInterface (int interface)
+{
+	SocketMap::iterator it = sockets.find(interface);
+	if (it != sockets.end() && --it->second->m_references == 0)
+	{
+		delete it->second;
+		sockets.erase(it);
+	}
+}
+
+bool ArpSocket::sendGratuitiousArps (int interface, const IpAddressSet &addresses)
+{
+	SocketMap::const_iterator it = sockets.find(interface);
+	if (it != sockets.end())
+		return it->second->send(addresses);
+
+	ArpSocket socket(interface);
+	return socket.open() && socket.send(addresses);
+}
+
+bool ArpSocket::sendGratuitiousArp (int interface, const IpAddress &address)
+{
+	IpAddressSet addresses;
+	addresses.insert(address);
+	return sendGratuitiousArps(interface, addresses);
 }
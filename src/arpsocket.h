@@ -21,10 +21,85 @@
 
 #include "ipaddress.h"
 
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <netpacket/packet.h>
+#include <sys/socket.h>
+
+/**
+  * Gratuitous ARP transmitter
+  *
+  * Interfaces added with addInterface() keep an open packet socket and a
+  * cached hardware address, which is refreshed whenever netlink reports a
+  * change of the link. Announcing the addresses of a new master then takes a
+  * single sendmmsg() instead of a socket, bind, ioctl, send and close per
+  * address.
+  */
 class ArpSocket
 {
 	public:
-		static bool sendGratuitiousArp (unsigned int interface, const IpAddress &address);
+		/**
+		  * Keep a transmitter open for an interface
+		  *
+		  * Calls are counted, so every call must be matched by removeInterface()
+		  * @return true on success
+		  */
+		static bool addInterface (int interface);
+		static void removeInterface (int interface);
+
+		/**
+		  * Send a gratuitous ARP reply for each address in one go
+		  *
+		  * Interfaces without a transmitter get a temporary one
+		  * @return true if all replies were sent
+		  */
+		static bool sendGratuitiousArps (int interface, const IpAddressSet &addresses);
+		static bool sendGratuitiousArp (int interface, const IpAddress &address);
+
+	private:
+		explicit ArpSocket (int interface);
+		~ArpSocket ();
+
+		bool open ();
+		bool updateHardwareAddress ();
+		bool send (const IpAddressSet &addresses);
+
+		static void interfaceCallback (int interface, bool linkIsUp, void *userData);
+
+	private:
+		struct ArpPacket
+		{
+			std::uint16_t hardwareType;
+			std::uint16_t protocolType;
+			std::uint8_t hardwareAddressLength;
+			std::uint8_t protocolAddressLength;
+			std::uint16_t operation;
+			std::uint8_t senderHardwareAddress[6];
+			std::uint8_t senderProtocolAddress[4];
+			std::uint8_t targetHardwareAddress[6];
+			std::uint8_t targetProtocolAddress[4];
+		} __attribute__((packed));
+
+		enum
+		{
+			MaxPackets = 255 // Addresses in a VRRP advertisement
+		};
+
+		int m_interface;
+		int m_socket;
+		unsigned int m_references;
+		bool m_monitored;
+		std::uint8_t m_hardwareAddress[6];
+		sockaddr_ll m_broadcastAddress;
+
+		std::vector<ArpPacket> m_packets;
+		std::vector<iovec> m_iov;
+		std::vector<mmsghdr> m_headers;
+
+		typedef std::map<int, ArpSocket *> SocketMap;
+		static SocketMap sockets;
 };
 
 #endif // INCLUDE_OPENVRRP_ARPSOCKET_H
@@ -17,12 +17,15 @@
  */
 
 #include "configurator.h"
+#include "log.h"
 #include "vrrpmanager.h"
 #include "vrrpservice.h"
 
 #include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <set>
+#include <utility>
 
 #include <net/if.h>
 
@@ -30,7 +33,7 @@
    Configuration format is as follows:
 
    config {
-	int version; // 2
+	int version; // 4
 	int routerCount;
 	router[routerCount] router;
    }
@@ -47,6 +50,10 @@
     IpAddress primaryIp; // Only if bit 0 of flags is set
 	string masterCommand;
 	string backupCommand;
+	int vlanId; // Since version 3
+	int arpBurstCount; // Since version 4
+	int arpBurstSpacing; // Since version 4
+	int arpRefreshInterval; // Since version 4
 	int addressCount;
 	IpSubnet[addressCount] subnets;
    }
@@ -62,8 +69,12 @@ bool Configurator::readConfiguration (const char *filename)
 	if (!file.good())
 		return false;
 
+	// Routers and addresses missing from the file are only removed once all of it has been read
+	std::set<VrrpService *> configured;
+	std::vector<std::pair<VrrpService *, IpSubnetSet> > addressLists;
+
 	int version;
-	if (!readInt(file, version) || (version != 1 && version != 2 && version != 3))
+	if (!readInt(file, version) || (version < 1 || version > 4))
 		return false;
 
 	int routerCount;
@@ -86,7 +97,10 @@ bool Configurator::readConfiguration (const char *filename)
 		IpSubnetSet subnets;
 		std::string masterCommand;
 		std::string backupCommand;
-		int vlanId;
+		int vlanId = 0;
+		int arpBurstCount = 1;
+		int arpBurstSpacing = 1000;
+		int arpRefreshInterval = 0;
 
 		// Read data
 		if (
@@ -121,6 +135,12 @@ bool Configurator::readConfiguration (const char *filename)
 				return false;
 		}
 
+		if (version > 3)
+		{
+			if (!readInt(file, arpBurstCount) || !readInt(file, arpBurstSpacing) || !readInt(file, arpRefreshInterval))
+				return false;
+		}
+
 		if (!readInt(file, addressCount))
 			return false;
 
@@ -133,6 +153,15 @@ bool Configurator::readConfiguration (const char *filename)
 			subnets.insert(subnet);
 		}
 
+		// An entry with a bad setting keeps its router running as it is, rather than taking it down
+		int ifIndex = if_nametoindex(interface.c_str());
+		if (ifIndex > 0 && vrid >= 1 && vrid <= 255)
+		{
+			VrrpService *existing = VrrpManager::getService(ifIndex, vrid, vlanId, addressFamily, false);
+			if (existing != 0)
+				configured.insert(existing);
+		}
+
 		// Sanitize
 
 		if (vrid < 1 || vrid > 255)
@@ -159,7 +188,13 @@ bool Configurator::readConfiguration (const char *filename)
 			continue;
 		}
 
-		int ifIndex = if_nametoindex(interface.c_str());
+		if (arpBurstCount < 1 || arpBurstCount > 255 || arpBurstSpacing < 10 || arpBurstSpacing > 60000
+				|| arpRefreshInterval < 0 || (arpRefreshInterval != 0 && arpRefreshInterval < 1000) || arpRefreshInterval > 3600000)
+		{
+			// TODO - Add to log
+			continue;
+		}
+
 		if (ifIndex <= 0)
 		{
 			// TODO - Add to log
@@ -174,11 +209,16 @@ bool Configurator::readConfiguration (const char *filename)
 			// TODO - Add to log
 			continue;
 		}
+		configured.insert(service);
+		addressLists.push_back(std::make_pair(service, subnets));
 
 		service->setPriority(priority);
 		service->setAdvertisementInterval(interval / 10);
 		service->setAcceptMode(accept);
 		service->setPreemptMode(preempt);
+		service->setArpBurstCount(arpBurstCount);
+		service->setArpBurstSpacing(arpBurstSpacing);
+		service->setArpRefreshInterval(arpRefreshInterval);
 		if (flags & FLAG_HAS_PRIMARY_IP_ADDRESS)
 			service->setPrimaryIpAddress(primaryIp);
 		service->setMasterCommand(masterCommand);
@@ -193,6 +233,26 @@ bool Configurator::readConfiguration (const char *filename)
 			service->disable();
 	}
 
+	for (std::vector<std::pair<VrrpService *, IpSubnetSet> >::const_iterator it = addressLists.begin(); it != addressLists.end(); ++it)
+	{
+		IpSubnetSet current = it->first->subnets();
+		for (IpSubnetSet::const_iterator subnet = current.begin(); subnet != current.end(); ++subnet)
+		{
+			if (it->second.find(*subnet) == it->second.end())
+				it->first->removeIpAddress(*subnet);
+		}
+	}
+
+	std::vector<VrrpService *> services = Configurator::services();
+	for (std::vector<VrrpService *>::const_iterator service = services.begin(); service != services.end(); ++service)
+	{
+		if (configured.find(*service) == configured.end())
+		{
+			LOG_UNLIMITED(LOG_INFO, "Removing %s router with VID %hhu on interface %i, as it is no longer configured", (*service)->family() == AF_INET ? "IPv4" : "IPv6", (*service)->virtualRouterId(), (*service)->interface());
+			VrrpManager::removeService(*service);
+		}
+	}
+
 	return true;
 }
 
@@ -221,7 +281,7 @@ bool Configurator::writeConfiguration (const char *filename)
 	if (!file.good())
 		return false;
 
-	if (!writeInt(file, 3))
+	if (!writeInt(file, 4))
 		return false;
 
 	std::vector<VrrpService *> services = Configurator::services();
@@ -260,7 +320,10 @@ bool Configurator::writeConfiguration (const char *filename)
 		if (
 				!writeString(file, service->masterCommand())
 				|| !writeString(file, service->backupCommand())
-				|| !writeInt(file, service->vlanId()))
+				|| !writeInt(file, service->vlanId())
+				|| !writeInt(file, service->arpBurstCount())
+				|| !writeInt(file, service->arpBurstSpacing())
+				|| !writeInt(file, service->arpRefreshInterval()))
 		{
 			return false;
 		}
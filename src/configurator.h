@@ -31,6 +31,16 @@ class Configurator
 {
 	public:
 		static void setConfigurationFile (const char *filename);
+		/**
+		  * Apply a configuration file
+		  *
+		  * Routers the file lists are created or updated. Once the whole file has
+		  * been read, routers it no longer lists are removed, and so are addresses
+		  * it no longer lists for a router. Nothing is removed if the file has
+		  * errors
+		  * @param filename File to read, or 0 for the file set by setConfigurationFile()
+		  * @return true on success
+		  */
 		static bool readConfiguration (const char *filename = 0);
 		static bool writeConfiguration (const char *filename = 0);
 
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "histogram.h"
+
+#include <cstring>
+
+Histogram::Histogram ()
+{
+	reset();
+}
+
+std::uint64_t Histogram::percentile (double percent) const
+{
+	if (m_count == 0)
+		return 0;
+
+	std::uint64_t target = static_cast<std::uint64_t>(m_count * percent / 100.0 + 0.5);
+	if (target == 0)
+		target = 1;
+
+	std::uint64_t seen = 0;
+	for (unsigned int i = 0; i != BucketCount; ++i)
+	{
+		seen += m_buckets[i];
+		if (seen >= target)
+		{
+			std::uint64_t bound = upperBound(i);
+			return bound < m_max ? bound : m_max;
+		}
+	}
+
+	return m_max;
+}
+
+void Histogram::reset ()
+{
+	std::memset(m_buckets, 0, sizeof(m_buckets));
+	m_count = 0;
+	m_max = 0;
+}
+
+std::uint64_t Histogram::upperBound (unsigned int bucket)
+{
+	if (bucket < SubBuckets)
+		return bucket;
+
+	unsigned int shift = bucket / SubBuckets - 1;
+	std::uint64_t base = static_cast<std::uint64_t>(SubBuckets | (bucket % SubBuckets)) << shift;
+	return base + ((static_cast<std::uint64_t>(1) << shift) - 1);
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INCLUDE_HISTOGRAM_H
+#define INCLUDE_HISTOGRAM_H
+
+#include <cstdint>
+
+/**
+  * Log-linear histogram of durations
+  *
+  * Each power of two is split into SubBuckets linear buckets, so values are
+  * recorded with a relative error of at most 1/SubBuckets. Recording a value
+  * is a handful of instructions and never allocates.
+  */
+class Histogram
+{
+	public:
+		Histogram ();
+
+		/**
+		  * Record a value
+		  * @param value Value, typically in microseconds
+		  */
+		inline void add (std::uint64_t value)
+		{
+			++m_buckets[bucket(value)];
+			++m_count;
+			if (value > m_max)
+				m_max = value;
+		}
+
+		/**
+		  * Get number of recorded values
+		  * @return Number of values
+		  */
+		inline std::uint64_t count () const
+		{
+			return m_count;
+		}
+
+		/**
+		  * Get largest recorded value
+		  * @return Largest value
+		  */
+		inline std::uint64_t max () const
+		{
+			return m_max;
+		}
+
+		/**
+		  * Get value below which a given percentage of the recorded values lie
+		  * @param percent Percentage between 0 and 100
+		  * @return Upper bound of the bucket holding the percentile, or 0 if nothing was recorded
+		  */
+		std::uint64_t percentile (double percent) const;
+
+		/**
+		  * Forget all recorded values
+		  */
+		void reset ();
+
+	private:
+		enum
+		{
+			SubBucketBits = 3,
+			SubBuckets = 1 << SubBucketBits,
+			BucketCount = (64 - SubBucketBits + 1) * SubBuckets
+		};
+
+		static inline unsigned int bucket (std::uint64_t value)
+		{
+			if (value < SubBuckets)
+				return static_cast<unsigned int>(value);
+
+			unsigned int msb = 63 - __builtin_clzll(value);
+			unsigned int shift = msb - SubBucketBits;
+			return (shift + 1) * SubBuckets + static_cast<unsigned int>((value >> shift) & (SubBuckets - 1));
+		}
+
+		static std::uint64_t upperBound (unsigned int bucket);
+
+	private:
+		std::uint64_t m_buckets[BucketCount];
+		std::uint64_t m_count;
+		std::uint64_t m_max;
+};
+
+#endif // INCLUDE_HISTOGRAM_H
@@ -128,7 +128,7 @@ bool IpAddress::operator > (const IpAddress &other) const
 
 bool IpAddress::operator == (const IpAddress &other) const
 {
-	return family() == other.family() && std::memcmp(data(), other.data(), size());
+	return family() == other.family() && std::memcmp(data(), other.data(), size()) == 0;
 }
 
 std::string IpAddress::toString () const
@@ -160,3 +160,23 @@ sockaddr *IpAddress::socketAddress ()
 {
 	return &m_addr.common;
 }
+
+std::uint64_t IpAddressListView::hash () const
+{
+	// Sum of a hash per address, so the order of the addresses doesn't matter
+	std::uint64_t sum = 0;
+	unsigned int addressSize = IpAddress::familySize(m_family);
+	for (std::size_t i = 0; i != m_count; ++i)
+	{
+		// FNV-1a with a final mix, so sums of similar addresses don't collide easily
+		std::uint64_t hash = 14695981039346656037ULL;
+		const std::uint8_t *address = m_data + i * addressSize;
+		for (unsigned int j = 0; j != addressSize; ++j)
+			hash = (hash ^ address[j]) * 1099511628211ULL;
+		hash ^= hash >> 33;
+		hash *= 0xFF51AFD7ED558CCDULL;
+		hash ^= hash >> 33;
+		sum += hash;
+	}
+	return sum;
+}
@@ -20,8 +20,10 @@
 #define INCLUDE_OPENVRRP_IPADDRESS_H
 
 #include <string>
+#include <iterator>
 #include <list>
 #include <set>
+#include <cstddef>
 #include <cstdint>
 
 #include <netinet/in.h>
@@ -111,4 +113,127 @@ class IpAddress
 typedef std::list<IpAddress> IpAddressList;
 typedef std::set<IpAddress> IpAddressSet;
 
+/**
+  * Non-owning view of a packed array of addresses, like the address list of
+  * a VRRP advertisement
+  *
+  * Addresses are only built on access. The view is only valid as long as
+  * the memory it refers to.
+  */
+class IpAddressListView
+{
+	public:
+		class const_iterator
+		{
+			public:
+				typedef std::forward_iterator_tag iterator_category;
+				typedef IpAddress value_type;
+				typedef std::ptrdiff_t difference_type;
+				typedef const IpAddress *pointer;
+				typedef IpAddress reference;
+
+				const_iterator (const std::uint8_t *ptr, int family) :
+					m_ptr(ptr),
+					m_family(family)
+				{
+				}
+
+				IpAddress operator * () const
+				{
+					return IpAddress(m_ptr, m_family);
+				}
+
+				const_iterator &operator ++ ()
+				{
+					m_ptr += IpAddress::familySize(m_family);
+					return *this;
+				}
+
+				bool operator == (const const_iterator &other) const
+				{
+					return m_ptr == other.m_ptr;
+				}
+
+				bool operator != (const const_iterator &other) const
+				{
+					return m_ptr != other.m_ptr;
+				}
+
+			private:
+				const std::uint8_t *m_ptr;
+				int m_family;
+		};
+
+		/**
+		  * @param data First address
+		  * @param size Size of the memory at data in bytes. A partial address at the end is ignored
+		  * @param family Address family of all the addresses
+		  */
+		IpAddressListView (const std::uint8_t *data, std::size_t size, int family) :
+			m_data(data),
+			m_count(IpAddress::familySize(family) == 0 ? 0 : size / IpAddress::familySize(family)),
+			m_family(family)
+		{
+		}
+
+		std::size_t size () const
+		{
+			return m_count;
+		}
+
+		bool empty () const
+		{
+			return m_count == 0;
+		}
+
+		int family () const
+		{
+			return m_family;
+		}
+
+		/**
+		  * Get the addresses in wire format
+		  */
+		const std::uint8_t *data () const
+		{
+			return m_data;
+		}
+
+		std::size_t byteSize () const
+		{
+			return m_count * IpAddress::familySize(m_family);
+		}
+
+		/**
+		  * Get a hash of the addresses that doesn't depend on their order
+		  */
+		std::uint64_t hash () const;
+
+		/**
+		  * Get an address
+		  * @return The address, or an AF_UNSPEC address if index is out of range
+		  */
+		IpAddress at (std::size_t index) const
+		{
+			if (index >= m_count)
+				return IpAddress();
+			return IpAddress(m_data + index * IpAddress::familySize(m_family), m_family);
+		}
+
+		const_iterator begin () const
+		{
+			return const_iterator(m_data, m_family);
+		}
+
+		const_iterator end () const
+		{
+			return const_iterator(m_data + m_count * IpAddress::familySize(m_family), m_family);
+		}
+
+	private:
+		const std::uint8_t *m_data;
+		std::size_t m_count;
+		int m_family;
+};
+
 #endif // INCLUDE_OPENVRRP_IP_H
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "log.h"
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+bool Log::m_running = false;
+pthread_t Log::m_thread;
+int Log::m_wakeFd = -1;
+unsigned int Log::m_rate = 0;
+unsigned int Log::m_burst = 1;
+Log::Record Log::m_ring[RingSize];
+std::atomic<unsigned int> Log::m_head(0);
+std::atomic<unsigned int> Log::m_tail(0);
+std::atomic<bool> Log::m_sleeping(false);
+std::atomic<bool> Log::m_stopping(false);
+std::atomic<std::uint64_t> Log::m_dropped(0);
+std::atomic<Log::Site *> Log::m_suppressingSites(0);
+
+static std::uint64_t monotonicMilliseconds ()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return static_cast<std::uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool Log::open (const char *ident, int option, int facility)
+{
+	openlog(ident, option, facility);
+
+	if (m_running)
+		return true;
+
+	m_wakeFd = eventfd(0, EFD_CLOEXEC);
+	if (m_wakeFd == -1)
+	{
+		syslog(LOG_WARNING, "Log: Error creating eventfd: %s. Logging synchronously", std::strerror(errno));
+		return false;
+	}
+
+	static bool atForkRegistered = false;
+	if (!atForkRegistered)
+	{
+		pthread_atfork(0, 0, forkChild);
+		atForkRegistered = true;
+	}
+
+	// Signals are handled by the main loop through a signalfd, so they must stay blocked in the flusher
+	sigset_t signals;
+	sigset_t oldSignals;
+	sigfillset(&signals);
+	pthread_sigmask(SIG_SETMASK, &signals, &oldSignals);
+
+	m_stopping = false;
+	int error = pthread_create(&m_thread, 0, flusher, 0);
+
+	pthread_sigmask(SIG_SETMASK, &oldSignals, 0);
+
+	if (error != 0)
+	{
+		syslog(LOG_WARNING, "Log: Error creating thread: %s. Logging synchronously", std::strerror(error));
+		::close(m_wakeFd);
+		m_wakeFd = -1;
+		return false;
+	}
+
+	m_running = true;
+	return true;
+}
+
+void Log::close ()
+{
+	if (!m_running)
+		return;
+
+	m_stopping = true;
+	std::uint64_t value = 1;
+	while (::write(m_wakeFd, &value, sizeof(value)) == -1 && errno == EINTR);
+	pthread_join(m_thread, 0);
+
+	m_running = false;
+	::close(m_wakeFd);
+	m_wakeFd = -1;
+}
+
+void Log::setRateLimit (unsigned int rate, unsigned int burst)
+{
+	m_rate = rate;
+	if (burst == 0)
+		m_burst = 1;
+	else if (burst > 1000000)
+		m_burst = 1000000;
+	else
+		m_burst = burst;
+}
+
+bool Log::admit (Site &site, int priority)
+{
+	if (m_rate == 0)
+		return true;
+
+	std::uint64_t now = monotonicMilliseconds() + 1;
+
+	std::uint64_t limit = m_burst * 1000ULL;
+	std::uint64_t tokens = (site.refilled == 0 ? limit : site.tokens + (now - site.refilled) * m_rate);
+	site.tokens = (tokens > limit ? limit : tokens);
+	site.refilled = now;
+
+	if (site.tokens < 1000)
+	{
+		// The flusher reports the count if the site goes quiet, so it has to be able to find the site
+		if (!site.listed)
+		{
+			site.priority = priority;
+			site.listed = true;
+			site.next = m_suppressingSites.load(std::memory_order_relaxed);
+			while (!m_suppressingSites.compare_exchange_weak(site.next, &site, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		__atomic_add_fetch(&site.suppressed, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	site.tokens -= 1000;
+	return true;
+}
+
+void Log::write (Site &site, int priority, const char *format, ...)
+{
+	// Formatting the summary could clobber errno for %m
+	int error = errno;
+
+	std::uint32_t suppressed = (site.listed ? __atomic_exchange_n(&site.suppressed, 0, __ATOMIC_RELAXED) : 0);
+
+	va_list args;
+	va_start(args, format);
+
+	if (!m_running)
+	{
+		if (suppressed != 0)
+			syslog(priority, "%s:%i: Suppressed %u messages", site.file, site.line, suppressed);
+		errno = error;
+		vsyslog(priority, format, args);
+	}
+	else
+	{
+		Record *record;
+		if (suppressed != 0 && (record = reserve()) != 0)
+		{
+			record->priority = priority;
+			std::snprintf(record->message, MessageSize, "%s:%i: Suppressed %u messages", site.file, site.line, suppressed);
+			commit();
+		}
+
+		record = reserve();
+		if (record != 0)
+		{
+			record->priority = priority;
+			errno = error;
+			std::vsnprintf(record->message, MessageSize, format, args);
+			commit();
+		}
+	}
+
+	va_end(args);
+}
+
+std::uint64_t Log::dropped ()
+{
+	return m_dropped.load(std::memory_order_relaxed);
+}
+
+Log::Record *Log::reserve ()
+{
+	unsigned int head = m_head.load(std::memory_order_relaxed);
+	if (head - m_tail.load(std::memory_order_acquire) == RingSize)
+	{
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+
+	return &m_ring[head & (RingSize - 1)];
+}
+
+void Log::commit ()
+{
+	m_head.store(m_head.load(std::memory_order_relaxed) + 1);
+
+	// Only pay for a system call when the flusher went to sleep on an empty ring
+	if (m_sleeping.load() && m_sleeping.exchange(false))
+	{
+		std::uint64_t value = 1;
+		while (::write(m_wakeFd, &value, sizeof(value)) == -1 && errno == EINTR);
+	}
+}
+
+void Log::forkChild ()
+{
+	// The flusher isn't running in the child
+	m_running = false;
+}
+
+void Log::reportSuppressed ()
+{
+	for (Site *site = m_suppressingSites.load(std::memory_order_acquire); site != 0; site = site->next)
+	{
+		std::uint32_t suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+		if (suppressed != 0)
+			syslog(site->priority, "%s:%i: Suppressed %u messages", site->file, site->line, suppressed);
+	}
+}
+
+void *Log::flusher (void *)
+{
+	std::uint64_t reported = m_dropped.load(std::memory_order_relaxed);
+	std::uint64_t summarized = monotonicMilliseconds();
+	unsigned int tail = m_tail.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		while (tail != m_head.load(std::memory_order_acquire))
+		{
+			const Record &record = m_ring[tail & (RingSize - 1)];
+			syslog(record.priority, "%s", record.message);
+			m_tail.store(++tail, std::memory_order_release);
+		}
+
+		std::uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+		if (dropped != reported)
+		{
+			syslog(LOG_WARNING, "Log: Dropped %llu messages", static_cast<unsigned long long>(dropped - reported));
+			reported = dropped;
+		}
+
+		// Call sites that went quiet after suppressing messages would otherwise never report them
+		std::uint64_t now = monotonicMilliseconds();
+		if (m_stopping || now - summarized >= SummaryInterval)
+		{
+			reportSuppressed();
+			summarized = now;
+		}
+
+		if (m_stopping)
+			break;
+
+		// The producer checks m_sleeping after publishing, so either it sees the flag or we see its message
+		m_sleeping = true;
+		if (tail != m_head.load() || m_stopping)
+		{
+			m_sleeping = false;
+			continue;
+		}
+
+		// Only wake up on our own for the next report once some call site has suppressed messages
+		pollfd pfd = {m_wakeFd, POLLIN, 0};
+		int timeout = (m_suppressingSites.load(std::memory_order_relaxed) != 0 ? static_cast<int>(summarized + SummaryInterval - now) : -1);
+		if (poll(&pfd, 1, timeout) > 0)
+		{
+			std::uint64_t value;
+			while (read(m_wakeFd, &value, sizeof(value)) == -1 && errno == EINTR);
+		}
+	}
+
+	return 0;
+}
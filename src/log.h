@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INCLUDE_OPENVRRP_LOG_H
+#define INCLUDE_OPENVRRP_LOG_H
+
+#include <atomic>
+#include <cstdint>
+
+#include <pthread.h>
+#include <syslog.h>
+
+// Messages less important than this are compiled out, e.g. -DLOG_MAX_PRIORITY=LOG_INFO
+#ifndef LOG_MAX_PRIORITY
+#define LOG_MAX_PRIORITY LOG_DEBUG
+#endif
+
+/**
+  * Log a message
+  *
+  * Takes the same arguments as syslog(). The arguments aren't evaluated
+  * when the message is rate limited or compiled out.
+  */
+#define LOG(priority, ...) \
+	do \
+	{ \
+		if ((priority) <= LOG_MAX_PRIORITY) \
+		{ \
+			static Log::Site logSite = {__FILE__, __LINE__, 0, 0, 0, 0, 0, false}; \
+			if (Log::admit(logSite, (priority))) \
+				Log::write(logSite, (priority), __VA_ARGS__); \
+		} \
+	} while (0)
+
+/**
+  * Log a message without rate limiting
+  *
+  * For output the user asked for, and for records operators rely on, like
+  * state changes, which must not be lost in a storm of other messages.
+  */
+#define LOG_UNLIMITED(priority, ...) \
+	do \
+	{ \
+		if ((priority) <= LOG_MAX_PRIORITY) \
+		{ \
+			static Log::Site logSite = {__FILE__, __LINE__, 0, 0, 0, 0, 0, false}; \
+			Log::write(logSite, (priority), __VA_ARGS__); \
+		} \
+	} while (0)
+
+/**
+  * Asynchronous, rate limited logging
+  *
+  * Messages are formatted into a lock-free ring buffer, and a background
+  * thread passes them on to syslog, so the main loop never blocks on
+  * /dev/log. With a rate limit set, every call site has a token bucket.
+  * Messages beyond its rate are counted, and the count is logged before the
+  * next message from the same call site gets through, or by the flusher
+  * thread within a second if the call site goes quiet. Messages that don't
+  * fit in the ring are dropped and counted as well.
+  *
+  * Until open() is called, and in forked children, messages go straight to
+  * syslog.
+  */
+class Log
+{
+	public:
+		/**
+		  * Rate limiting state of a call site
+		  */
+		struct Site
+		{
+			const char *file;
+			int line;
+			std::uint32_t tokens; // In thousandths of a message
+			std::uint32_t suppressed; // Shared with the flusher thread, so only accessed atomically
+			std::uint64_t refilled; // Milliseconds, 0 if never used
+			int priority; // Of the suppressed messages
+			Site *next; // Next site in the list of sites that suppressed messages
+			bool listed;
+		};
+
+		/**
+		  * Open syslog and start the flusher thread
+		  *
+		  * Takes the same arguments as openlog()
+		  * @return true on success. On failure messages are logged synchronously
+		  */
+		static bool open (const char *ident, int option, int facility);
+
+		/**
+		  * Write out all queued messages and stop the flusher thread
+		  */
+		static void close ();
+
+		/**
+		  * Set rate limit of every call site
+		  * @param rate Messages per second, or 0 for no limit
+		  * @param burst Messages that may be logged at once
+		  */
+		static void setRateLimit (unsigned int rate, unsigned int burst);
+
+		/**
+		  * Take a token from the bucket of a call site
+		  * @param site Call site
+		  * @param priority Priority of the message
+		  * @return true if the message may be logged
+		  */
+		static bool admit (Site &site, int priority);
+
+		static void write (Site &site, int priority, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+		/**
+		  * Get number of messages dropped because the ring was full
+		  */
+		static std::uint64_t dropped ();
+
+	private:
+		enum
+		{
+			RingSize = 512, // Must be a power of two
+			MessageSize = 508,
+			SummaryInterval = 1000 // Milliseconds between reports of suppressed messages by the flusher
+		};
+
+		struct Record
+		{
+			int priority;
+			char message[MessageSize];
+		};
+
+		static Record *reserve ();
+		static void commit ();
+		static void forkChild ();
+		static void *flusher (void *);
+		static void reportSuppressed ();
+
+	private:
+		static bool m_running;
+		static pthread_t m_thread;
+		static int m_wakeFd;
+		static unsigned int m_rate;
+		static unsigned int m_burst;
+		static Record m_ring[RingSize];
+		static std::atomic<unsigned int> m_head;
+		static std::atomic<unsigned int> m_tail;
+		static std::atomic<bool> m_sleeping;
+		static std::atomic<bool> m_stopping;
+		static std::atomic<std::uint64_t> m_dropped;
+		static std::atomic<Site *> m_suppressingSites;
+};
+
+#endif // INCLUDE_OPENVRRP_LOG_H
@@ -23,22 +23,45 @@
 #include "ipaddress.h"
 #include "telnetserver.h"
 #include "configurator.h"
+#include "realtime.h"
+#include "log.h"
 
 #include <iostream>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 
 #include <getopt.h>
 #include <net/if.h>
 #include <arpa/inet.h>
-#include <syslog.h>
+#include <signal.h>
 
 #define DEFAULT_CONFIG_FILE "configuration.dat"
 #define DEFAULT_BIND_ADDR "127.0.0.1:7777"
+#define DEFAULT_REALTIME_PRIORITY "50"
 
 static void cleanup ()
 {
 	VrrpManager::cleanup();
 	VrrpSocket::cleanup();
+	Log::close();
+}
+
+static void onTerminate (int)
+{
+	VrrpManager::shutdown();
+}
+
+static void onReload (int)
+{
+	LOG(LOG_INFO, "Reloading configuration");
+	if (!Configurator::readConfiguration())
+		LOG(LOG_ERR, "Error reloading configuration");
+}
+
+static void onDumpStatistics (int)
+{
+	VrrpManager::logStatistics();
 }
 
 static void showHelp ()
@@ -50,6 +73,29 @@ static void showHelp ()
 		"  -c, --config=FILE  Set configuration data file to FILE (Default: " DEFAULT_CONFIG_FILE ")\n"
 		"  -s, --stdout       Log to stdout instead of syslog\n"
 		"  -b, --bind=ADDR    Bind to address / port (Default: " DEFAULT_BIND_ADDR ")\n"
+		"  -r, --realtime[=PRIO]\n"
+		"                     Run with SCHED_FIFO priority PRIO (Default: " DEFAULT_REALTIME_PRIORITY ") and locked,\n"
+		"                     prefaulted memory\n"
+		"  -a, --affinity=CPUS\n"
+		"                     Run on CPUS only, e.g. 0,2-3\n"
+		"  -n, --receive-batch=N\n"
+		"                     Receive up to N VRRP packets per system call (Default: 32)\n"
+		"  -S, --send-buffer=BYTES\n"
+		"                     Set the send buffer of the VRRP sockets to BYTES\n"
+		"                     (Default: net.core.wmem_default)\n"
+		"  -k, --kernel-filter\n"
+		"                     Drop unwanted VRRP packets in the kernel with an eBPF filter\n"
+		"  -i, --ingest=NAME  Receive VRRP packets with NAME (socket or ring) (Default: socket)\n"
+		"  -p, --capture=FILE Record received VRRP packets to FILE in pcapng format\n"
+		"  -w, --coalesce=MSEC[/PHASES]\n"
+		"                     Align advertisements onto ticks MSEC apart, spread over\n"
+		"                     PHASES groups per tick. Only intervals that are a multiple\n"
+		"                     of MSEC are coalesced (Default: no coalescing)\n"
+		"  -L, --log-rate=RATE[/BURST]\n"
+		"                     Log at most RATE messages per second from each place in\n"
+		"                     the code, in bursts of up to BURST (Default: no limit).\n"
+		"                     BURST defaults to 10 * RATE, and RATE 0 disables the limit.\n"
+		"                     State changes are never limited\n"
 		"  -h, --help         Display this message" << std::endl;			
 }
 
@@ -58,6 +104,17 @@ int main (int argc, char *argv[])
 	bool logToStdout = false;
 	const char *configuration = DEFAULT_CONFIG_FILE;
 	const char *bindAddr = DEFAULT_BIND_ADDR;
+	int realtimePriority = 0;
+	const char *affinity = 0;
+	int receiveBatch = 0;
+	int sendBuffer = 0;
+	bool kernelFilter = false;
+	VrrpSocket::Ingest ingest = VrrpSocket::SocketIngest;
+	const char *captureFile = 0;
+	unsigned int coalesceWindow = 0;
+	unsigned int coalescePhases = 1;
+	unsigned int logRate = 0;
+	unsigned int logBurst = 0;
 	for (;;)
 	{
 		static const option longOptions[] = {
@@ -65,11 +122,20 @@ int main (int argc, char *argv[])
 			{"config", required_argument, 0, 'c'},
 			{"bind", required_argument, 0, 'b'},
 			{"stdout", no_argument, 0, 's'},
+			{"realtime", optional_argument, 0, 'r'},
+			{"affinity", required_argument, 0, 'a'},
+			{"receive-batch", required_argument, 0, 'n'},
+			{"send-buffer", required_argument, 0, 'S'},
+			{"kernel-filter", no_argument, 0, 'k'},
+			{"ingest", required_argument, 0, 'i'},
+			{"capture", required_argument, 0, 'p'},
+			{"coalesce", required_argument, 0, 'w'},
+			{"log-rate", required_argument, 0, 'L'},
 			{0, 0, 0, 0}
 		};
 
 		int optionIndex = 0;
-		int c = getopt_long(argc, argv, "hc:b:s", longOptions, &optionIndex);
+		int c = getopt_long(argc, argv, "hc:b:sr::a:n:S:ki:p:w:L:", longOptions, &optionIndex);
 		if (c == -1)
 			break;
 
@@ -90,6 +156,81 @@ int main (int argc, char *argv[])
 			case 's':
 				logToStdout = true;
 				break;
+
+			case 'r':
+				realtimePriority = std::atoi(optarg != 0 ? optarg : DEFAULT_REALTIME_PRIORITY);
+				if (realtimePriority < 1 || realtimePriority > 99)
+				{
+					std::cerr << "Real-time priority must be between 1 and 99" << std::endl;
+					return -1;
+				}
+				break;
+
+			case 'a':
+				affinity = optarg;
+				break;
+
+			case 'n':
+				receiveBatch = std::atoi(optarg);
+				if (receiveBatch < 1 || receiveBatch > 1024)
+				{
+					std::cerr << "Receive batch size must be between 1 and 1024" << std::endl;
+					return -1;
+				}
+				break;
+
+			case 'S':
+				sendBuffer = std::atoi(optarg);
+				if (sendBuffer < 1)
+				{
+					std::cerr << "Send buffer size must be positive" << std::endl;
+					return -1;
+				}
+				break;
+
+			case 'k':
+				kernelFilter = true;
+				break;
+
+			case 'i':
+				if (std::strcmp(optarg, "socket") == 0)
+					ingest = VrrpSocket::SocketIngest;
+				else if (std::strcmp(optarg, "ring") == 0)
+					ingest = VrrpSocket::RingIngest;
+				else
+				{
+					std::cerr << "Unknown ingest: " << optarg << std::endl;
+					return -1;
+				}
+				break;
+
+			case 'p':
+				captureFile = optarg;
+				break;
+
+			case 'w':
+				if (std::sscanf(optarg, "%u/%u", &coalesceWindow, &coalescePhases) < 1 || coalescePhases == 0)
+				{
+					std::cerr << "Invalid coalescing window: " << optarg << std::endl;
+					return -1;
+				}
+				break;
+
+			case 'L':
+				switch (std::sscanf(optarg, "%u/%u", &logRate, &logBurst))
+				{
+					case 1:
+						logBurst = logRate * 10;
+						break;
+
+					case 2:
+						break;
+
+					default:
+						std::cerr << "Invalid log rate: " << optarg << std::endl;
+						return -1;
+				}
+				break;
 		
 			default:
 				std::abort();
@@ -97,20 +238,40 @@ int main (int argc, char *argv[])
 	}
 
 	if (logToStdout)
-		openlog("openvrrp", LOG_PERROR, LOG_DAEMON);
+		Log::open("openvrrp", LOG_PERROR, LOG_DAEMON);
 	else
-		openlog("openvrrp", 0, LOG_DAEMON);
+		Log::open("openvrrp", 0, LOG_DAEMON);
+	Log::setRateLimit(logRate, logBurst);
 
 	std::atexit(cleanup);
 
+	if (affinity != 0 && !Realtime::setAffinity(affinity))
+		return -1;
+
+	if (realtimePriority != 0 && !Realtime::enable(realtimePriority))
+		return -1;
+
 	TelnetServer server(bindAddr);
 	if (!server.start())
 		return -1;
 
 	VrrpManager::removeVrrpInterfaces();
 
+	VrrpService::setCoalescing(coalesceWindow, coalescePhases);
+	if (receiveBatch != 0)
+		VrrpSocket::setReceiveBatchSize(receiveBatch);
+	VrrpSocket::setSendBufferSize(sendBuffer);
+	VrrpSocket::setKernelFilter(kernelFilter);
+	VrrpSocket::setIngest(ingest);
+	if (captureFile != 0 && !VrrpSocket::setCaptureFile(captureFile))
+		return -1;
+
 	Configurator::setConfigurationFile(configuration);
 	Configurator::readConfiguration();
 
+	MainLoop::setSignalCallback(SIGTERM, onTerminate);
+	MainLoop::setSignalCallback(SIGHUP, onReload);
+	MainLoop::setSignalCallback(SIGUSR1, onDumpStatistics);
+
 	return MainLoop::run() ? 0 : -1;
 }
@@ -17,132 +17,308 @@
  */
 
 #include "mainloop.h"
+#include "log.h"
 
 #include <cerrno>
 #include <cstring>
 
 #include <string.h>
 #include <unistd.h>
-#include <syslog.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 int MainLoop::m_fd = -1;
-MainLoop::MonitorMap MainLoop::m_monitors;
-MainLoop::TimerMap MainLoop::m_timers;
+std::uint64_t MainLoop::m_syscalls = 0;
+MainLoop::MonitorTable MainLoop::m_monitors;
+MainLoop::FlushList MainLoop::m_flushCallbacks;
+unsigned int MainLoop::m_monitorCount = 0;
+unsigned int MainLoop::m_lowPriorityBudget = 2000;
 bool MainLoop::m_aborted = false;
-int MainLoop::m_abortSignal = 0;
+MainLoop::SignalCallback *MainLoop::m_signalCallbacks[NSIG] = {0};
+Histogram MainLoop::m_callbackDurations[PriorityCount];
 
-void MainLoop::init ()
+bool MainLoop::init ()
 {
 	if (m_fd == -1)
-		m_fd = epoll_create(32);
+	{
+		m_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (m_fd == -1)
+		{
+			LOG(LOG_ERR, "MainLoop: Error creating epoll instance: %s", std::strerror(errno));
+			return false;
+		}
+	}
+	return true;
+}
+
+std::uint64_t MainLoop::syscalls ()
+{
+	return m_syscalls;
+}
+
+const Histogram &MainLoop::callbackDurations (Priority priority)
+{
+	return m_callbackDurations[priority];
+}
+
+static std::uint64_t monotonicNanoseconds ()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+bool MainLoop::addMonitor (int fd, Callback *callback, void *userData, Priority priority)
+{
+	return addMonitor(fd, callback, userData, priority, false);
+}
+
+bool MainLoop::addWriteMonitor (int fd, Callback *callback, void *userData, Priority priority)
+{
+	return addMonitor(fd, callback, userData, priority, true);
 }
 
-bool MainLoop::addMonitor (int fd, Callback *callback, void *userData)
+bool MainLoop::addMonitor (int fd, Callback *callback, void *userData, Priority priority, bool writable)
 {
-	init();
+	if (fd < 0 || !init())
+		return false;
 
-	Monitor *monitor = new Monitor();
-	monitor->callback = callback;
-	monitor->userData = userData;
-	monitor->fd = fd;
+	if (static_cast<unsigned int>(fd) >= m_monitors.size())
+	{
+		Monitor empty;
+		empty.callback = 0;
+		empty.userData = 0;
+		empty.generation = 0;
+		empty.priority = AdminPriority;
+		empty.active = false;
+		m_monitors.resize(fd + 1, empty);
+	}
+
+	Monitor &monitor = m_monitors[fd];
+
+	// Already registered, so just replace the callback without touching epoll
+	if (monitor.active)
+	{
+		monitor.callback = callback;
+		monitor.userData = userData;
+		monitor.priority = priority;
+		return true;
+	}
 
 	struct epoll_event event;
-	event.events = EPOLLIN;
-	event.data.ptr = monitor;
+	event.events = (writable ? EPOLLOUT : EPOLLIN);
+	event.data.u64 = (static_cast<std::uint64_t>(monitor.generation) << 32) | static_cast<std::uint32_t>(fd);
 
+	++m_syscalls;
 	if (epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &event) == -1)
 	{
-		syslog(LOG_ERR, "MainLoop: Error adding file to main loop monitor: %s", std::strerror(errno));
-		delete monitor;
+		LOG(LOG_ERR, "MainLoop: Error adding file to main loop monitor: %s", std::strerror(errno));
 		return false;
 	}
 
-	MonitorMap::iterator it = m_monitors.find(fd);
-	if (it != m_monitors.end())
-	{
-		delete it->second;
-		it->second = monitor;
-	}
-	else
-		m_monitors[fd] = monitor;
+	monitor.callback = callback;
+	monitor.userData = userData;
+	monitor.priority = priority;
+	monitor.active = true;
+	++m_monitorCount;
 
 	return true;
 }
 
 bool MainLoop::removeMonitor (int fd)
 {
-	MonitorMap::iterator it = m_monitors.find(fd);
-	if (it == m_monitors.end())
+	if (fd < 0 || static_cast<unsigned int>(fd) >= m_monitors.size() || !m_monitors[fd].active)
 		return false;
 
+	Monitor &monitor = m_monitors[fd];
+
 	struct epoll_event event;
 	event.events = EPOLLIN;
-	event.data.ptr = it->second;
+	event.data.u64 = 0;
+	++m_syscalls;
 	if (epoll_ctl(m_fd, EPOLL_CTL_DEL, fd, &event) == -1)
-		syslog(LOG_ERR, "MainLoop: Error removing file from main loop monitor: %s", std::strerror(errno));
+		LOG(LOG_ERR, "MainLoop: Error removing file from main loop monitor: %s", std::strerror(errno));
 
-	delete it->second;
-	m_monitors.erase(it);
+	monitor.active = false;
+	++monitor.generation;
+	--m_monitorCount;
 	
 	return true;
 }
 
+void MainLoop::addFlushCallback (FlushCallback *callback, void *userData)
+{
+	Flush entry;
+	entry.callback = callback;
+	entry.userData = userData;
+	m_flushCallbacks.push_back(entry);
+}
+
+void MainLoop::removeFlushCallback (FlushCallback *callback, void *userData)
+{
+	for (FlushList::iterator it = m_flushCallbacks.begin(); it != m_flushCallbacks.end(); ++it)
+	{
+		if (it->callback == callback && it->userData == userData)
+		{
+			m_flushCallbacks.erase(it);
+			return;
+		}
+	}
+}
+
+void MainLoop::flush ()
+{
+	for (FlushList::const_iterator it = m_flushCallbacks.begin(); it != m_flushCallbacks.end(); ++it)
+		it->callback(it->userData);
+}
+
 bool MainLoop::run ()
 {
 	bool ret = true;
 
 	m_aborted = false;
 
-	sighandler_t intHandler = signal(SIGINT, signalCallback);
-	sighandler_t termHandler = signal(SIGTERM, signalCallback);
-	sighandler_t quitHandler = signal(SIGQUIT, signalCallback);
-	sighandler_t hupHandler = signal(SIGHUP, SIG_IGN);
-	sighandler_t usr1Handler = signal(SIGUSR1, SIG_IGN);
-	sighandler_t usr2Handler = signal(SIGUSR2, SIG_IGN);
-	sighandler_t alarmHandler = signal(SIGALRM, SIG_IGN);
+	// Signals are taken from a signalfd like any other event, so callbacks run from the loop
+	// and not in signal context. Blocking them first keeps signals arriving before the
+	// signalfd exists pending instead of lost
+	sigset_t signals;
+	sigset_t oldSignals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGQUIT);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGUSR1);
+	sigaddset(&signals, SIGUSR2);
+	sigaddset(&signals, SIGALRM);
+	sigprocmask(SIG_BLOCK, &signals, &oldSignals);
+
+	int signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signalFd == -1 || !addMonitor(signalFd, signalCallback, 0, AdminPriority))
+	{
+		LOG(LOG_ERR, "MainLoop: Error setting up signal handling: %s", std::strerror(errno));
+		if (signalFd != -1)
+			close(signalFd);
+		sigprocmask(SIG_SETMASK, &oldSignals, 0);
+		return false;
+	}
 
-	while (m_monitors.size() > 0 && !m_aborted)
+	while (m_monitorCount > 1 && !m_aborted) // Not counting the signalfd
 	{
-		struct epoll_event events[16];
+		// Whatever the previous iteration queued goes out before we sleep
+		flush();
+
+		struct epoll_event events[64];
+		++m_syscalls;
 		int eventCount = epoll_wait(m_fd, events, sizeof(events) / sizeof(events[0]), -1);
 
 		if (eventCount == -1)
 		{
 			if (errno != EINTR)
 			{
-				syslog(LOG_ERR, "MainLoop: epoll_wait failed: %s", std::strerror(errno));
+				LOG(LOG_ERR, "MainLoop: epoll_wait failed: %s", std::strerror(errno));
 				ret = false;
 				break;
 			}
-			else
-				syslog(LOG_NOTICE, "MainLoop: epoll_wait was interrupted by signal %s", strsignal(m_abortSignal));
 		}
 		else
 		{
+			// Sort the batch into priority classes, keeping arrival order within each class
+			std::uint64_t classEvents[PriorityCount][sizeof(events) / sizeof(events[0])];
+			int classCount[PriorityCount] = {0};
 			for (int i = 0; i != eventCount; ++i)
 			{
-				Monitor *monitor = reinterpret_cast<Monitor *>(events[i].data.ptr);
-				monitor->callback(monitor->fd, monitor->userData);
+				int fd = static_cast<int>(events[i].data.u64 & 0xFFFFFFFF);
+				Priority priority = m_monitors[fd].priority;
+				classEvents[priority][classCount[priority]++] = events[i].data.u64;
+			}
+
+			// The clock is read once per callback, and serves both the profiling and the budget
+			std::uint64_t now = monotonicNanoseconds();
+			std::uint64_t deadline = 0;
+			for (int priority = 0; priority != PriorityCount; ++priority)
+			{
+				// Send what the VRRP callbacks queued before the low priority classes get their turn,
+				// rather than after them
+				if (priority == NetlinkPriority && classCount[NetlinkPriority] + classCount[AdminPriority] != 0)
+				{
+					flush();
+					now = monotonicNanoseconds();
+				}
+
+				for (int i = 0; i != classCount[priority]; ++i)
+				{
+					if (priority >= NetlinkPriority)
+					{
+						if (deadline == 0)
+							deadline = now + static_cast<std::uint64_t>(m_lowPriorityBudget) * 1000;
+						else if (now >= deadline)
+							break; // Budget spent. The remaining fds are still readable and will be reported again
+					}
+
+					now = dispatch(classEvents[priority][i], now);
+				}
 			}
 		}
 	}
 
-	signal(SIGINT, intHandler);
-	signal(SIGTERM, termHandler);
-	signal(SIGQUIT, quitHandler);
-	signal(SIGHUP, hupHandler);
-	signal(SIGUSR1, usr1Handler);
-	signal(SIGUSR2, usr2Handler);
-	signal(SIGALRM, alarmHandler);
+	flush();
+
+	// Consume signals that arrived after the abort, so they aren't delivered when unblocked
+	removeMonitor(signalFd);
+	signalfd_siginfo info;
+	while (read(signalFd, &info, sizeof(info)) == sizeof(info));
+	while (close(signalFd) == -1 && errno == EINTR);
+	sigprocmask(SIG_SETMASK, &oldSignals, 0);
 
 	return ret;
 }
 
-void MainLoop::signalCallback (int signum)
+std::uint64_t MainLoop::dispatch (std::uint64_t data, std::uint64_t start)
+{
+	int fd = static_cast<int>(data & 0xFFFFFFFF);
+	std::uint32_t generation = static_cast<std::uint32_t>(data >> 32);
+
+	// Skip events for monitors removed (or replaced) by an earlier callback in this batch
+	const Monitor &monitor = m_monitors[fd];
+	if (!monitor.active || monitor.generation != generation)
+		return start;
+
+	// The callback may resize the table, so don't touch monitor afterwards
+	Priority priority = monitor.priority;
+	monitor.callback(fd, monitor.userData);
+
+	std::uint64_t end = monotonicNanoseconds();
+	m_callbackDurations[priority].add(end - start);
+	return end;
+}
+
+void MainLoop::setLowPriorityBudget (unsigned int usec)
+{
+	m_lowPriorityBudget = usec;
+}
+
+void MainLoop::setSignalCallback (int signum, SignalCallback *callback)
 {
-	m_abortSignal = signum;
-	m_aborted = true;
-	signal(signum, SIG_IGN);
+	if (signum > 0 && signum < NSIG)
+		m_signalCallbacks[signum] = callback;
+}
+
+void MainLoop::signalCallback (int fd, void *)
+{
+	signalfd_siginfo info;
+	while (read(fd, &info, sizeof(info)) == sizeof(info))
+	{
+		int signum = static_cast<int>(info.ssi_signo);
+		if (signum < NSIG && m_signalCallbacks[signum] != 0)
+			m_signalCallbacks[signum](signum);
+
+		if (signum == SIGINT || signum == SIGTERM || signum == SIGQUIT)
+		{
+			LOG(LOG_NOTICE, "MainLoop: Received signal %s. Stopping", strsignal(signum));
+			m_aborted = true;
+		}
+	}
 }
@@ -19,45 +19,139 @@
 #ifndef INCLUDE_MAIN_LOOP_H
 #define INCLUDE_MAIN_LOOP_H
 
-#include <map>
+#include <cstdint>
+#include <vector>
+
+#include "histogram.h"
 
 class MainLoop
 {
 	public:
 		typedef void (Callback)(int fd, void *userData);
+		typedef void (SignalCallback)(int signum);
+		typedef void (FlushCallback)(void *userData);
+
+		/*
+		   Events are dispatched in priority order within each epoll_wait batch, so VRRP
+		   timers and sockets are never queued behind administrative work. The low priority
+		   classes (netlink and admin) share a time budget per loop iteration. Events left
+		   over when the budget is spent stay pending and are reported again on the next
+		   iteration.
+		*/
+		enum Priority
+		{
+			VrrpPriority = 0, // Timers and VRRP sockets
+			ArpPriority,
+			NetlinkPriority,
+			AdminPriority, // Telnet and configuration
+			PriorityCount
+		};
+
+		static bool addMonitor (int fd, Callback *callback, void *userData, Priority priority = AdminPriority);
 
-		static bool addMonitor (int fd, Callback *callback, void *userData);
+		/**
+		  * Call a function whenever a file descriptor is writable
+		  *
+		  * Shares the table with addMonitor(), so to watch a file descriptor for
+		  * both, register a dup() of it here. Remove it with removeMonitor()
+		  */
+		static bool addWriteMonitor (int fd, Callback *callback, void *userData, Priority priority = AdminPriority);
 		static bool removeMonitor (int fd);
 
 		static bool run ();
 
+		/**
+		  * Set function to call when a signal is received by run()
+		  *
+		  * SIGHUP, SIGUSR1, SIGUSR2 and SIGALRM are ignored unless a callback is
+		  * set. SIGINT, SIGTERM and SIGQUIT stop the loop once their callback has
+		  * returned. The callback is called from the loop, so it may do anything
+		  * an ordinary monitor callback may.
+		  * @param signum Signal number
+		  * @param callback Function to call, or 0 to remove the callback
+		  */
+		static void setSignalCallback (int signum, SignalCallback *callback);
+
+		/**
+		  * Register a function to call before the loop waits for events
+		  *
+		  * Meant for work that the callbacks of one loop iteration batch up,
+		  * like queued packets. It is also called before the netlink and
+		  * admin classes are dispatched, so their work doesn't delay what the
+		  * VRRP class queued, and once more when run() returns.
+		  * @param callback Function to call
+		  * @param userData Passed to the callback
+		  */
+		static void addFlushCallback (FlushCallback *callback, void *userData);
+		static void removeFlushCallback (FlushCallback *callback, void *userData);
+
+		/**
+		  * Get number of epoll system calls issued by the main loop
+		  * @return Number of system calls
+		  */
+		static std::uint64_t syscalls ();
+
+		/**
+		  * Get callback durations of a priority class
+		  * @param priority Priority class
+		  * @return Histogram of callback durations in nanoseconds
+		  */
+		static const Histogram &callbackDurations (Priority priority);
+
+		/**
+		  * Set time budget of the low priority classes
+		  * @param usec Microseconds the netlink and admin classes may use per loop iteration
+		  */
+		static void setLowPriorityBudget (unsigned int usec);
+
 	private:
-		static void init ();
-		static void timerCallback (int fd, Callback *callback, void *userData);
-		static void signalCallback (int signum);
+		static bool init ();
+		static bool addMonitor (int fd, Callback *callback, void *userData, Priority priority, bool writable);
+		/**
+		  * Call the callback of a monitor and record its duration
+		  * @param data Value reported by epoll
+		  * @param start Current time in nanoseconds
+		  * @return Time in nanoseconds after the callback returned
+		  */
+		static std::uint64_t dispatch (std::uint64_t data, std::uint64_t start);
+		static void flush ();
+		static void signalCallback (int fd, void *userData);
 
 	private:
+		/*
+		   Monitors are stored inline in a table indexed by file descriptor. The generation
+		   counter is bumped whenever a slot is released, and is passed to epoll together with
+		   the file descriptor, so events belonging to a monitor that was removed earlier in
+		   the same epoll_wait batch are recognized and dropped.
+		*/
 		struct Monitor
 		{
 			Callback *callback;
 			void *userData;
-			int fd;
+			std::uint32_t generation;
+			Priority priority;
+			bool active;
 		};
 
-		struct Timer
+		typedef std::vector<Monitor> MonitorTable;
+
+		struct Flush
 		{
-			Callback *callback;
+			FlushCallback *callback;
 			void *userData;
 		};
 
-		typedef std::map<int, Monitor *> MonitorMap;
-		typedef std::map<int, Timer *> TimerMap;
+		typedef std::vector<Flush> FlushList;
 		
 		static int m_fd;
-		static MonitorMap m_monitors;
-		static TimerMap m_timers;
+		static std::uint64_t m_syscalls;
+		static MonitorTable m_monitors;
+		static FlushList m_flushCallbacks;
+		static unsigned int m_monitorCount;
+		static unsigned int m_lowPriorityBudget;
 		static bool m_aborted;
-		static int m_abortSignal;
+		static SignalCallback *m_signalCallbacks[];
+		static Histogram m_callbackDurations[PriorityCount];
 };
 
 #endif
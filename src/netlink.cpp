@@ -18,13 +18,13 @@
 
 #include "netlink.h"
 #include "mainloop.h"
+#include "log.h"
 
 #include <cstring>
 #include <cstdio>
 #include <fstream>
 
 #include <dirent.h>
-#include <syslog.h>
 #include <net/if_arp.h>
 #include <linux/rtnetlink.h>
 #include <linux/sockios.h>
@@ -44,7 +44,7 @@ nl_sock *Netlink::createSocket ()
 	int err = nl_connect(sock, NETLINK_ROUTE);
 	if (err != 0)
 	{
-		syslog(LOG_ERR, "Error creating netlink socket: %s", nl_geterror(err));
+		LOG(LOG_ERR, "Error creating netlink socket: %s", nl_geterror(err));
 		nl_socket_free(sock);
 		return 0;
 	}
@@ -81,7 +81,7 @@ IpAddress Netlink::getPrimaryIpAddress (int interface, int family)
 	nl_cache_free(cache);
 
 	if (address.family() == AF_UNSPEC)
-		syslog(LOG_WARNING, "Unable to get a local address for interface %i", interface);
+		LOG(LOG_WARNING, "Unable to get a local address for interface %i", interface);
 
 	return address;
 }
@@ -125,9 +125,9 @@ bool Netlink::modifyIpAddress (int interface, const IpSubnet &ip, bool add)
 	if (err != 0)
 	{
 		if (add)
-			syslog(LOG_ERR, "Error adding IP address %s to interface %i: %s", ip.toString().c_str(), interface, nl_geterror(err));
+			LOG(LOG_ERR, "Error adding IP address %s to interface %i: %s", ip.toString().c_str(), interface, nl_geterror(err));
 		else
-			syslog(LOG_WARNING, "Error removing IP address %s from interface %i: %s", ip.toString().c_str(), interface, nl_geterror(err));
+			LOG(LOG_WARNING, "Error removing IP address %s from interface %i: %s", ip.toString().c_str(), interface, nl_geterror(err));
 		return false;
 	}
 	else
@@ -147,8 +147,9 @@ int Netlink::addInterface(nl_msg* msg, const char* name)
 
 	if (err < 0)
 	{
-		syslog(LOG_ERR, "Error creating interface: %s", nl_geterror(err));
+		LOG(LOG_ERR, "Error creating interface: %s", nl_geterror(err));
 		nl_socket_free(sock);
+		return -1;
 	}
 
 	nl_cache* cache;
@@ -159,7 +160,7 @@ int Netlink::addInterface(nl_msg* msg, const char* name)
 #endif // LIBNL3
 	if (err < 0)
 	{
-		syslog(LOG_ERR, "Error allocating link cache: %s", nl_geterror(err));
+		LOG(LOG_ERR, "Error allocating link cache: %s", nl_geterror(err));
 		nl_socket_free(sock);
 		return -1;
 	}
@@ -287,7 +288,7 @@ bool Netlink::removeInterface (int interface)
 
 	if (err < 0)
 	{
-		syslog(LOG_WARNING, "Error removing interface %i: %s", interface, nl_geterror(err));
+		LOG(LOG_WARNING, "Error removing interface %i: %s", interface, nl_geterror(err));
 		return false;
 	}
 	else
@@ -345,7 +346,7 @@ bool Netlink::setMac (int interface, const std::uint8_t *macAddress)
 	nlmsg_free(msg);
 
 	if (err < 0)
-		syslog(LOG_ERR, "Error setting MAC address of interface %i: %s", interface, nl_geterror(err));
+		LOG(LOG_ERR, "Error setting MAC address of interface %i: %s", interface, nl_geterror(err));
 
 	nl_socket_free(sock);
 
@@ -405,7 +406,7 @@ bool Netlink::toggleInterface (int interface, bool up)
 	nlmsg_free(msg);
 
 	if (err < 0)
-		syslog(LOG_ERR, "Error toggling interface %i: %s", interface, nl_geterror(err));
+		LOG(LOG_ERR, "Error toggling interface %i: %s", interface, nl_geterror(err));
 
 	nl_socket_free(sock);
 
@@ -463,7 +464,7 @@ bool Netlink::addInterfaceMonitor (int interface, InterfaceCallback *callback, v
 		int ret = nl_connect(sock, NETLINK_ROUTE);
 		if (ret != 0)
 		{
-			syslog(LOG_ERR, "Error creating NETLINK_ROUTE netlink socket: %i", ret);
+			LOG(LOG_ERR, "Error creating NETLINK_ROUTE netlink socket: %i", ret);
 
 			callbacks.erase(it);
 			return false;
@@ -474,7 +475,7 @@ bool Netlink::addInterfaceMonitor (int interface, InterfaceCallback *callback, v
 		nl_socket_modify_cb(sock, NL_CB_VALID, NL_CB_CUSTOM, nlMessageCallback, sock);
 		nl_socket_add_membership(sock, RTMGRP_LINK);
 
-		MainLoop::addMonitor(nl_socket_get_fd(sock), nlSocketCallback, sock);
+		MainLoop::addMonitor(nl_socket_get_fd(sock), nlSocketCallback, sock, MainLoop::NetlinkPriority);
 	}
 
 	it->second.insert(data);
@@ -515,7 +516,7 @@ void Netlink::nlSocketCallback (int, void *userData)
 	int err;
 	while ((err = nl_recvmsgs_default(sock)) > 0);
 	if (err < 0)
-		syslog(LOG_WARNING, "Error receiving netlink message: %s", nl_geterror(err));
+		LOG(LOG_WARNING, "Error receiving netlink message: %s", nl_geterror(err));
 }
 
 int Netlink::nlMessageCallback (nl_msg *msg, void *)
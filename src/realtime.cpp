@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "realtime.h"
+#include "log.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+// Memory touched up front, so the first advertisements after startup don't page-fault
+#define PREFAULT_STACK_SIZE (256 * 1024)
+#define PREFAULT_HEAP_SIZE (4 * 1024 * 1024)
+
+bool Realtime::m_affinitySet = false;
+bool Realtime::m_enabled = false;
+
+static cpu_set_t originalAffinity;
+static int originalTimerSlack = 0;
+
+bool Realtime::setAffinity (const char *cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	const char *p = cpus;
+	for (;;)
+	{
+		char *end;
+		long first = std::strtol(p, &end, 10);
+		long last = first;
+		if (end == p || first < 0)
+			break;
+		if (*end == '-')
+		{
+			p = end + 1;
+			last = std::strtol(p, &end, 10);
+			if (end == p || last < first)
+				break;
+		}
+		if (last >= CPU_SETSIZE)
+			break;
+
+		for (long cpu = first; cpu <= last; ++cpu)
+			CPU_SET(cpu, &set);
+
+		if (*end == '\0')
+		{
+			if (sched_getaffinity(0, sizeof(originalAffinity), &originalAffinity) == -1
+					|| sched_setaffinity(0, sizeof(set), &set) == -1)
+			{
+				LOG(LOG_ERR, "Error setting CPU affinity to %s: %s", cpus, std::strerror(errno));
+				return false;
+			}
+
+			m_affinitySet = true;
+			LOG(LOG_INFO, "Running on CPUs %s", cpus);
+			return true;
+		}
+		else if (*end != ',')
+			break;
+
+		p = end + 1;
+	}
+
+	LOG(LOG_ERR, "Invalid CPU list: %s", cpus);
+	return false;
+}
+
+bool Realtime::enable (int priority)
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+	{
+		LOG(LOG_ERR, "Error locking memory: %s", std::strerror(errno));
+		return false;
+	}
+
+	prefault();
+
+	// One nanosecond is the smallest slack there is. Zero means the default
+	originalTimerSlack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+	if (prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0) == -1)
+		LOG(LOG_WARNING, "Error setting timer slack: %s", std::strerror(errno));
+
+	// Forked scripts get SCHED_OTHER back automatically
+	sched_param param;
+	std::memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &param) == -1)
+	{
+		LOG(LOG_ERR, "Error setting real-time priority %i: %s", priority, std::strerror(errno));
+		return false;
+	}
+
+	m_enabled = true;
+	LOG(LOG_INFO, "Running with real-time priority %i", priority);
+	return true;
+}
+
+void Realtime::prefault ()
+{
+	// Never give heap memory back to the system or serve allocations with mmap, so the
+	// prefaulted heap is what later allocations get
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	volatile char *heap = reinterpret_cast<volatile char *>(std::malloc(PREFAULT_HEAP_SIZE));
+	if (heap != 0)
+	{
+		for (unsigned int i = 0; i < PREFAULT_HEAP_SIZE; i += 4096)
+			heap[i] = 0;
+		std::free(const_cast<char *>(heap));
+	}
+
+	volatile char stack[PREFAULT_STACK_SIZE];
+	for (unsigned int i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+void Realtime::resetChild ()
+{
+	if (m_affinitySet)
+		sched_setaffinity(0, sizeof(originalAffinity), &originalAffinity);
+
+	// Restore the value explicitly, as the default of a child is the slack of its parent
+	if (m_enabled && originalTimerSlack > 0)
+		prctl(PR_SET_TIMERSLACK, originalTimerSlack, 0, 0, 0);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INCLUDE_OPENVRRP_REALTIME_H
+#define INCLUDE_OPENVRRP_REALTIME_H
+
+/**
+  * Real-time execution mode
+  *
+  * Keeps the daemon from being descheduled or page-faulted long enough for
+  * backups to declare it dead. Processes forked by the daemon must call
+  * resetChild() so they don't compete with it.
+  */
+class Realtime
+{
+	public:
+		/**
+		  * Restrict the daemon to a set of CPUs
+		  * @param cpus Comma separated list of CPU numbers and ranges, like "0,2-3"
+		  * @return true on success
+		  */
+		static bool setAffinity (const char *cpus);
+
+		/**
+		  * Enter real-time mode
+		  *
+		  * Switches to SCHED_FIFO, locks all current and future memory,
+		  * prefaults the stack and heap and sets the smallest timer slack.
+		  * @param priority SCHED_FIFO priority
+		  * @return true on success
+		  */
+		static bool enable (int priority);
+
+		/**
+		  * Drop back to normal execution in a forked child
+		  *
+		  * Restores the CPU affinity and timer slack the daemon was started
+		  * with. The scheduling class is reset by the kernel on fork, and
+		  * memory locks aren't inherited.
+		  */
+		static void resetChild ();
+
+	private:
+		static void prefault ();
+
+	private:
+		static bool m_affinitySet;
+		static bool m_enabled;
+};
+
+#endif // INCLUDE_OPENVRRP_REALTIME_H
@@ -19,12 +19,12 @@
 #include "telnetserver.h"
 #include "mainloop.h"
 #include "telnetsession.h"
+#include "log.h"
 
 #include <cerrno>
 #include <cstring>
 
 #include <unistd.h>
-#include <syslog.h>
 
 TelnetServer::TelnetServer (const IpAddress &address) :
 	m_address(address),
@@ -42,7 +42,7 @@ bool TelnetServer::start ()
 	m_socket = socket(m_address.family(), SOCK_STREAM, IPPROTO_TCP);
 	if (m_socket == -1)
 	{
-		syslog(LOG_ERR, "Error starting telnet server: %s", std::strerror(errno));
+		LOG(LOG_ERR, "Error starting telnet server: %s", std::strerror(errno));
 		return false;
 	}
 
@@ -51,12 +51,12 @@ bool TelnetServer::start ()
 
 	if (bind(m_socket, m_address.socketAddress(), m_address.socketAddressSize()) == -1 || listen(m_socket, 10) == -1)
 	{
-		syslog(LOG_ERR, "Error starting telnet server: %s", std::strerror(errno));
+		LOG(LOG_ERR, "Error starting telnet server: %s", std::strerror(errno));
 		stop();
 		return false;
 	}
 
-	if (!MainLoop::addMonitor(m_socket, onIncomingConnection, this))
+	if (!MainLoop::addMonitor(m_socket, onIncomingConnection, this, MainLoop::AdminPriority))
 	{
 		stop();
 		return false;
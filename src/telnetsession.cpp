@@ -19,6 +19,7 @@
 #include "telnetsession.h"
 #include "telnetserver.h"
 #include "mainloop.h"
+#include "timer.h"
 #include "vrrpsocket.h"
 #include "vrrpmanager.h"
 #include "vrrpservice.h"
@@ -40,6 +41,7 @@
 #define RESP_INVALID_IP			"Invalid ip address\n"
 #define RESP_INVALID_PRIORITY	"Invalid priority\n"
 #define RESP_INVALID_INTERVAL	"Invalid interval\n"
+#define RESP_INVALID_COUNT		"Invalid count\n"
 
 #define RESP_ADD_ROUTER				"add router INTF VRID [vlan VLAN] [ipv6]\n"
 #define RESP_ADD_ADDRESS			"add address INTF VRID [ipv6] CIDR\n"
@@ -50,6 +52,9 @@
 #define RESP_SET_ROUTER_INTERVAL	"set router INTF VRID [ipv6] interval MSEC\n"
 #define RESP_SET_ROUTER_ACCEPT		"set router INTF VRID [ipv6] accept BOOL\n"
 #define RESP_SET_ROUTER_PREEMPT		"set router INTF VRID [ipv6] preempt BOOL\n"
+#define RESP_SET_ROUTER_ARP			"set router INTF VRID arp count COUNT\n" \
+									"set router INTF VRID arp spacing MSEC\n" \
+									"set router INTF VRID arp refresh MSEC\n"
 #define RESP_SET_ROUTER_STATUS		"set router INTF VRID [ipv6] status [master|slave]\n"
 #define RESP_SET_ROUTER_MASTER_CMD	"set router INTF VRID [ipv6] master command COMMAND\n"
 #define RESP_SET_ROUTER_BACKUP_CMD	"set router INTF VRID [ipv6] backup command COMMAND\n"
@@ -57,6 +62,7 @@
 #define RESP_DISABLE_ROUTER			"disable router INTF VRID [ipv6]\n"
 #define RESP_SHOW_ROUTER			"show router [INTF] [VRID] [ipv6] [stats]\n"
 #define RESP_SHOW_STATS				"show stats\n"
+#define RESP_SHOW_LOOP				"show loop\n"
 #define RESP_SAVE					"save [FILENAME]\n"
 
 #define RESP_ADD					RESP_ADD_ROUTER \
@@ -66,6 +72,7 @@
 									RESP_REMOVE_ADDRESS
 
 #define RESP_SET_ROUTER				RESP_SET_ROUTER_ACCEPT \
+									RESP_SET_ROUTER_ARP \
 									RESP_SET_ROUTER_INTERVAL \
 									RESP_SET_ROUTER_PREEMPT \
 									RESP_SET_ROUTER_PRIMARY \
@@ -81,7 +88,8 @@
 #define RESP_DISABLE				RESP_DISABLE_ROUTER
 
 #define RESP_SHOW					RESP_SHOW_ROUTER \
-									RESP_SHOW_STATS
+									RESP_SHOW_STATS \
+									RESP_SHOW_LOOP
 
 #define RESP_HELP					RESP_ADD \
 									RESP_DISABLE \
@@ -102,7 +110,7 @@ TelnetSession::TelnetSession (int fd, TelnetServer *server) :
 	m_server(server),
 	m_overflow(false)
 {
-	MainLoop::addMonitor(m_socket, onIncomingData, this);
+	MainLoop::addMonitor(m_socket, onIncomingData, this, MainLoop::AdminPriority);
 	SEND_RESP(RESP_PROMPT);
 }
 
@@ -524,6 +532,49 @@ void TelnetSession::onSetRouterCommand (const std::vector<char *> &argv)
 				return;
 
 			}
+			else if (std::strcmp(argv[offset], "arp") == 0)
+			{
+				if (argv.size() > offset + 2)
+				{
+					int value = std::atoi(argv[offset + 2]);
+					if (std::strcmp(argv[offset + 1], "count") == 0)
+					{
+						if (value < 1 || value > 255)
+						{
+							SEND_RESP(RESP_INVALID_COUNT);
+							return;
+						}
+
+						service->setArpBurstCount(value);
+						return;
+					}
+					else if (std::strcmp(argv[offset + 1], "spacing") == 0)
+					{
+						if (value < 10 || value > 60000)
+						{
+							SEND_RESP(RESP_INVALID_INTERVAL);
+							return;
+						}
+
+						service->setArpBurstSpacing(value);
+						return;
+					}
+					else if (std::strcmp(argv[offset + 1], "refresh") == 0)
+					{
+						if (value < 0 || (value != 0 && value < 1000) || value > 3600000)
+						{
+							SEND_RESP(RESP_INVALID_INTERVAL);
+							return;
+						}
+
+						service->setArpRefreshInterval(value);
+						return;
+					}
+				}
+
+				SEND_RESP(RESP_SET_ROUTER_ARP);
+				return;
+			}
 			else if (std::strcmp(argv[offset], "master") == 0 || std::strcmp(argv[offset], "backup") == 0)
 			{
 				if (argv.size() > offset + 1 && std::strcmp(argv[offset + 1], "command") == 0)
@@ -603,6 +654,11 @@ void TelnetSession::onShowCommand (const std::vector<char *> &argv)
 			onShowStatsCommand(argv);
 			return;
 		}
+		else if (std::strcmp(argv[1], "loop") == 0)
+		{
+			onShowLoopCommand(argv);
+			return;
+		}
 	}
 
 	SEND_RESP(RESP_SHOW);
@@ -659,6 +715,9 @@ void TelnetSession::onShowRouterCommand (const std::vector<char *> &argv)
 	if (vrid == -1)
 		vrid = 0;
 
+	if (stats)
+		VrrpSocket::updateStatistics();
+
 	const VrrpManager::VrrpServiceMap &services = VrrpManager::services();
 	if (interface > 0)
 	{
@@ -731,10 +790,47 @@ void TelnetSession::onShowRouterCommand (const std::vector<char *> &argv)
 
 void TelnetSession::onShowStatsCommand (const std::vector<char *> &)
 {
+	VrrpSocket::updateStatistics();
 	sendFormatted("Router Checksum Errors: %llu\n", (unsigned long long int)VrrpSocket::routerChecksumErrors());
 	sendFormatted("Router Version Errors:  %llu\n", (unsigned long long int)VrrpSocket::routerVersionErrors());
 	sendFormatted("Router VRID Errors:     %lu\n", (unsigned long long int)VrrpSocket::routerVrIdErrors());
 	SEND_RESP("\n");
+	sendFormatted("Advertisements Queued:   %llu\n", (unsigned long long int)VrrpSocket::advertisementsQueued());
+	sendFormatted("Advertisements Sent:     %llu (%llu sendmmsg calls)\n", (unsigned long long int)VrrpSocket::advertisementsSent(), (unsigned long long int)VrrpSocket::sendCalls());
+	sendFormatted("Advertisements Deferred: %llu (%llu sent late)\n", (unsigned long long int)VrrpSocket::advertisementsDeferred(), (unsigned long long int)VrrpSocket::advertisementsLate());
+	sendFormatted("Advertisements Dropped:  %llu\n", (unsigned long long int)VrrpSocket::advertisementsDropped());
+	SEND_RESP("\n");
+	SEND_RESP("Packets dropped by validation stage:\n");
+	for (int stage = 0; stage != VrrpSocket::StageCount; ++stage)
+		sendFormatted(" %-10s %llu\n", VrrpSocket::stageName(static_cast<VrrpSocket::Stage>(stage)), (unsigned long long int)VrrpSocket::stageDrops(static_cast<VrrpSocket::Stage>(stage)));
+	SEND_RESP("\n");
+}
+
+void TelnetSession::onShowLoopCommand (const std::vector<char *> &)
+{
+	static const char *classes[] = {"VRRP", "ARP", "Netlink", "Admin"};
+
+	sendFormatted("epoll system calls: %llu\n", (unsigned long long int)MainLoop::syscalls());
+	SEND_RESP("\n");
+	sendFormatted("%-24s %10s %10s %10s %10s %10s %10s\n", "Callback duration (usec)", "Count", "p50", "p90", "p99", "p99.9", "Max");
+	for (int priority = 0; priority != MainLoop::PriorityCount; ++priority)
+		showHistogram(classes[priority], MainLoop::callbackDurations(static_cast<MainLoop::Priority>(priority)));
+	SEND_RESP("\n");
+	sendFormatted("%-24s %10s %10s %10s %10s %10s %10s\n", "Timer lateness (usec)", "Count", "p50", "p90", "p99", "p99.9", "Max");
+	showHistogram("Timers", Timer::lateness());
+	SEND_RESP("\n");
+}
+
+void TelnetSession::showHistogram (const char *name, const Histogram &histogram)
+{
+	sendFormatted(" %-23s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			name,
+			(unsigned long long int)histogram.count(),
+			histogram.percentile(50) / 1000.0,
+			histogram.percentile(90) / 1000.0,
+			histogram.percentile(99) / 1000.0,
+			histogram.percentile(99.9) / 1000.0,
+			histogram.max() / 1000.0);
 }
 
 VrrpService *TelnetSession::getService (const std::vector<char *> &argv, bool create)
@@ -837,6 +933,14 @@ void TelnetSession::showRouter (const VrrpService *service)
 	sendFormatted(" Advertisement Interval: %u msec\n", (unsigned int)service->advertisementInterval() * 10);
 	sendFormatted(" Preempt Mode:           %s\n", service->preemptMode() ? "Yes" : "No");
 	sendFormatted(" Accept Mode:            %s\n", service->acceptMode() ? "Yes" : "No");
+	if (service->family() == AF_INET)
+	{
+		sendFormatted(" Gratuitous ARP:         %u burst(s), %u msec apart\n", service->arpBurstCount(), service->arpBurstSpacing());
+		if (service->arpRefreshInterval() != 0)
+			sendFormatted(" Gratuitous ARP Refresh: %u msec\n", service->arpRefreshInterval());
+		else
+			SEND_RESP(" Gratuitous ARP Refresh: Disabled\n");
+	}
 	sendFormatted(" Master Command:         %s\n", service->masterCommand().c_str());
 	sendFormatted(" Backup Command:         %s\n", service->backupCommand().c_str());
 	SEND_RESP(" Address List:\n");
@@ -869,6 +973,21 @@ void TelnetSession::showRouterStats (const VrrpService *service)
 	sendFormatted(" Invalid Packet Types Received:         %llu\n", (unsigned long long int)service->statsRcvdInvalidTypePackets());
 	sendFormatted(" Address List Errors:                   %llu\n", (unsigned long long int)service->statsAddressListErrors());
 	sendFormatted(" Packet Length Errors:                  %llu\n", (unsigned long long int)service->statsPacketLengthErrors());
+	sendFormatted(" Missed Advertisements:                 %llu\n", (unsigned long long int)service->statsMissedAdvertisements());
+	sendFormatted(" Deferred / Late / Dropped Adverts:     %llu / %llu / %llu\n",
+			(unsigned long long int)service->statsDeferredAdvertisements(),
+			(unsigned long long int)service->statsLateAdvertisements(),
+			(unsigned long long int)service->statsDroppedAdvertisements());
+	sendFormatted(" Advertisement Jitter (avg / max):      %llu / %llu usec\n", (unsigned long long int)service->statsAdvertisementJitterAverage(), (unsigned long long int)service->statsAdvertisementJitterMax());
+
+	const Histogram &gaps = service->statsArrivalGaps();
+	sendFormatted(" Arrival Gap (p50 / p99 / max):         %.3f / %.3f / %.3f msec (%llu gaps)\n",
+			gaps.percentile(50) / 1000.0,
+			gaps.percentile(99) / 1000.0,
+			gaps.max() / 1000.0,
+			(unsigned long long int)gaps.count());
+	sendFormatted(" Near Misses (gap > 2 intervals):       %llu\n", (unsigned long long int)service->statsNearMisses());
+	sendFormatted(" Receive Delay (avg / max):             %llu / %llu usec\n", (unsigned long long int)service->statsReceiveDelayAverage(), (unsigned long long int)service->statsReceiveDelayMax());
 	SEND_RESP("\n");
 }
 
@@ -26,6 +26,7 @@
 
 class TelnetServer;
 class VrrpService;
+class Histogram;
 
 class TelnetSession
 {
@@ -55,11 +56,13 @@ class TelnetSession
 
 		void onShowRouterCommand (const std::vector<char *> &argv);
 		void onShowStatsCommand (const std::vector<char *> &argv);
+		void onShowLoopCommand (const std::vector<char *> &argv);
 
 		void onSaveCommand (const std::vector<char *> &argv);
 		
 		void showRouter (const VrrpService *service);
 		void showRouterStats (const VrrpService *service);
+		void showHistogram (const char *name, const Histogram &histogram);
 
 		void sendFormatted (const char *templ, ...);
 
@@ -18,65 +18,314 @@
 
 #include "timer.h"
 #include "mainloop.h"
+#include "log.h"
 
 #include <cerrno>
 
+#include <time.h>
 #include <unistd.h>
-#include <syslog.h>
 #include <sys/timerfd.h>
 
+/*
+   The timing wheel is a hierarchy of WheelCount wheels with WheelSize slots each.
+   Slots in wheel 0 are one millisecond wide, slots in wheel 1 are WheelSize
+   milliseconds wide and so on. A timer is placed in the wheel matching the
+   magnitude of its remaining time, and is moved to a lower wheel as time
+   progresses. Each wheel keeps a bitmap of non-empty slots, which makes it
+   cheap to find the next expiry and to skip idle periods without ticking.
+*/
+
+int Timer::m_fd = -1;
+std::uint64_t Timer::m_curtime = 0;
+std::uint64_t Timer::m_armedTime = 0;
+std::uint64_t Timer::m_pending[WheelCount];
+Timer *Timer::m_wheel[WheelCount][WheelSize];
+Timer *Timer::m_expired = 0;
+Histogram Timer::m_lateness;
+
+static inline std::uint64_t rotl (std::uint64_t v, int c)
+{
+	c &= 63;
+	return (v << c) | (v >> ((64 - c) & 63));
+}
+
+static inline std::uint64_t rotr (std::uint64_t v, int c)
+{
+	c &= 63;
+	return (v >> c) | (v << ((64 - c) & 63));
+}
+
 Timer::Timer (Callback *callback, void *userData) :
-	m_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
 	m_armed(false),
 	m_callback(callback),
-	m_userData(userData)
+	m_userData(userData),
+	m_expires(0),
+	m_next(0),
+	m_prev(0),
+	m_list(0)
 {
-	if (m_fd == -1)
-		syslog(LOG_ERR, "Error creating timer: %m");
+	init();
 }
 
 Timer::~Timer ()
 {
 	stop();
-	while (close(m_fd) == -1 && errno == EINTR);
 }
 
-void Timer::start (unsigned int msec)
+void Timer::init ()
 {
-	struct itimerspec value;
-	value.it_interval.tv_sec = 0;
-	value.it_interval.tv_nsec = 0;
-	value.it_value.tv_sec = msec / 1000;
-	value.it_value.tv_nsec = (msec % 1000) * 1000000;
-	timerfd_settime(m_fd, 0, &value, 0);
-	if (!m_armed)
+	if (m_fd != -1)
+		return;
+
+	m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (m_fd == -1)
 	{
-		m_armed = true;
-		MainLoop::addMonitor(m_fd, callback, this);
+		LOG(LOG_ERR, "Error creating timer: %m");
+		return;
 	}
+
+	m_curtime = now();
+	MainLoop::addMonitor(m_fd, callback, 0, MainLoop::VrrpPriority);
+}
+
+std::uint64_t Timer::now ()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<std::uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+const Histogram &Timer::lateness ()
+{
+	return m_lateness;
+}
+
+std::uint64_t Timer::alignDeadline (std::uint64_t deadline, unsigned int window, unsigned int offset)
+{
+	if (window == 0)
+		return deadline;
+
+	std::uint64_t remainder = (deadline + window - offset % window) % window;
+	return remainder == 0 ? deadline : deadline + window - remainder;
+}
+
+void Timer::start (unsigned int msec)
+{
+	startAt(now() + msec);
+}
+
+void Timer::startAt (std::uint64_t deadline)
+{
+	if (m_armed)
+		unlink();
+
+	// Avoid measuring from a stale wheel position when nothing is scheduled
+	if (m_expired == 0 && (m_pending[0] | m_pending[1] | m_pending[2] | m_pending[3]) == 0)
+		m_curtime = now();
+
+	m_armed = true;
+	m_expires = deadline;
+	schedule(this);
+	rearm();
 }
 
 void Timer::stop ()
 {
 	if (m_armed)
 	{
-		struct itimerspec value;
-		value.it_interval.tv_sec = 0;
-		value.it_interval.tv_nsec = 0;
-		value.it_value.tv_sec = 0;
-		value.it_value.tv_nsec = 0;
-		timerfd_settime(m_fd, TFD_TIMER_ABSTIME, &value, 0);
-		MainLoop::removeMonitor(m_fd);
+		unlink();
 		m_armed = false;
 	}
 }
 
-void Timer::callback (int, void *userData)
+void Timer::link (Timer **list)
+{
+	m_list = list;
+	m_prev = 0;
+	m_next = *list;
+	if (m_next != 0)
+		m_next->m_prev = this;
+	*list = this;
+}
+
+void Timer::unlink ()
+{
+	if (m_list == 0)
+		return;
+
+	if (m_prev != 0)
+		m_prev->m_next = m_next;
+	else
+		*m_list = m_next;
+
+	if (m_next != 0)
+		m_next->m_prev = m_prev;
+
+	// Clear the pending bit if a wheel slot became empty
+	Timer **first = &m_wheel[0][0];
+	if (*m_list == 0 && m_list >= first && m_list < first + WheelCount * WheelSize)
+	{
+		std::ptrdiff_t index = m_list - first;
+		m_pending[index / WheelSize] &= ~(static_cast<std::uint64_t>(1) << (index % WheelSize));
+	}
+
+	m_list = 0;
+	m_next = 0;
+	m_prev = 0;
+}
+
+void Timer::schedule (Timer *timer)
+{
+	if (timer->m_expires <= m_curtime)
+	{
+		timer->link(&m_expired);
+		return;
+	}
+
+	std::uint64_t remaining = timer->m_expires - m_curtime;
+	static const std::uint64_t maxRemaining = (static_cast<std::uint64_t>(1) << (WheelBits * WheelCount)) - 1;
+	if (remaining > maxRemaining)
+		remaining = maxRemaining;
+
+	int wheel = (63 - __builtin_clzll(remaining)) / WheelBits;
+
+	// Slots in the upper wheels are processed one rotation early, so the timer is moved down before it expires
+	int slot = WheelMask & ((timer->m_expires >> (wheel * WheelBits)) - (wheel != 0 ? 1 : 0));
+
+	timer->link(&m_wheel[wheel][slot]);
+	m_pending[wheel] |= static_cast<std::uint64_t>(1) << slot;
+}
+
+void Timer::update (std::uint64_t curtime)
 {
-	Timer *self = reinterpret_cast<Timer *>(userData);
-	if (self->m_armed)
+	if (curtime <= m_curtime)
+		return;
+
+	std::uint64_t elapsed = curtime - m_curtime;
+	Timer *todo = 0;
+
+	for (int wheel = 0; wheel != WheelCount; ++wheel)
 	{
-		self->stop();
-		self->m_callback(self, self->m_userData);
+		// Find the slots passed since the last update
+		std::uint64_t pending;
+		if ((elapsed >> (wheel * WheelBits)) > WheelMask)
+			pending = ~static_cast<std::uint64_t>(0);
+		else
+		{
+			std::uint64_t wheelElapsed = WheelMask & (elapsed >> (wheel * WheelBits));
+			int oldSlot = WheelMask & (m_curtime >> (wheel * WheelBits));
+			int newSlot = WheelMask & (curtime >> (wheel * WheelBits));
+
+			pending = rotl((static_cast<std::uint64_t>(1) << wheelElapsed) - 1, oldSlot);
+			pending |= rotr(rotl((static_cast<std::uint64_t>(1) << wheelElapsed) - 1, newSlot), wheelElapsed);
+			pending |= static_cast<std::uint64_t>(1) << newSlot;
+		}
+
+		while ((pending & m_pending[wheel]) != 0)
+		{
+			int slot = __builtin_ctzll(pending & m_pending[wheel]);
+			while (m_wheel[wheel][slot] != 0)
+			{
+				Timer *timer = m_wheel[wheel][slot];
+				timer->unlink();
+				timer->link(&todo);
+			}
+		}
+
+		// Stop unless the wheel wrapped around, in which case the next wheel ticked as well
+		if ((pending & 1) == 0)
+			break;
+
+		if (elapsed < (static_cast<std::uint64_t>(WheelSize) << (wheel * WheelBits)))
+			elapsed = static_cast<std::uint64_t>(WheelSize) << (wheel * WheelBits);
+	}
+
+	m_curtime = curtime;
+
+	while (todo != 0)
+	{
+		Timer *timer = todo;
+		timer->unlink();
+		schedule(timer);
 	}
 }
+
+std::uint64_t Timer::nextTimeout ()
+{
+	std::uint64_t timeout = ~static_cast<std::uint64_t>(0);
+	std::uint64_t relativeMask = 0;
+
+	for (int wheel = 0; wheel != WheelCount; ++wheel)
+	{
+		if (m_pending[wheel] != 0)
+		{
+			int slot = WheelMask & (m_curtime >> (wheel * WheelBits));
+
+			// Upper wheels are one rotation ahead, otherwise the timer would have been in a lower wheel
+			std::uint64_t wheelTimeout = static_cast<std::uint64_t>(__builtin_ctzll(rotr(m_pending[wheel], slot)) + (wheel != 0 ? 1 : 0)) << (wheel * WheelBits);
+			wheelTimeout -= relativeMask & m_curtime;
+
+			if (wheelTimeout < timeout)
+				timeout = wheelTimeout;
+		}
+
+		relativeMask = (relativeMask << WheelBits) | WheelMask;
+	}
+
+	return timeout;
+}
+
+void Timer::rearm ()
+{
+	std::uint64_t next;
+	if (m_expired != 0)
+		next = m_curtime;
+	else if ((m_pending[0] | m_pending[1] | m_pending[2] | m_pending[3]) == 0)
+		next = 0;
+	else
+		next = m_curtime + nextTimeout();
+
+	// The timerfd is only ever moved to an earlier deadline. If the next deadline was postponed or
+	// all timers were stopped, the timerfd fires early and is re-armed from the callback instead,
+	// so restarting a timer (e.g. the master down timer on every advertisement) costs no syscalls
+	if (next == 0 || (m_armedTime != 0 && m_armedTime <= next))
+		return;
+
+	itimerspec value;
+	value.it_interval.tv_sec = 0;
+	value.it_interval.tv_nsec = 0;
+	value.it_value.tv_sec = next / 1000;
+	value.it_value.tv_nsec = (next % 1000) * 1000000;
+	if (timerfd_settime(m_fd, TFD_TIMER_ABSTIME, &value, 0) == -1)
+		LOG(LOG_ERR, "Error arming timer: %m");
+	else
+		m_armedTime = next;
+}
+
+void Timer::callback (int fd, void *)
+{
+	// Discard the expiration count. The wheel knows what expired
+	std::uint64_t expirations;
+	while (read(fd, &expirations, sizeof(expirations)) == -1 && errno == EINTR);
+	m_armedTime = 0;
+
+	update(now());
+
+	while (m_expired != 0)
+	{
+		Timer *timer = m_expired;
+		timer->unlink();
+		timer->m_armed = false;
+
+		// Timers expiring together run back to back, so the clock is read for each of them
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		std::uint64_t nsec = static_cast<std::uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+		std::uint64_t due = timer->m_expires * 1000000;
+		m_lateness.add(nsec > due ? nsec - due : 0);
+
+		timer->m_callback(timer, timer->m_userData);
+	}
+
+	rearm();
+}
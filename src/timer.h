@@ -19,8 +19,20 @@
 #ifndef INCLUDE_TIMER_H
 #define INCLUDE_TIMER_H
 
+#include <cstdint>
+
+#include "histogram.h"
+
 class MainLoop;
 
+/**
+  * One-shot millisecond timer
+  *
+  * All timers share a single hierarchical timing wheel, which is driven by
+  * one timerfd registered with the main loop for its whole lifetime. Starting
+  * and stopping a timer is O(1) and never touches the main loop. The timerfd
+  * is only re-armed when the earliest deadline moves closer.
+  */
 class Timer
 {
 	public:
@@ -29,17 +41,87 @@ class Timer
 		Timer(Callback *callback, void *userData);
 		~Timer();
 
-		void start (unsigned int dsec);
+		void start (unsigned int msec);
+
+		/**
+		  * Start timer on an absolute deadline
+		  *
+		  * Unlike start(), restarting from the previous deadline doesn't
+		  * accumulate callback latency, so periodic timers don't drift.
+		  * @param deadline Time as returned by now(). A deadline in the past fires right away
+		  */
+		void startAt (std::uint64_t deadline);
+
 		void stop ();
 
+		inline bool armed () const
+		{
+			return m_armed;
+		}
+
+		/**
+		  * Get current time of the monotonic clock
+		  * @return Milliseconds since some unspecified starting point
+		  */
+		static std::uint64_t now ();
+
+		/**
+		  * Get how late timers fired
+		  *
+		  * Lateness is measured from the millisecond a timer was due to the
+		  * moment its callback was called.
+		  * @return Histogram of lateness in nanoseconds
+		  */
+		static const Histogram &lateness ();
+
+		/**
+		  * Move a deadline forward onto a grid of shared ticks
+		  *
+		  * Timers with deadlines on the same tick expire in the same wakeup.
+		  * @param deadline Desired deadline
+		  * @param window Distance between ticks in milliseconds
+		  * @param offset Position of the ticks within the window
+		  * @return Earliest tick not before deadline
+		  */
+		static std::uint64_t alignDeadline (std::uint64_t deadline, unsigned int window, unsigned int offset);
+
 	private:
+		enum
+		{
+			WheelBits = 6,
+			WheelSize = 1 << WheelBits,
+			WheelMask = WheelSize - 1,
+			WheelCount = 4
+		};
+
+		void link (Timer **list);
+		void unlink ();
+
+		static void init ();
+		static void schedule (Timer *timer);
+		static void update (std::uint64_t curtime);
+		static std::uint64_t nextTimeout ();
+		static void rearm ();
+
 		static void callback (int fd, void *userData);
 
 	private:
-		int m_fd;
 		bool m_armed;
 		Callback *m_callback;
 		void *m_userData;
+		std::uint64_t m_expires;
+
+		Timer *m_next;
+		Timer *m_prev;
+		Timer **m_list;
+
+		static int m_fd;
+		static std::uint64_t m_curtime;
+		static std::uint64_t m_armedTime;
+		static std::uint64_t m_pending[WheelCount];
+		static Timer *m_wheel[WheelCount][WheelSize];
+		static Timer *m_expired;
+		static Histogram m_lateness;
 };
 
 #endif // INCLUDE_TIMER_H
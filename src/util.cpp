@@ -33,15 +33,19 @@ std::uint16_t Util::checksum (const void *packet, unsigned int size, const IpAdd
 		std::memcpy(pseudoHeader + 4, dstAddr.data(), 4);
 		pseudoHeader[8] = 0;
 		pseudoHeader[9] = family;
-		*reinterpret_cast<std::uint16_t *>(pseudoHeader + 10) = htons(size);
+		std::uint16_t length = htons(size);
+		std::memcpy(pseudoHeader + 10, &length, 2);
 		pseudoHeaderSize = 12;
 	}
 	else if (srcAddr.family() == AF_INET6 && dstAddr.family() == AF_INET6)
 	{
 		std::memcpy(pseudoHeader, srcAddr.data(), 16);
 		std::memcpy(pseudoHeader + 16, dstAddr.data(), 16);
-		*reinterpret_cast<std::uint32_t *>(pseudoHeader + 32) = htonl(size);
-		*reinterpret_cast<std::uint32_t *>(pseudoHeader + 36) = htonl(family);
+		// Written with memcpy, as the header is read back 16 bits at a time
+		std::uint32_t length = htonl(size);
+		std::uint32_t nextHeader = htonl(family);
+		std::memcpy(pseudoHeader + 32, &length, 4);
+		std::memcpy(pseudoHeader + 36, &nextHeader, 4);
 		pseudoHeaderSize = 40;
 	}
 	else
@@ -66,3 +70,13 @@ std::uint16_t Util::checksum (const void *packet, unsigned int size, const IpAdd
 
 	return htons(sum & 0xFFFF);
 }
+
+std::uint16_t Util::updateChecksum (std::uint16_t checksum, std::uint16_t oldWord, std::uint16_t newWord)
+{
+	// HC' = ~(~HC + ~m + m'), which unlike eqn. 2 never produces -0
+	std::uint32_t sum = static_cast<std::uint16_t>(~checksum) + static_cast<std::uint16_t>(~oldWord) + newWord;
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return ~sum & 0xFFFF;
+}
@@ -27,6 +27,17 @@ class Util
 {
 	public:
 		static std::uint16_t checksum (const void *packet, unsigned int size, const IpAddress &srcAddr, const IpAddress &dstAddr, int family);
+
+		/**
+		  * Update an internet checksum after a 16-bit word of the data changed (RFC 1624)
+		  *
+		  * All values must be in the same byte order, e.g. as they are stored in the packet
+		  * @param checksum Checksum before the change
+		  * @param oldWord Word before the change
+		  * @param newWord Word after the change
+		  * @return Checksum after the change
+		  */
+		static std::uint16_t updateChecksum (std::uint16_t checksum, std::uint16_t oldWord, std::uint16_t newWord);
 };
 
 #endif // INCLUDE_OPENVRRP_UTIL_H
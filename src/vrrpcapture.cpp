@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "vrrpcapture.h"
+#include "ipaddress.h"
+#include "log.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <time.h>
+#include <arpa/inet.h>
+
+// pcapng block types and link types
+#define BLOCK_SECTION_HEADER 0x0A0D0D0A
+#define BLOCK_INTERFACE_DESCRIPTION 0x00000001
+#define BLOCK_ENHANCED_PACKET 0x00000006
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+
+#define OPTION_END 0
+#define OPTION_COMMENT 1
+#define OPTION_IF_TSRESOL 9
+
+#define MAX_CAPTURE_SIZE 2048
+
+static inline std::uint8_t *put16 (std::uint8_t *ptr, std::uint16_t value)
+{
+	std::memcpy(ptr, &value, sizeof(value));
+	return ptr + sizeof(value);
+}
+
+static inline std::uint8_t *put32 (std::uint8_t *ptr, std::uint32_t value)
+{
+	std::memcpy(ptr, &value, sizeof(value));
+	return ptr + sizeof(value);
+}
+
+static inline std::uint8_t *putPadded (std::uint8_t *ptr, const void *data, std::size_t size)
+{
+	std::memcpy(ptr, data, size);
+	std::size_t padded = (size + 3) & ~static_cast<std::size_t>(3);
+	std::memset(ptr + size, 0, padded - size);
+	return ptr + padded;
+}
+
+VrrpCapture::VrrpCapture () :
+	m_file(0)
+{
+}
+
+VrrpCapture::~VrrpCapture ()
+{
+	close();
+}
+
+bool VrrpCapture::open (const char *fileName)
+{
+	close();
+
+	m_file = std::fopen(fileName, "wb");
+	if (m_file == 0)
+	{
+		LOG(LOG_ERR, "Error creating capture file %s: %s", fileName, std::strerror(errno));
+		return false;
+	}
+
+	// Section header in host byte order, of unknown length
+	std::uint8_t *ptr = m_block + 8;
+	ptr = put32(ptr, 0x1A2B3C4D);
+	ptr = put16(ptr, 1);
+	ptr = put16(ptr, 0);
+	ptr = put32(ptr, 0xFFFFFFFF);
+	ptr = put32(ptr, 0xFFFFFFFF);
+	if (!writeBlock(BLOCK_SECTION_HEADER, ptr - (m_block + 8)))
+		return false;
+
+	// One interface per address family, with nanosecond timestamps
+	static const std::uint16_t linkTypes[] = {LINKTYPE_IPV4, LINKTYPE_IPV6};
+	for (unsigned int i = 0; i != 2; ++i)
+	{
+		ptr = m_block + 8;
+		ptr = put16(ptr, linkTypes[i]);
+		ptr = put16(ptr, 0);
+		ptr = put32(ptr, MAX_CAPTURE_SIZE);
+		ptr = put16(ptr, OPTION_IF_TSRESOL);
+		ptr = put16(ptr, 1);
+		std::uint8_t resolution = 9;
+		ptr = putPadded(ptr, &resolution, 1);
+		ptr = put16(ptr, OPTION_END);
+		ptr = put16(ptr, 0);
+		if (!writeBlock(BLOCK_INTERFACE_DESCRIPTION, ptr - (m_block + 8)))
+			return false;
+	}
+
+	// Packets are kept in the stdio buffer, so capturing doesn't add a system call per packet
+	std::setvbuf(m_file, 0, _IOFBF, 64 * 1024);
+
+	LOG(LOG_INFO, "Capturing VRRP packets to %s", fileName);
+	return true;
+}
+
+void VrrpCapture::write (int family, const std::uint8_t *packet, std::size_t size, int interface, const IpAddress &srcAddress, const IpAddress &dstAddress, std::uint64_t timestamp)
+{
+	if (m_file == 0)
+		return;
+
+	if (timestamp == 0)
+	{
+		timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		timestamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	std::size_t captured = (size > MAX_CAPTURE_SIZE ? MAX_CAPTURE_SIZE : size);
+
+	// No std::string here, to keep the receive path free of allocations
+	char src[INET6_ADDRSTRLEN] = "";
+	char dst[INET6_ADDRSTRLEN] = "";
+	if (srcAddress.family() != AF_UNSPEC)
+		inet_ntop(srcAddress.family(), srcAddress.data(), src, sizeof(src));
+	if (dstAddress.family() != AF_UNSPEC)
+		inet_ntop(dstAddress.family(), dstAddress.data(), dst, sizeof(dst));
+	char comment[128];
+	int commentSize = std::snprintf(comment, sizeof(comment), "ifindex=%i src=%s dst=%s", interface, src, dst);
+	if (commentSize >= static_cast<int>(sizeof(comment)))
+		commentSize = sizeof(comment) - 1;
+
+	std::uint8_t *ptr = m_block + 8;
+	ptr = put32(ptr, family == AF_INET ? 0 : 1);
+	ptr = put32(ptr, static_cast<std::uint32_t>(timestamp >> 32));
+	ptr = put32(ptr, static_cast<std::uint32_t>(timestamp));
+	ptr = put32(ptr, captured);
+	ptr = put32(ptr, size);
+	ptr = putPadded(ptr, packet, captured);
+	ptr = put16(ptr, OPTION_COMMENT);
+	ptr = put16(ptr, commentSize);
+	ptr = putPadded(ptr, comment, commentSize);
+	ptr = put16(ptr, OPTION_END);
+	ptr = put16(ptr, 0);
+	writeBlock(BLOCK_ENHANCED_PACKET, ptr - (m_block + 8));
+}
+
+void VrrpCapture::close ()
+{
+	if (m_file != 0)
+	{
+		std::fclose(m_file);
+		m_file = 0;
+	}
+}
+
+bool VrrpCapture::writeBlock (std::uint32_t type, std::size_t size)
+{
+	std::uint32_t total = size + 12;
+	put32(m_block, type);
+	put32(m_block + 4, total);
+	put32(m_block + 8 + size, total);
+
+	if (std::fwrite(m_block, total, 1, m_file) != 1)
+	{
+		LOG(LOG_ERR, "Error writing capture file: %s. Capturing stopped", std::strerror(errno));
+		close();
+		return false;
+	}
+	return true;
+}
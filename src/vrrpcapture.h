@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INCLUDE_OPENVRRP_VRRPCAPTURE_H
+#define INCLUDE_OPENVRRP_VRRPCAPTURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+class IpAddress;
+
+/**
+  * pcapng writer for received VRRP packets
+  *
+  * Every packet is written as an Enhanced Packet Block on interface 0
+  * (LINKTYPE_IPV4) or 1 (LINKTYPE_IPV6) with nanosecond timestamps. What
+  * the kernel reports in control data goes into the comment of the block as
+  * "ifindex=N src=ADDRESS dst=ADDRESS", which the replay tool reads back.
+  * The packet data is exactly what the parser saw.
+  */
+class VrrpCapture
+{
+	public:
+		VrrpCapture ();
+		~VrrpCapture ();
+
+		/**
+		  * Create a capture file, replacing any existing one
+		  * @return true on success
+		  */
+		bool open (const char *fileName);
+
+		/**
+		  * Append a packet
+		  *
+		  * Capturing stops on the first write error.
+		  * @param timestamp Receive time in nanoseconds since the epoch, or 0 for now
+		  */
+		void write (int family, const std::uint8_t *packet, std::size_t size, int interface, const IpAddress &srcAddress, const IpAddress &dstAddress, std::uint64_t timestamp);
+
+		void close ();
+
+	private:
+		bool writeBlock (std::uint32_t type, std::size_t size);
+
+	private:
+		std::FILE *m_file;
+		std::uint8_t m_block[4096];
+};
+
+#endif // INCLUDE_OPENVRRP_VRRPCAPTURE_H
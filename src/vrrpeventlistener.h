@@ -26,13 +26,18 @@
 class VrrpEventListener
 {
 	public:
+		/**
+		  * Called for every valid advertisement
+		  * @param timestamp Kernel receive time in nanoseconds since the epoch, or 0 if unknown
+		  */
 		virtual void onIncomingVrrpPacket (
 				unsigned int interface,
 				const IpAddress &address,
 				std::uint_fast8_t virtualRouterId,
 				std::uint_fast8_t priority,
 				std::uint_fast16_t maxAdvertisementInterval,
-				const IpAddressList &addresses) = 0;
+				const IpAddressListView &addresses,
+				std::uint64_t timestamp) = 0;
 
 		enum Error
 		{
@@ -45,7 +50,11 @@ class VrrpEventListener
 			PacketLengthError
 		};		
 
-		virtual void onIncomingVrrpError (unsigned int interface, std::uint_fast8_t virtualRouterId, Error error) = 0;
+		/**
+		  * Called for packets that were discarded
+		  * @param count Number of packets, more than 1 when the kernel filter discarded them
+		  */
+		virtual void onIncomingVrrpError (unsigned int interface, std::uint_fast8_t virtualRouterId, Error error, std::uint_fast64_t count) = 0;
 };
 
 #endif // INCLUDE_OPENVRRP_VRRPEVENTLISTENER_H
@@ -0,0 +1,584 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "vrrpfilter.h"
+#include "log.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+
+#ifndef SO_ATTACH_BPF
+#define SO_ATTACH_BPF 50
+#endif
+
+#define MAX_INTERFACES 1024
+#define MAX_LISTENERS 4096
+#define MAX_DROP_KEYS (MAX_INTERFACES + MAX_LISTENERS)
+
+namespace
+{
+	// Key of the drop map
+	struct DropKey
+	{
+		std::uint32_t key; // interface << 8 | virtual router id
+		std::uint32_t reason;
+	};
+
+	enum Label
+	{
+		PassLabel,
+		DropLabel,
+		KnownLabel,
+		CountLabel,
+		CreateLabel,
+		LabelCount
+	};
+
+	/*
+	 * Minimal eBPF assembler. Jumps refer to labels, which are resolved
+	 * into offsets by finish()
+	 */
+	class Program
+	{
+		public:
+			Program () :
+				m_labels(LabelCount, -1)
+			{
+			}
+
+			void emit (std::uint8_t code, std::uint8_t dst, std::uint8_t src, std::int16_t off, std::int32_t imm)
+			{
+				bpf_insn insn;
+				std::memset(&insn, 0, sizeof(insn));
+				insn.code = code;
+				insn.dst_reg = dst;
+				insn.src_reg = src;
+				insn.off = off;
+				insn.imm = imm;
+				m_insns.push_back(insn);
+			}
+
+			void movReg (int dst, int src)
+			{
+				emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0);
+			}
+
+			void movImm (int dst, std::int32_t imm)
+			{
+				emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm);
+			}
+
+			void aluImm (int op, int dst, std::int32_t imm)
+			{
+				emit(BPF_ALU64 | op | BPF_K, dst, 0, 0, imm);
+			}
+
+			void aluReg (int op, int dst, int src)
+			{
+				emit(BPF_ALU64 | op | BPF_X, dst, src, 0, 0);
+			}
+
+			void load (int size, int dst, int src, std::int16_t off)
+			{
+				emit(BPF_LDX | BPF_MEM | size, dst, src, off, 0);
+			}
+
+			void store (int size, int dst, std::int16_t off, int src)
+			{
+				emit(BPF_STX | BPF_MEM | size, dst, src, off, 0);
+			}
+
+			void atomicAdd (int dst, std::int16_t off, int src)
+			{
+				emit(BPF_STX | BPF_ATOMIC | BPF_DW, dst, src, off, BPF_ADD);
+			}
+
+			void storeImm (int size, int dst, std::int16_t off, std::int32_t imm)
+			{
+				emit(BPF_ST | BPF_MEM | size, dst, 0, off, imm);
+			}
+
+			void loadMap (int dst, int fd)
+			{
+				emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+				emit(0, 0, 0, 0, 0);
+			}
+
+			void call (int function)
+			{
+				emit(BPF_JMP | BPF_CALL, 0, 0, 0, function);
+			}
+
+			void jumpImm (int op, int dst, std::int32_t imm, Label label)
+			{
+				m_jumps.push_back(std::make_pair(m_insns.size(), label));
+				emit(BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+			}
+
+			void jump (Label label)
+			{
+				m_jumps.push_back(std::make_pair(m_insns.size(), label));
+				emit(BPF_JMP | BPF_JA, 0, 0, 0, 0);
+			}
+
+			void exit ()
+			{
+				emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+			}
+
+			void label (Label label)
+			{
+				m_labels[label] = m_insns.size();
+			}
+
+			const std::vector<bpf_insn> &finish ()
+			{
+				for (std::vector<std::pair<std::size_t, Label> >::const_iterator it = m_jumps.begin(); it != m_jumps.end(); ++it)
+					m_insns[it->first].off = m_labels[it->second] - it->first - 1;
+				return m_insns;
+			}
+
+		private:
+			std::vector<bpf_insn> m_insns;
+			std::vector<int> m_labels;
+			std::vector<std::pair<std::size_t, Label> > m_jumps;
+	};
+
+	int bpf (int cmd, bpf_attr &attr)
+	{
+		return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+	}
+
+	std::uint64_t pointer (const void *ptr)
+	{
+		return reinterpret_cast<std::uintptr_t>(ptr);
+	}
+}
+
+VrrpFilter::VrrpFilter (int family, bool packetSocket) :
+	m_family(family),
+	m_packetSocket(packetSocket),
+	m_error(0),
+	m_interfaceMap(-1),
+	m_listenerMap(-1),
+	m_dropMap(-1),
+	m_sequenceMap(-1),
+	m_program(-1),
+	m_cpus(possibleCpus()),
+	m_sequence(0),
+	m_collectedSequence(0)
+{
+}
+
+VrrpFilter::~VrrpFilter ()
+{
+	closeAll();
+}
+
+bool VrrpFilter::attach (int socket)
+{
+	if (!createMaps() || !loadProgram())
+	{
+		closeAll();
+		return false;
+	}
+
+	if (setsockopt(socket, SOL_SOCKET, SO_ATTACH_BPF, &m_program, sizeof(m_program)) == -1)
+	{
+		m_error = errno;
+		LOG(LOG_ERR, "VrrpFilter: Error attaching socket filter: %s", std::strerror(m_error));
+		closeAll();
+		return false;
+	}
+
+	return true;
+}
+
+bool VrrpFilter::createMaps ()
+{
+	static const struct
+	{
+		int VrrpFilter::*fd;
+		bpf_map_type type;
+		unsigned int keySize;
+		unsigned int valueSize;
+		unsigned int maxEntries;
+		unsigned int flags;
+	} maps[] = {
+		{&VrrpFilter::m_interfaceMap, BPF_MAP_TYPE_HASH, sizeof(std::uint32_t), sizeof(std::uint8_t), MAX_INTERFACES, 0},
+		{&VrrpFilter::m_listenerMap, BPF_MAP_TYPE_HASH, sizeof(std::uint32_t), sizeof(std::uint8_t), MAX_LISTENERS, 0},
+		{&VrrpFilter::m_dropMap, BPF_MAP_TYPE_PERCPU_HASH, sizeof(DropKey), sizeof(std::uint64_t), MAX_DROP_KEYS, 0},
+		{&VrrpFilter::m_sequenceMap, BPF_MAP_TYPE_ARRAY, sizeof(std::uint32_t), sizeof(std::uint64_t), 1, BPF_F_MMAPABLE}
+	};
+
+	for (std::size_t i = 0; i != sizeof(maps) / sizeof(maps[0]); ++i)
+	{
+		bpf_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.map_type = maps[i].type;
+		attr.key_size = maps[i].keySize;
+		attr.value_size = maps[i].valueSize;
+		attr.max_entries = maps[i].maxEntries;
+		attr.map_flags = maps[i].flags;
+
+		this->*maps[i].fd = bpf(BPF_MAP_CREATE, attr);
+		if (this->*maps[i].fd == -1)
+		{
+			m_error = errno;
+			LOG(LOG_ERR, "VrrpFilter: Error creating BPF map: %s", std::strerror(m_error));
+			return false;
+		}
+	}
+
+	void *sequence = mmap(0, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, m_sequenceMap, 0);
+	if (sequence == MAP_FAILED)
+	{
+		m_error = errno;
+		LOG(LOG_ERR, "VrrpFilter: Error mapping BPF map: %s", std::strerror(m_error));
+		return false;
+	}
+	m_sequence = reinterpret_cast<volatile std::uint64_t *>(sequence);
+
+	return true;
+}
+
+bool VrrpFilter::loadProgram ()
+{
+	// Stack layout relative to the frame pointer
+	enum
+	{
+		InterfaceKey = -4,     // u32 key of the interface map
+		ListenerKey = -8,      // u32 key of the listener map
+		DropKeyOffset = -16,   // DropKey
+		DropValue = -24,       // u64 initial drop count
+		SequenceKey = -28,     // u32 key of the sequence map
+		IpHeader = -72,        // 40 bytes of IP header
+		VrrpHeader = -80       // 8 bytes of VRRP header
+	};
+
+	Program p;
+
+	p.movReg(BPF_REG_6, BPF_REG_1);
+	p.load(BPF_W, BPF_REG_7, BPF_REG_6, offsetof(__sk_buff, ifindex));
+
+	// Pass nothing from interfaces without virtual routers
+	p.store(BPF_W, BPF_REG_10, InterfaceKey, BPF_REG_7);
+	p.loadMap(BPF_REG_1, m_interfaceMap);
+	p.movReg(BPF_REG_2, BPF_REG_10);
+	p.aluImm(BPF_ADD, BPF_REG_2, InterfaceKey);
+	p.call(BPF_FUNC_map_lookup_elem);
+	p.jumpImm(BPF_JEQ, BPF_REG_0, 0, DropLabel);
+
+	// Get TTL into r8 and the VRRP header offset into r2. Raw IPv6 sockets don't see the IP header in the packet data, so go through the network header for both families
+	p.movReg(BPF_REG_1, BPF_REG_6);
+	p.movImm(BPF_REG_2, 0);
+	p.movReg(BPF_REG_3, BPF_REG_10);
+	p.aluImm(BPF_ADD, BPF_REG_3, IpHeader);
+	p.movImm(BPF_REG_4, m_family == AF_INET ? 20 : 40);
+	p.movImm(BPF_REG_5, BPF_HDR_START_NET);
+	p.call(BPF_FUNC_skb_load_bytes_relative);
+	p.jumpImm(BPF_JNE, BPF_REG_0, 0, PassLabel);
+	if (m_family == AF_INET)
+	{
+		if (m_packetSocket)
+		{
+			p.load(BPF_B, BPF_REG_2, BPF_REG_10, IpHeader + 9);
+			p.jumpImm(BPF_JNE, BPF_REG_2, 112, DropLabel);
+		}
+		p.load(BPF_B, BPF_REG_8, BPF_REG_10, IpHeader + 8);
+		p.load(BPF_B, BPF_REG_2, BPF_REG_10, IpHeader);
+		p.aluImm(BPF_AND, BPF_REG_2, 0x0F);
+		p.aluImm(BPF_LSH, BPF_REG_2, 2);
+	}
+	else
+	{
+		// Leave packets with extension headers to user space. A packet socket only gets VRRP without them
+		p.load(BPF_B, BPF_REG_2, BPF_REG_10, IpHeader + 6);
+		p.jumpImm(BPF_JNE, BPF_REG_2, 112, m_packetSocket ? DropLabel : PassLabel);
+		p.load(BPF_B, BPF_REG_8, BPF_REG_10, IpHeader + 7);
+		p.movImm(BPF_REG_2, 40);
+	}
+
+	// Only judge VRRPv3 advertisements. Everything else must reach the error handling in user space
+	p.movReg(BPF_REG_1, BPF_REG_6);
+	p.movReg(BPF_REG_3, BPF_REG_10);
+	p.aluImm(BPF_ADD, BPF_REG_3, VrrpHeader);
+	p.movImm(BPF_REG_4, 8);
+	p.movImm(BPF_REG_5, BPF_HDR_START_NET);
+	p.call(BPF_FUNC_skb_load_bytes_relative);
+	p.jumpImm(BPF_JNE, BPF_REG_0, 0, PassLabel);
+	p.load(BPF_B, BPF_REG_9, BPF_REG_10, VrrpHeader);
+	p.jumpImm(BPF_JNE, BPF_REG_9, 0x31, PassLabel);
+
+	// Look up the virtual router
+	p.load(BPF_B, BPF_REG_9, BPF_REG_10, VrrpHeader + 1);
+	p.movReg(BPF_REG_1, BPF_REG_7);
+	p.aluImm(BPF_LSH, BPF_REG_1, 8);
+	p.aluReg(BPF_OR, BPF_REG_1, BPF_REG_9);
+	p.store(BPF_W, BPF_REG_10, ListenerKey, BPF_REG_1);
+	p.loadMap(BPF_REG_1, m_listenerMap);
+	p.movReg(BPF_REG_2, BPF_REG_10);
+	p.aluImm(BPF_ADD, BPF_REG_2, ListenerKey);
+	p.call(BPF_FUNC_map_lookup_elem);
+	p.jumpImm(BPF_JNE, BPF_REG_0, 0, KnownLabel);
+
+	// Unknown virtual router. Counted per interface
+	p.movReg(BPF_REG_1, BPF_REG_7);
+	p.aluImm(BPF_LSH, BPF_REG_1, 8);
+	p.movImm(BPF_REG_2, VrIdDrop);
+	p.jump(CountLabel);
+
+	p.label(KnownLabel);
+	p.jumpImm(BPF_JEQ, BPF_REG_8, 255, PassLabel);
+	p.load(BPF_W, BPF_REG_1, BPF_REG_10, ListenerKey);
+	p.movImm(BPF_REG_2, TtlDrop);
+
+	// Increment the drop counter of key r1 and reason r2
+	p.label(CountLabel);
+	p.store(BPF_W, BPF_REG_10, DropKeyOffset + static_cast<int>(offsetof(DropKey, key)), BPF_REG_1);
+	p.store(BPF_W, BPF_REG_10, DropKeyOffset + static_cast<int>(offsetof(DropKey, reason)), BPF_REG_2);
+	p.storeImm(BPF_W, BPF_REG_10, SequenceKey, 0);
+	p.loadMap(BPF_REG_1, m_sequenceMap);
+	p.movReg(BPF_REG_2, BPF_REG_10);
+	p.aluImm(BPF_ADD, BPF_REG_2, SequenceKey);
+	p.call(BPF_FUNC_map_lookup_elem);
+	p.jumpImm(BPF_JEQ, BPF_REG_0, 0, DropLabel);
+	p.movImm(BPF_REG_1, 1);
+	p.atomicAdd(BPF_REG_0, 0, BPF_REG_1);
+	p.loadMap(BPF_REG_1, m_dropMap);
+	p.movReg(BPF_REG_2, BPF_REG_10);
+	p.aluImm(BPF_ADD, BPF_REG_2, DropKeyOffset);
+	p.call(BPF_FUNC_map_lookup_elem);
+	p.jumpImm(BPF_JEQ, BPF_REG_0, 0, CreateLabel);
+	p.load(BPF_DW, BPF_REG_1, BPF_REG_0, 0);
+	p.aluImm(BPF_ADD, BPF_REG_1, 1);
+	p.store(BPF_DW, BPF_REG_0, 0, BPF_REG_1);
+	p.jump(DropLabel);
+
+	p.label(CreateLabel);
+	p.storeImm(BPF_DW, BPF_REG_10, DropValue, 1);
+	p.loadMap(BPF_REG_1, m_dropMap);
+	p.movReg(BPF_REG_2, BPF_REG_10);
+	p.aluImm(BPF_ADD, BPF_REG_2, DropKeyOffset);
+	p.movReg(BPF_REG_3, BPF_REG_10);
+	p.aluImm(BPF_ADD, BPF_REG_3, DropValue);
+	p.movImm(BPF_REG_4, BPF_NOEXIST);
+	p.call(BPF_FUNC_map_update_elem);
+
+	p.label(DropLabel);
+	p.movImm(BPF_REG_0, 0);
+	p.exit();
+
+	p.label(PassLabel);
+	p.load(BPF_W, BPF_REG_0, BPF_REG_6, offsetof(__sk_buff, len));
+	p.exit();
+
+	const std::vector<bpf_insn> &insns = p.finish();
+
+	static char log[16384];
+	log[0] = 0;
+
+	bpf_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+	attr.insns = pointer(&insns[0]);
+	attr.insn_cnt = insns.size();
+	attr.license = pointer("GPL");
+	attr.log_buf = pointer(log);
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+
+	m_program = bpf(BPF_PROG_LOAD, attr);
+	if (m_program == -1)
+	{
+		m_error = errno;
+		LOG(LOG_ERR, "VrrpFilter: Error loading socket filter: %s", std::strerror(m_error));
+		if (log[0] != 0)
+			LOG(LOG_DEBUG, "VrrpFilter: Verifier log: %s", log);
+		return false;
+	}
+
+	return true;
+}
+
+void VrrpFilter::closeAll ()
+{
+	if (m_sequence != 0)
+	{
+		munmap(const_cast<std::uint64_t *>(m_sequence), sysconf(_SC_PAGESIZE));
+		m_sequence = 0;
+	}
+
+	int *fds[] = {&m_program, &m_sequenceMap, &m_dropMap, &m_listenerMap, &m_interfaceMap};
+	for (std::size_t i = 0; i != sizeof(fds) / sizeof(fds[0]); ++i)
+	{
+		if (*fds[i] != -1)
+		{
+			while (close(*fds[i]) == -1 && errno == EINTR);
+			*fds[i] = -1;
+		}
+	}
+	m_dropTotals.clear();
+}
+
+void VrrpFilter::addListener (unsigned int interface, std::uint_fast8_t virtualRouterId)
+{
+	if (m_program == -1)
+		return;
+
+	std::uint8_t value = 1;
+	std::uint32_t interfaceKey = interface;
+	std::uint32_t listenerKey = (interface << 8) | virtualRouterId;
+
+	// Add the virtual router before the interface so none of its packets are counted as VRID errors
+	updateElement(m_listenerMap, &listenerKey, &value);
+	updateElement(m_interfaceMap, &interfaceKey, &value);
+}
+
+void VrrpFilter::removeListener (unsigned int interface, std::uint_fast8_t virtualRouterId, bool lastOnInterface)
+{
+	if (m_program == -1)
+		return;
+
+	std::uint32_t listenerKey = (interface << 8) | virtualRouterId;
+	deleteElement(m_listenerMap, &listenerKey);
+	forgetDrops(listenerKey, TtlDrop);
+
+	if (lastOnInterface)
+	{
+		std::uint32_t interfaceKey = interface;
+		deleteElement(m_interfaceMap, &interfaceKey);
+		forgetDrops(interface << 8, VrIdDrop);
+	}
+}
+
+void VrrpFilter::collectDrops (std::vector<Drop> &drops)
+{
+	if (m_program == -1)
+		return;
+
+	// Drops counted after this are seen by the next call
+	m_collectedSequence = *m_sequence;
+
+	std::vector<std::uint64_t> values(m_cpus);
+
+	DropKey key;
+	bpf_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.map_fd = m_dropMap;
+	attr.key = 0; // Start with the first key
+	attr.next_key = pointer(&key);
+	while (bpf(BPF_MAP_GET_NEXT_KEY, attr) == 0)
+	{
+		bpf_attr lookup;
+		std::memset(&lookup, 0, sizeof(lookup));
+		lookup.map_fd = m_dropMap;
+		lookup.key = pointer(&key);
+		lookup.value = pointer(&values[0]);
+		if (bpf(BPF_MAP_LOOKUP_ELEM, lookup) == 0)
+		{
+			std::uint64_t total = 0;
+			for (int cpu = 0; cpu != m_cpus; ++cpu)
+				total += values[cpu];
+
+			std::uint64_t &last = m_dropTotals[(static_cast<std::uint64_t>(key.reason) << 32) | key.key];
+			if (total != last)
+			{
+				Drop drop;
+				drop.interface = key.key >> 8;
+				drop.virtualRouterId = key.key & 0xFF;
+				drop.reason = static_cast<Reason>(key.reason);
+				drop.count = total - last;
+				drops.push_back(drop);
+				last = total;
+			}
+		}
+
+		attr.key = pointer(&key);
+	}
+}
+
+void VrrpFilter::updateElement (int map, const void *key, const void *value)
+{
+	bpf_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map;
+	attr.key = pointer(key);
+	attr.value = pointer(value);
+	attr.flags = BPF_ANY;
+	if (bpf(BPF_MAP_UPDATE_ELEM, attr) == -1)
+	{
+		m_error = errno;
+		LOG(LOG_WARNING, "VrrpFilter: Error updating BPF map: %s", std::strerror(m_error));
+	}
+}
+
+void VrrpFilter::deleteElement (int map, const void *key)
+{
+	bpf_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map;
+	attr.key = pointer(key);
+	if (bpf(BPF_MAP_DELETE_ELEM, attr) == -1 && errno != ENOENT)
+	{
+		m_error = errno;
+		LOG(LOG_WARNING, "VrrpFilter: Error deleting from BPF map: %s", std::strerror(m_error));
+	}
+}
+
+void VrrpFilter::forgetDrops (std::uint32_t key, Reason reason)
+{
+	DropKey dropKey;
+	dropKey.key = key;
+	dropKey.reason = reason;
+	deleteElement(m_dropMap, &dropKey);
+	m_dropTotals.erase((static_cast<std::uint64_t>(reason) << 32) | key);
+}
+
+int VrrpFilter::possibleCpus ()
+{
+	// Per-CPU map values have one slot for every possible CPU, such as "0-3,8-11"
+	int count = 0;
+	std::FILE *file = std::fopen("/sys/devices/system/cpu/possible", "r");
+	if (file != 0)
+	{
+		unsigned int first, last;
+		char separator;
+		while (std::fscanf(file, "%u", &first) == 1)
+		{
+			last = first;
+			if (std::fscanf(file, "%c", &separator) == 1 && separator == '-')
+			{
+				if (std::fscanf(file, "%u", &last) != 1)
+					break;
+				std::fscanf(file, "%c", &separator);
+			}
+			count += last - first + 1;
+		}
+		std::fclose(file);
+	}
+	return (count == 0 ? 1 : count);
+}
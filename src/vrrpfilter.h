@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INCLUDE_OPENVRRP_VRRPFILTER_H
+#define INCLUDE_OPENVRRP_VRRPFILTER_H
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/**
+  * eBPF socket filter for a VRRP socket
+  *
+  * The filter drops VRRP packets in the kernel that would be discarded after
+  * being copied to user space anyway: packets on interfaces without virtual
+  * routers, advertisements for virtual routers we don't run, and
+  * advertisements with a TTL or hop limit other than 255. Everything else,
+  * including every other kind of malformed packet, is passed on.
+  *
+  * The virtual routers are kept in BPF maps, so the program itself never
+  * changes. Dropped advertisements are counted in a per-CPU map, which
+  * collectDrops() turns into counter increments. A shared sequence number,
+  * mapped into our memory, tells whether anything was dropped without a
+  * system call.
+  */
+class VrrpFilter
+{
+	public:
+		enum Reason
+		{
+			VrIdDrop,
+			TtlDrop
+		};
+
+		struct Drop
+		{
+			unsigned int interface;
+			std::uint_fast8_t virtualRouterId; // 0 for VrIdDrop
+			Reason reason;
+			std::uint_fast64_t count;
+		};
+
+		/**
+		  * @param family Address family of the socket
+		  * @param packetSocket The socket receives all IP packets and not just VRRP
+		  */
+		VrrpFilter (int family, bool packetSocket);
+		~VrrpFilter ();
+
+		/**
+		  * Load the filter and attach it to a socket
+		  * @return true on success. The socket is unfiltered on failure
+		  */
+		bool attach (int socket);
+
+		void addListener (unsigned int interface, std::uint_fast8_t virtualRouterId);
+
+		/**
+		  * Remove a virtual router from the filter
+		  * @param lastOnInterface Also stop accepting packets from the interface
+		  */
+		void removeListener (unsigned int interface, std::uint_fast8_t virtualRouterId, bool lastOnInterface);
+
+		/**
+		  * Get packets dropped since the last call
+		  * @param drops Vector to append the drops to
+		  */
+		void collectDrops (std::vector<Drop> &drops);
+
+		/**
+		  * Check whether packets were dropped since the last collectDrops()
+		  */
+		inline bool pendingDrops () const
+		{
+			return m_sequence != 0 && *m_sequence != m_collectedSequence;
+		}
+
+		inline int error () const
+		{
+			return m_error;
+		}
+
+	private:
+		bool createMaps ();
+		bool loadProgram ();
+		void closeAll ();
+
+		void updateElement (int map, const void *key, const void *value);
+		void deleteElement (int map, const void *key);
+		void forgetDrops (std::uint32_t key, Reason reason);
+
+		static int possibleCpus ();
+
+	private:
+		int m_family;
+		bool m_packetSocket;
+		int m_error;
+		int m_interfaceMap;
+		int m_listenerMap;
+		int m_dropMap;
+		int m_sequenceMap;
+		int m_program;
+		int m_cpus;
+
+		volatile std::uint64_t *m_sequence;
+		std::uint64_t m_collectedSequence;
+
+		// Totals of the drop map at the last collectDrops(), by key
+		std::map<std::uint64_t, std::uint64_t> m_dropTotals;
+};
+
+#endif // INCLUDE_OPENVRRP_VRRPFILTER_H
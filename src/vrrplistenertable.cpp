@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "vrrplistenertable.h"
+
+#include <cstring>
+
+void VrrpListenerTable::add (unsigned int interface, std::uint_fast8_t virtualRouterId, VrrpEventListener *listener)
+{
+	if (interface >= m_slotByInterface.size())
+		m_slotByInterface.resize(interface + 1, 0);
+
+	if (m_slotByInterface[interface] == 0)
+	{
+		Interface slot;
+		slot.interface = interface;
+		slot.count = 0;
+		std::memset(slot.listeners, 0, sizeof(slot.listeners));
+		m_slots.push_back(slot);
+		m_slotByInterface[interface] = m_slots.size();
+	}
+
+	Interface &slot = m_slots[m_slotByInterface[interface] - 1];
+	if (slot.listeners[virtualRouterId] == 0)
+	{
+		// Keep ids sorted, so listeners are notified in the same order as before
+		unsigned int pos = slot.count;
+		while (pos != 0 && slot.ids[pos - 1] > virtualRouterId)
+		{
+			slot.ids[pos] = slot.ids[pos - 1];
+			--pos;
+		}
+		slot.ids[pos] = virtualRouterId;
+		++slot.count;
+	}
+	slot.listeners[virtualRouterId] = listener;
+}
+
+bool VrrpListenerTable::remove (unsigned int interface, std::uint_fast8_t virtualRouterId)
+{
+	if (interface >= m_slotByInterface.size() || m_slotByInterface[interface] == 0)
+		return false;
+
+	unsigned int index = m_slotByInterface[interface] - 1;
+	Interface &slot = m_slots[index];
+	if (slot.listeners[virtualRouterId] == 0)
+		return false;
+
+	slot.listeners[virtualRouterId] = 0;
+	unsigned int pos = 0;
+	while (slot.ids[pos] != virtualRouterId)
+		++pos;
+	--slot.count;
+	std::memmove(slot.ids + pos, slot.ids + pos + 1, slot.count - pos);
+
+	if (slot.count != 0)
+		return false;
+
+	// Fill the hole with the last slot
+	m_slotByInterface[interface] = 0;
+	if (index != m_slots.size() - 1)
+	{
+		slot = m_slots.back();
+		m_slotByInterface[slot.interface] = index + 1;
+	}
+	m_slots.pop_back();
+	return true;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INCLUDE_OPENVRRP_VRRPLISTENERTABLE_H
+#define INCLUDE_OPENVRRP_VRRPLISTENERTABLE_H
+
+#include <cstdint>
+#include <vector>
+
+class VrrpEventListener;
+
+/**
+  * Event listeners of a VRRP socket by interface and virtual router id
+  *
+  * Every interface with listeners has a slot with a 256 entry array indexed
+  * by virtual router id, so finding the listener of a packet takes two array
+  * lookups. The slots are kept dense and are found through a table indexed
+  * by interface index.
+  */
+class VrrpListenerTable
+{
+	public:
+		struct Interface
+		{
+			unsigned int interface;
+			unsigned int count;
+			std::uint8_t ids[256]; // Virtual router ids with listeners, in ascending order
+			VrrpEventListener *listeners[256];
+
+			inline VrrpEventListener *find (std::uint_fast8_t virtualRouterId) const
+			{
+				return listeners[virtualRouterId];
+			}
+		};
+
+		/**
+		  * Add or replace a listener
+		  */
+		void add (unsigned int interface, std::uint_fast8_t virtualRouterId, VrrpEventListener *listener);
+
+		/**
+		  * Remove a listener
+		  * @return true if it was the last listener of the interface
+		  */
+		bool remove (unsigned int interface, std::uint_fast8_t virtualRouterId);
+
+		/**
+		  * Get the listeners of an interface
+		  * @return Listeners or 0 if the interface has none
+		  */
+		inline const Interface *find (unsigned int interface) const
+		{
+			if (interface >= m_slotByInterface.size() || m_slotByInterface[interface] == 0)
+				return 0;
+			return &m_slots[m_slotByInterface[interface] - 1];
+		}
+
+		inline VrrpEventListener *find (unsigned int interface, std::uint_fast8_t virtualRouterId) const
+		{
+			const Interface *listeners = find(interface);
+			return (listeners == 0 ? 0 : listeners->find(virtualRouterId));
+		}
+
+	private:
+		std::vector<Interface> m_slots;
+		std::vector<std::uint16_t> m_slotByInterface; // Slot index + 1, or 0
+};
+
+#endif // INCLUDE_OPENVRRP_VRRPLISTENERTABLE_H
@@ -18,8 +18,9 @@
 #include "vrrpmanager.h"
 #include "vrrpservice.h"
 #include "netlink.h"
+#include "vrrpsocket.h"
+#include "log.h"
 
-#include <syslog.h>
 
 VrrpManager::VrrpServiceMap VrrpManager::m_services;
 
@@ -52,13 +53,13 @@ VrrpService *VrrpManager::getService (int interface, std::uint_fast8_t virtualRo
 		VrrpService *service = new VrrpService(interface, family, virtualRouterId, vlanId);
 		if (service->error() == 0)
 		{
-			syslog(LOG_INFO, "Created %s router with VID %hhu on interface %i (VLAN %hu)", family == AF_INET ? "IPv4" : "IPv6", virtualRouterId, interface, static_cast<unsigned short int>(vlanId));
+			LOG_UNLIMITED(LOG_INFO, "Created %s router with VID %hhu on interface %i (VLAN %hu)", family == AF_INET ? "IPv4" : "IPv6", virtualRouterId, interface, static_cast<unsigned short int>(vlanId));
 			m_services[interface][virtualRouterId][family] = service;
 			return service;
 		}
 		else
 		{
-			syslog(LOG_ERR, "Error creating %s router with VID %hhu on interface %i (VLAN %hu)", family == AF_INET ? "IPv4" : "IPv6", virtualRouterId, interface, static_cast<unsigned const int>(vlanId));
+			LOG(LOG_ERR, "Error creating %s router with VID %hhu on interface %i (VLAN %hu)", family == AF_INET ? "IPv4" : "IPv6", virtualRouterId, interface, static_cast<unsigned const int>(vlanId));
 			delete service;
 			return 0;
 		}
@@ -98,3 +99,62 @@ void VrrpManager::removeService (VrrpService *service)
 	
 	}
 }
+
+void VrrpManager::shutdown ()
+{
+	// Send all the priority 0 advertisements before any addresses are removed or scripts are run
+	for (VrrpServiceMap::const_iterator interfaceServices = m_services.begin(); interfaceServices != m_services.end(); ++interfaceServices)
+	{
+		for (VrrpServiceMap::mapped_type::const_iterator routerServices = interfaceServices->second.begin(); routerServices != interfaceServices->second.end(); ++routerServices)
+		{
+			for (VrrpServiceMap::mapped_type::mapped_type::const_iterator service = routerServices->second.begin(); service != routerServices->second.end(); ++service)
+				service->second->resign();
+		}
+	}
+
+	// One batch for all of them
+	VrrpSocket::flushAll();
+
+	for (VrrpServiceMap::const_iterator interfaceServices = m_services.begin(); interfaceServices != m_services.end(); ++interfaceServices)
+	{
+		for (VrrpServiceMap::mapped_type::const_iterator routerServices = interfaceServices->second.begin(); routerServices != interfaceServices->second.end(); ++routerServices)
+		{
+			for (VrrpServiceMap::mapped_type::mapped_type::const_iterator service = routerServices->second.begin(); service != routerServices->second.end(); ++service)
+				service->second->disable();
+		}
+	}
+}
+
+void VrrpManager::logStatistics ()
+{
+	VrrpSocket::updateStatistics();
+
+	LOG_UNLIMITED(LOG_INFO, "Router Checksum Errors: %llu, Version Errors: %llu, VRID Errors: %llu",
+			(unsigned long long int)VrrpSocket::routerChecksumErrors(),
+			(unsigned long long int)VrrpSocket::routerVersionErrors(),
+			(unsigned long long int)VrrpSocket::routerVrIdErrors());
+
+	for (VrrpServiceMap::const_iterator interfaceServices = m_services.begin(); interfaceServices != m_services.end(); ++interfaceServices)
+	{
+		for (VrrpServiceMap::mapped_type::const_iterator routerServices = interfaceServices->second.begin(); routerServices != interfaceServices->second.end(); ++routerServices)
+		{
+			for (VrrpServiceMap::mapped_type::mapped_type::const_iterator service = routerServices->second.begin(); service != routerServices->second.end(); ++service)
+			{
+				const VrrpService *s = service->second;
+				LOG_UNLIMITED(LOG_INFO, "%s router with VID %hhu on interface %i: Master Transitions: %lu, Rcvd Advertisements: %llu, Adv Interval Errors: %llu, IP TTL Errors: %llu, Rcvd Pri Zero: %llu, Sent Pri Zero: %llu, Invalid Type: %llu, Address List Errors: %llu, Packet Length Errors: %llu",
+						s->family() == AF_INET ? "IPv4" : "IPv6",
+						s->virtualRouterId(),
+						s->interface(),
+						(unsigned long int)s->statsMasterTransitions(),
+						(unsigned long long int)s->statsRcvdAdvertisements(),
+						(unsigned long long int)s->statsAdvIntervalErrors(),
+						(unsigned long long int)s->statsIpTtlErrors(),
+						(unsigned long long int)s->statsRcvdPriZeroPackets(),
+						(unsigned long long int)s->statsSentPriZeroPackets(),
+						(unsigned long long int)s->statsRcvdInvalidTypePackets(),
+						(unsigned long long int)s->statsAddressListErrors(),
+						(unsigned long long int)s->statsPacketLengthErrors());
+			}
+		}
+	}
+}
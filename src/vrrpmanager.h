@@ -41,6 +41,20 @@ class VrrpManager
 		static void removeVrrpInterfaces ();
 		static void cleanup ();
 
+		/**
+		  * Take down all routers in an orderly fashion
+		  *
+		  * Every master sends its priority 0 advertisement first, so backups
+		  * can take over all routers at once, and then all routers are
+		  * disabled.
+		  */
+		static void shutdown ();
+
+		/**
+		  * Log statistics of all routers to syslog
+		  */
+		static void logStatistics ();
+
 		enum ProtocolErrorReason
 		{
 			NoError = 0,
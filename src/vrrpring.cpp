@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "vrrpring.h"
+#include "log.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+
+#define RING_BLOCK_SIZE (1 << 16)
+#define RING_BLOCK_COUNT 32
+#define RING_FRAME_SIZE 2048
+
+// A block is handed over when it's full or this many milliseconds after its first packet. VRRP timing is in centiseconds, so keep it short
+#define RING_BLOCK_TIMEOUT 1
+
+VrrpRing::VrrpRing (int family) :
+	m_family(family),
+	m_fd(-1),
+	m_error(0),
+	m_ring(0),
+	m_ringSize(0),
+	m_blockSize(RING_BLOCK_SIZE),
+	m_blockCount(RING_BLOCK_COUNT),
+	m_currentBlock(0)
+{
+}
+
+VrrpRing::~VrrpRing ()
+{
+	close();
+}
+
+bool VrrpRing::open ()
+{
+	int protocol = htons(m_family == AF_INET ? ETH_P_IP : ETH_P_IPV6);
+
+	// Cooked mode, so packets start with the IP header on any link type. Nothing is received until bind()
+	m_fd = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (m_fd == -1)
+	{
+		m_error = errno;
+		LOG(LOG_ERR, "VrrpRing: Error creating packet socket: %s", std::strerror(m_error));
+		return false;
+	}
+
+	// Filter before binding, so nothing else gets queued in between
+	if (!attachProtocolFilter())
+	{
+		close();
+		return false;
+	}
+
+	int val = 1;
+	if (setsockopt(m_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &val, sizeof(val)) == -1)
+		LOG(LOG_NOTICE, "VrrpRing: Unable to ignore outgoing packets: %s", std::strerror(errno));
+
+	val = TPACKET_V3;
+	if (setsockopt(m_fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val)) == -1)
+	{
+		m_error = errno;
+		LOG(LOG_ERR, "VrrpRing: Error selecting TPACKET_V3: %s", std::strerror(m_error));
+		close();
+		return false;
+	}
+
+	tpacket_req3 req;
+	std::memset(&req, 0, sizeof(req));
+	req.tp_block_size = m_blockSize;
+	req.tp_block_nr = m_blockCount;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = m_blockSize / RING_FRAME_SIZE * m_blockCount;
+	req.tp_retire_blk_tov = RING_BLOCK_TIMEOUT;
+	if (setsockopt(m_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+	{
+		m_error = errno;
+		LOG(LOG_ERR, "VrrpRing: Error creating receive ring: %s", std::strerror(m_error));
+		close();
+		return false;
+	}
+
+	m_ringSize = static_cast<std::size_t>(m_blockSize) * m_blockCount;
+	void *ring = mmap(0, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED | MAP_POPULATE, m_fd, 0);
+	if (ring == MAP_FAILED)
+	{
+		// MAP_LOCKED fails without CAP_IPC_LOCK or enough RLIMIT_MEMLOCK
+		ring = mmap(0, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, 0);
+		if (ring == MAP_FAILED)
+		{
+			m_error = errno;
+			LOG(LOG_ERR, "VrrpRing: Error mapping receive ring: %s", std::strerror(m_error));
+			close();
+			return false;
+		}
+	}
+	m_ring = reinterpret_cast<std::uint8_t *>(ring);
+
+	sockaddr_ll addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = protocol;
+	addr.sll_ifindex = 0; // All interfaces
+	if (bind(m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1)
+	{
+		m_error = errno;
+		LOG(LOG_ERR, "VrrpRing: Error binding packet socket: %s", std::strerror(m_error));
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool VrrpRing::attachProtocolFilter ()
+{
+	// Accept whole packets with IP protocol / IPv6 next header 112
+	sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, static_cast<unsigned int>(m_family == AF_INET ? 9 : 6)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 112, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xFFFF),
+		BPF_STMT(BPF_RET | BPF_K, 0)
+	};
+
+	sock_fprog program;
+	program.len = sizeof(code) / sizeof(code[0]);
+	program.filter = code;
+	if (setsockopt(m_fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == -1)
+	{
+		m_error = errno;
+		LOG(LOG_ERR, "VrrpRing: Error attaching socket filter: %s", std::strerror(m_error));
+		return false;
+	}
+	return true;
+}
+
+void VrrpRing::close ()
+{
+	if (m_ring != 0)
+	{
+		munmap(m_ring, m_ringSize);
+		m_ring = 0;
+	}
+	if (m_fd != -1)
+	{
+		while (::close(m_fd) == -1 && errno == EINTR);
+		m_fd = -1;
+	}
+}
+
+unsigned int VrrpRing::receive (PacketCallback *callback, void *userData)
+{
+	unsigned int packets = 0;
+
+	// Visit each block at most once, so a flood can't keep us here
+	for (unsigned int i = 0; i != m_blockCount; ++i)
+	{
+		tpacket_block_desc *block = reinterpret_cast<tpacket_block_desc *>(m_ring + static_cast<std::size_t>(m_currentBlock) * m_blockSize);
+		if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+			break;
+
+		const std::uint8_t *ptr = reinterpret_cast<const std::uint8_t *>(block) + block->hdr.bh1.offset_to_first_pkt;
+		for (unsigned int j = 0; j != block->hdr.bh1.num_pkts; ++j)
+		{
+			const tpacket3_hdr *hdr = reinterpret_cast<const tpacket3_hdr *>(ptr);
+			const sockaddr_ll *addr = reinterpret_cast<const sockaddr_ll *>(ptr + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+			if (addr->sll_pkttype != PACKET_OUTGOING)
+				callback(ptr + hdr->tp_net, hdr->tp_snaplen, addr->sll_ifindex, hdr->tp_sec * 1000000000ULL + hdr->tp_nsec, userData);
+			ptr += hdr->tp_next_offset;
+			++packets;
+		}
+
+		// Hand the block back
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		m_currentBlock = (m_currentBlock + 1) % m_blockCount;
+	}
+
+	return packets;
+}
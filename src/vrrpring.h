@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2012 Peter Christensen <pch@ordbogen.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INCLUDE_OPENVRRP_VRRPRING_H
+#define INCLUDE_OPENVRRP_VRRPRING_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+  * Memory mapped TPACKET_V3 receive ring for VRRP packets
+  *
+  * An AF_PACKET socket hands over whole blocks of packets in a ring shared
+  * with the kernel, so a wakeup can deliver many packets without copying
+  * them. A socket filter passes only packets of IP protocol 112 and
+  * packets sent by us are ignored.
+  */
+class VrrpRing
+{
+	public:
+		/**
+		  * Called for every received packet
+		  * @param packet Packet starting with the IP header. Only valid during the call
+		  * @param size Size of packet
+		  * @param interface Receiving interface
+		  * @param timestamp Kernel receive time in nanoseconds since the epoch
+		  */
+		typedef void (PacketCallback)(const std::uint8_t *packet, std::size_t size, int interface, std::uint64_t timestamp, void *userData);
+
+		explicit VrrpRing (int family);
+		~VrrpRing ();
+
+		/**
+		  * Create the socket and map the ring
+		  * @return true on success
+		  */
+		bool open ();
+
+		inline int fd () const
+		{
+			return m_fd;
+		}
+
+		inline int error () const
+		{
+			return m_error;
+		}
+
+		/**
+		  * Pass all packets of the blocks the kernel has handed over to a callback
+		  * @return Number of packets
+		  */
+		unsigned int receive (PacketCallback *callback, void *userData);
+
+	private:
+		bool attachProtocolFilter ();
+		void close ();
+
+	private:
+		int m_family;
+		int m_fd;
+		int m_error;
+		std::uint8_t *m_ring;
+		std::size_t m_ringSize;
+		unsigned int m_blockSize;
+		unsigned int m_blockCount;
+		unsigned int m_currentBlock;
+};
+
+#endif // INCLUDE_OPENVRRP_VRRPRING_H
@@ -21,20 +21,25 @@
 #include "vrrpservice.h"
 #include "vrrpsocket.h"
 #include "arpservice.h"
+#include "realtime.h"
+#include "log.h"
 
 #include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <cstdlib>
 
+#include <time.h>
 #include <unistd.h>
-#include <syslog.h>
 #include <signal.h>
 #include <net/if.h>
 #include <linux/ethtool.h>
 #include <linux/sockios.h>
 #include <sys/ioctl.h>
 
+unsigned int VrrpService::m_coalesceWindow = 0;
+unsigned int VrrpService::m_coalescePhases = 1;
+
 VrrpService::VrrpService (int interface, int family, std::uint_fast8_t virtualRouterId, std::uint_fast16_t vlanId) :
 	m_virtualRouterId(virtualRouterId),
 	m_priority(100),
@@ -44,8 +49,15 @@ VrrpService::VrrpService (int interface, int family, std::uint_fast8_t virtualRo
 	m_masterAdvertisementInterval(m_advertisementInterval),
 	m_preemptMode(true),
 	m_acceptMode(family == AF_INET6 || vlanId != 0 ? true : false),
+	m_arpBurstCount(1),
+	m_arpBurstSpacing(1000),
+	m_arpRefreshInterval(0),
+	m_arpBurstsLeft(0),
 	m_masterDownTimer(timerCallback, this),
 	m_advertisementTimer(timerCallback, this),
+	m_arpTimer(timerCallback, this),
+	m_nextAdvertisement(0),
+	m_lastAdvertisementTime(0),
 	m_state(Disabled),
 	m_family(family),
 	m_interface(interface),
@@ -53,9 +65,11 @@ VrrpService::VrrpService (int interface, int family, std::uint_fast8_t virtualRo
 	m_vlanInterface(-1),
 	m_outputInterface(interface),
 	m_inputInterface(interface),
+	m_addressHash(0),
 	m_socket(VrrpSocket::instance(m_family)),
 	m_vlanId(vlanId),
 	m_error(0),
+	m_arpTransmitter(false),
 
 	m_statsMasterTransitions(0),
 	m_statsNewMasterReason(NotMaster),
@@ -68,6 +82,15 @@ VrrpService::VrrpService (int interface, int family, std::uint_fast8_t virtualRo
 	m_statsRcvdInvalidTypePackets(0),
 	m_statsAddressListErrors(0),
 	m_statsPacketLengthErrors(0),
+	m_statsMissedAdvertisements(0),
+	m_statsAdvertisementJitterTotal(0),
+	m_statsAdvertisementJitterCount(0),
+	m_statsAdvertisementJitterMax(0),
+	m_lastArrival(0),
+	m_statsNearMisses(0),
+	m_statsReceiveDelayTotal(0),
+	m_statsReceiveDelayCount(0),
+	m_statsReceiveDelayMax(0),
 
 	m_pendingNewMasterReason(MasterNotResponding)
 {
@@ -103,7 +126,7 @@ VrrpService::VrrpService (int interface, int family, std::uint_fast8_t virtualRo
 		if_indextoname(interface, req.ifr_name);
 		if (ioctl(s, SIOCGIFHWADDR, &req) == -1)
 		{
-			syslog(LOG_WARNING, "Failed to get MAC address of VRRP interface: %s", std::strerror(errno));
+			LOG(LOG_WARNING, "Failed to get MAC address of VRRP interface: %s", std::strerror(errno));
 		}
 		else
 		{
@@ -121,7 +144,7 @@ VrrpService::VrrpService (int interface, int family, std::uint_fast8_t virtualRo
 		m_vlanInterface = Netlink::addVlanInterface(m_outputInterface, m_vlanId, name);
 		if (m_vlanInterface < 0)
 		{
-			syslog(LOG_WARNING, "Failed to create VLAN interface: %s", std::strerror(errno));
+			LOG(LOG_WARNING, "Failed to create VLAN interface: %s", std::strerror(errno));
 			m_error = 1;
 			return;
 		}
@@ -133,6 +156,10 @@ VrrpService::VrrpService (int interface, int family, std::uint_fast8_t virtualRo
 	m_socket->addInterface(m_inputInterface);
 	m_socket->addEventListener(m_inputInterface, m_virtualRouterId, this);
 
+	// Keep the ARP transmitter ready, so becoming master doesn't have to set it up
+	if (m_family == AF_INET)
+		m_arpTransmitter = ArpSocket::addInterface(m_outputInterface);
+
 	Netlink::addInterfaceMonitor(m_interface, interfaceCallback, this);
 }
 
@@ -146,8 +173,12 @@ VrrpService::~VrrpService ()
 	{
 		m_socket->removeInterface(m_inputInterface);
 		m_socket->removeEventListener(m_inputInterface, m_virtualRouterId);
+		m_socket->forgetAdvertisement(m_advertisement);
 	}
 
+	if (m_arpTransmitter)
+		ArpSocket::removeInterface(m_outputInterface);
+
 	if (m_vlanInterface != -1)
 		Netlink::removeInterface(m_vlanInterface);
 	if (m_macvlanInterface != -1)
@@ -202,6 +233,7 @@ bool VrrpService::setPrimaryIpAddress (const IpAddress &address)
 	{
 		m_primaryIpAddress = address;
 		m_autoPrimaryIpAddress = false;
+		invalidateAdvertisement();
 		return true;
 	}
 	else
@@ -214,6 +246,7 @@ void VrrpService::unsetPrimaryIpAddress ()
 	{
 		m_primaryIpAddress = Netlink::getPrimaryIpAddress(m_interface, m_family);
 		m_autoPrimaryIpAddress = false;
+		invalidateAdvertisement();
 	}
 }
 
@@ -248,6 +281,7 @@ bool VrrpService::setPriority (std::uint_fast8_t priority)
 	}
 
 	m_priority = priority;
+	invalidateAdvertisement();
 
 	return true;
 }
@@ -262,6 +296,7 @@ bool VrrpService::setAdvertisementInterval (unsigned int advertisementInterval)
 	if (advertisementInterval < 1 || advertisementInterval > 4095)
 		return false;
 	m_advertisementInterval = advertisementInterval;
+	invalidateAdvertisement();
 	return true;
 }
 
@@ -332,6 +367,48 @@ bool VrrpService::acceptMode () const
 	return m_acceptMode;
 }
 
+void VrrpService::setArpBurstCount (unsigned int count)
+{
+	m_arpBurstCount = count;
+
+	// Cut a takeover that is in progress short if it already sent enough
+	if (m_arpBurstsLeft >= count)
+	{
+		m_arpBurstsLeft = count - 1;
+		if (m_state == Master && m_family == AF_INET)
+			startArpTimer();
+	}
+}
+
+unsigned int VrrpService::arpBurstCount () const
+{
+	return m_arpBurstCount;
+}
+
+void VrrpService::setArpBurstSpacing (unsigned int msec)
+{
+	m_arpBurstSpacing = msec;
+	if (m_state == Master && m_family == AF_INET)
+		startArpTimer();
+}
+
+unsigned int VrrpService::arpBurstSpacing () const
+{
+	return m_arpBurstSpacing;
+}
+
+void VrrpService::setArpRefreshInterval (unsigned int msec)
+{
+	m_arpRefreshInterval = msec;
+	if (m_state == Master && m_family == AF_INET)
+		startArpTimer();
+}
+
+unsigned int VrrpService::arpRefreshInterval () const
+{
+	return m_arpRefreshInterval;
+}
+
 void VrrpService::timerCallback (Timer *timer, void *userData)
 {
 	VrrpService *self = reinterpret_cast<VrrpService *>(userData);
@@ -339,6 +416,8 @@ void VrrpService::timerCallback (Timer *timer, void *userData)
 		self->onMasterDownTimer();
 	else if (timer == &self->m_advertisementTimer)
 		self->onAdvertisementTimer();
+	else if (timer == &self->m_arpTimer)
+		self->onArpTimer();
 }
 
 void VrrpService::enable ()
@@ -445,6 +524,56 @@ std::uint_fast64_t VrrpService::statsPacketLengthErrors () const
 	return m_statsPacketLengthErrors;
 }
 
+std::uint_fast64_t VrrpService::statsDeferredAdvertisements () const
+{
+	return m_advertisement.deferred;
+}
+
+std::uint_fast64_t VrrpService::statsLateAdvertisements () const
+{
+	return m_advertisement.late;
+}
+
+std::uint_fast64_t VrrpService::statsDroppedAdvertisements () const
+{
+	return m_advertisement.dropped;
+}
+
+std::uint_fast64_t VrrpService::statsMissedAdvertisements () const
+{
+	return m_statsMissedAdvertisements;
+}
+
+std::uint_fast64_t VrrpService::statsAdvertisementJitterAverage () const
+{
+	return m_statsAdvertisementJitterCount == 0 ? 0 : m_statsAdvertisementJitterTotal / m_statsAdvertisementJitterCount;
+}
+
+std::uint_fast64_t VrrpService::statsAdvertisementJitterMax () const
+{
+	return m_statsAdvertisementJitterMax;
+}
+
+const Histogram &VrrpService::statsArrivalGaps () const
+{
+	return m_statsArrivalGaps;
+}
+
+std::uint_fast64_t VrrpService::statsNearMisses () const
+{
+	return m_statsNearMisses;
+}
+
+std::uint_fast64_t VrrpService::statsReceiveDelayAverage () const
+{
+	return m_statsReceiveDelayCount == 0 ? 0 : m_statsReceiveDelayTotal / m_statsReceiveDelayCount;
+}
+
+std::uint_fast64_t VrrpService::statsReceiveDelayMax () const
+{
+	return m_statsReceiveDelayMax;
+}
+
 void VrrpService::startup ()
 {
 	if (m_priority == 255)
@@ -458,7 +587,7 @@ void VrrpService::startup ()
 			// Neighbor advertisements are sent automatically
 		}
 
-		m_advertisementTimer.start(m_advertisementInterval * 10);
+		startAdvertisementTimer();
 		
 		// Update statistics
 		++m_statsMasterTransitions;
@@ -485,11 +614,21 @@ void VrrpService::shutdown (State newState)
 	}
 	else if (state() == Master)
 	{
-		// We are master, so inform everybody that we're leaving
+		// We are master, so inform everybody that we're leaving. Leaving tears down the output interface, so this can't wait for the end of the loop iteration
+		resign();
+		m_socket->flush();
+		setState(newState);
+	}
+}
+
+void VrrpService::resign ()
+{
+	// The advertisement timer runs for as long as we are master and haven't resigned
+	if (m_state == Master && m_advertisementTimer.armed())
+	{
 		m_advertisementTimer.stop();
 		sendAdvertisement(0);
-		setState(newState);
-		
+
 		++m_statsSentPriZeroPackets;
 	}
 }
@@ -507,7 +646,7 @@ void VrrpService::onMasterDownTimer ()
 			// Solicited multicast is automatically joined by Linux
 			// Neighbor advertisements is sent automatically by Linux
 		}
-		m_advertisementTimer.start(m_advertisementInterval * 10);
+		startAdvertisementTimer();
 
 		// Update statistics
 		++m_statsMasterTransitions;
@@ -522,21 +661,88 @@ void VrrpService::onAdvertisementTimer ()
 	{
 		// We are master and the advertisement timer fired, so send an advertisement
 		sendAdvertisement(m_priority);
-		m_advertisementTimer.start(m_advertisementInterval * 10);
+
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		std::uint64_t sent = static_cast<std::uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+		std::uint64_t interval = m_advertisementInterval * 10;
+		if (m_lastAdvertisementTime != 0)
+		{
+			std::uint64_t elapsed = sent - m_lastAdvertisementTime;
+			std::uint64_t jitter = (elapsed > interval * 1000 ? elapsed - interval * 1000 : interval * 1000 - elapsed);
+			m_statsAdvertisementJitterTotal += jitter;
+			++m_statsAdvertisementJitterCount;
+			if (jitter > m_statsAdvertisementJitterMax)
+				m_statsAdvertisementJitterMax = jitter;
+		}
+		m_lastAdvertisementTime = sent;
+
+		// Advance from the previous deadline rather than from now, so callback latency doesn't accumulate.
+		// If we fell more than an interval behind, skip the missed advertisements instead of sending a burst
+		m_nextAdvertisement += interval;
+		std::uint64_t now = Timer::now();
+		if (m_nextAdvertisement <= now)
+		{
+			std::uint64_t missed = (now - m_nextAdvertisement) / interval + 1;
+			m_nextAdvertisement += missed * interval;
+			m_statsMissedAdvertisements += missed;
+		}
+		m_nextAdvertisement = alignAdvertisement(m_nextAdvertisement);
+		m_advertisementTimer.startAt(m_nextAdvertisement);
 	}
 }
 
+std::uint64_t VrrpService::alignAdvertisement (std::uint64_t deadline) const
+{
+	// Deadlines are only ever moved forward, so advertisements are never sent early. An interval that isn't a multiple
+	// of the window would be stretched on every advertisement rather than just the first, so such routers aren't coalesced
+	if (m_coalesceWindow == 0 || (m_advertisementInterval * 10) % m_coalesceWindow != 0)
+		return deadline;
+
+	// Consecutive router ids take turns, and the IPv6 router of a pair sits half a window away
+	unsigned int phase = (m_interface + m_virtualRouterId + (m_family == AF_INET6 ? m_coalescePhases / 2 : 0)) % m_coalescePhases;
+	return Timer::alignDeadline(deadline, m_coalesceWindow, phase * m_coalesceWindow / m_coalescePhases);
+}
+
+void VrrpService::setCoalescing (unsigned int window, unsigned int phases)
+{
+	m_coalesceWindow = window;
+	m_coalescePhases = (phases == 0 ? 1 : phases);
+}
+
+void VrrpService::startAdvertisementTimer ()
+{
+	// Start a new schedule one interval from now. Jitter isn't measured across the restart
+	std::uint64_t now = Timer::now();
+	m_nextAdvertisement = alignAdvertisement(now + m_advertisementInterval * 10);
+	m_lastAdvertisementTime = 0;
+	m_advertisementTimer.startAt(m_nextAdvertisement);
+}
+
 void VrrpService::onIncomingVrrpPacket (
 		unsigned int,
 		const IpAddress &address,
 		std::uint_fast8_t,
 		std::uint_fast8_t priority,
 		std::uint_fast16_t maxAdvertisementInterval,
-		const IpAddressList &addresses)
+		const IpAddressListView &addresses,
+		std::uint64_t timestamp)
 {
 	++m_statsRcvdAdvertisements;
 	m_statsProtocolErrReason = NoError;
 
+	if (timestamp != 0)
+	{
+		timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		std::uint64_t now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		std::uint64_t delay = (now > timestamp ? (now - timestamp) / 1000 : 0);
+		m_statsReceiveDelayTotal += delay;
+		++m_statsReceiveDelayCount;
+		if (delay > m_statsReceiveDelayMax)
+			m_statsReceiveDelayMax = delay;
+	}
+
 	if (!maxAdvertisementInterval != m_advertisementInterval)
 		++m_statsAdvIntervalErrors;
 
@@ -546,34 +752,32 @@ void VrrpService::onIncomingVrrpPacket (
 		{
 			// The master decided to stop gracefully, wait skew time before transitioning to master
 			m_masterDownTimer.start(skewTime() * 10);
+			m_lastArrival = 0;
 
 			++m_statsRcvdPriZeroPackets;
 			m_pendingNewMasterReason = Priority;
 		}
 		else if (!m_preemptMode || priority >= this->priority())
 		{
-			// The right master is running, wait for the next announcement
+			// The right master is running, wait for the next announcement. Gaps are measured on kernel timestamps, so our own delays don't show up as network jitter
+			if (m_lastArrival != 0 && timestamp > m_lastArrival && address == m_masterIpAddress)
+			{
+				std::uint64_t gap = (timestamp - m_lastArrival) / 1000;
+				m_statsArrivalGaps.add(gap);
+				if (gap > m_masterAdvertisementInterval * 20000ULL) // Twice the interval, which is in centiseconds
+					++m_statsNearMisses;
+			}
+			m_lastArrival = timestamp;
+
 			m_masterAdvertisementInterval = maxAdvertisementInterval;
 			m_masterDownTimer.start(masterDownInterval() * 10);
 			m_masterIpAddress = address;
 
 			// Check address list
-			std::vector<IpAddress> incomingList(addresses.size());
-			std::copy(addresses.begin(), addresses.end(), incomingList.begin());
-			std::sort(incomingList.begin(), incomingList.end());
-			
-			std::vector<IpAddress> serviceList(m_addresses.size());
-			std::copy(m_addresses.begin(), m_addresses.end(), serviceList.begin());
-			std::sort(serviceList.begin(), serviceList.end());
-
-			std::vector<IpAddress> difference(std::max(incomingList.size(), serviceList.size()));
-			std::vector<IpAddress>::iterator differenceEnd = std::set_difference(incomingList.begin(), incomingList.end(), serviceList.begin(), serviceList.end(), difference.begin());
-
-			std::vector<IpAddress>::size_type differenceCount = differenceEnd - difference.begin();
-			if (differenceCount > 0)
+			if (!matchesAddressList(addresses))
 			{
 				// There are differences between incoming address list and our list
-				syslog(LOG_WARNING, "%s (Router %u, Interface %u): Address list mismatch", m_name, (unsigned int)m_virtualRouterId, (unsigned int)m_interface);
+				LOG(LOG_WARNING, "%s (Router %u, Interface %u): Address list mismatch", m_name, (unsigned int)m_virtualRouterId, (unsigned int)m_interface);
 				++m_statsAddressListErrors;
 			}
 
@@ -590,7 +794,7 @@ void VrrpService::onIncomingVrrpPacket (
 		{
 			// The conflicing master is stopping gracefully, so just remind everybody that we are the master
 			sendAdvertisement(m_priority);
-			m_advertisementTimer.start(advertisementInterval() * 10);
+			startAdvertisementTimer();
 
 			++m_statsRcvdPriZeroPackets;
 			m_pendingNewMasterReason = Priority;
@@ -615,13 +819,20 @@ void VrrpService::onIncomingVrrpPacket (
 
 bool VrrpService::sendAdvertisement (std::uint_least8_t priority)
 {
-	return m_socket->sendPacket(
-			m_outputInterface,
-			m_primaryIpAddress,
-			m_virtualRouterId,
-			priority,
-			m_advertisementInterval,
-			m_addresses);
+	// The advertisement is built with our own priority. Other priorities, like 0 when resigning, are patched in by the socket
+	if (m_advertisement.packet.empty())
+	{
+		m_socket->buildAdvertisement(
+				m_advertisement,
+				m_outputInterface,
+				m_primaryIpAddress,
+				m_virtualRouterId,
+				m_priority,
+				m_advertisementInterval,
+				m_addresses);
+	}
+
+	return m_socket->sendAdvertisement(m_advertisement, priority);
 }
 
 void VrrpService::setState (State state)
@@ -631,13 +842,14 @@ void VrrpService::setState (State state)
 		static const char *states[] = {"Disabled", "LinkDown", "Backup", "Master"};
 		State oldState = m_state;
 		m_state = state;
+		m_lastArrival = 0;
 		if (m_state == Master)
 		{
 			static const char *reasons[] = {"NotMaster", "Priority", "Preempted", "MasterNotResponding"};
-			syslog(LOG_INFO, "%s (Router %u, Interface %u): Changed state to %s (Reason: %s)", m_name, (unsigned int)m_virtualRouterId, (unsigned int)m_interface, states[m_state], reasons[m_pendingNewMasterReason - 1]);
+			LOG_UNLIMITED(LOG_INFO, "%s (Router %u, Interface %u): Changed state to %s (Reason: %s)", m_name, (unsigned int)m_virtualRouterId, (unsigned int)m_interface, states[m_state], reasons[m_pendingNewMasterReason - 1]);
 		}
 		else
-			syslog(LOG_INFO, "%s (Router %u, Interface %u): Changed state to %s", m_name, (unsigned int)m_virtualRouterId, (unsigned int)m_interface, states[m_state]);
+			LOG_UNLIMITED(LOG_INFO, "%s (Router %u, Interface %u): Changed state to %s", m_name, (unsigned int)m_virtualRouterId, (unsigned int)m_interface, states[m_state]);
 		if (m_state == Master)
 		{
 			setVirtualMac();
@@ -649,6 +861,7 @@ void VrrpService::setState (State state)
 			if (oldState == Master)
 				removeIpAddresses();
 			setDefaultMac();
+			m_arpTimer.stop();
 		}
 
 		if (state == Backup)
@@ -666,8 +879,31 @@ void VrrpService::setState (State state)
 
 void VrrpService::sendARPs ()
 {
-	for (IpAddressSet::const_iterator address = m_addresses.begin(); address != m_addresses.end(); ++address)
-		ArpSocket::sendGratuitiousArp(m_outputInterface, *address);
+	// The first burst goes out right away. The rest are sent from the ARP timer
+	ArpSocket::sendGratuitiousArps(m_outputInterface, m_addresses);
+	m_arpBurstsLeft = m_arpBurstCount - 1;
+	startArpTimer();
+}
+
+void VrrpService::startArpTimer ()
+{
+	if (m_arpBurstsLeft != 0)
+		m_arpTimer.start(m_arpBurstSpacing);
+	else if (m_arpRefreshInterval != 0)
+		m_arpTimer.start(m_arpRefreshInterval);
+	else
+		m_arpTimer.stop();
+}
+
+void VrrpService::onArpTimer ()
+{
+	if (m_state == Master)
+	{
+		ArpSocket::sendGratuitiousArps(m_outputInterface, m_addresses);
+		if (m_arpBurstsLeft != 0)
+			--m_arpBurstsLeft;
+		startArpTimer();
+	}
 }
 
 bool VrrpService::setVirtualMac ()
@@ -728,6 +964,7 @@ bool VrrpService::addIpAddress (const IpSubnet &subnet)
 		return false;
 	m_subnets.insert(subnet);
 	m_addresses.insert(subnet.address());
+	updateAddressBlock();
 
 	if (m_state == Master)
 	{
@@ -745,6 +982,7 @@ bool VrrpService::removeIpAddress (const IpSubnet &subnet)
 	bool ret = false;
 	ret |= m_subnets.erase(subnet);
 	ret |= m_addresses.erase(subnet.address());
+	updateAddressBlock();
 
 	if (m_state == Master)
 	{
@@ -757,6 +995,44 @@ bool VrrpService::removeIpAddress (const IpSubnet &subnet)
 	return ret;
 }
 
+void VrrpService::updateAddressBlock ()
+{
+	unsigned int addressSize = IpAddress::familySize(m_family);
+	m_addressBlock.resize(m_addresses.size() * addressSize);
+	std::uint8_t *ptr = m_addressBlock.data();
+	for (IpAddressSet::const_iterator address = m_addresses.begin(); address != m_addresses.end(); ++address, ptr += addressSize)
+		std::memcpy(ptr, address->data(), addressSize);
+
+	m_addressHash = IpAddressListView(m_addressBlock.data(), m_addressBlock.size(), m_family).hash();
+
+	invalidateAdvertisement();
+}
+
+void VrrpService::invalidateAdvertisement ()
+{
+	// Clearing keeps the capacity, so rebuilding doesn't allocate unless the packet grows
+	m_advertisement.packet.clear();
+}
+
+bool VrrpService::matchesAddressList (const IpAddressListView &addresses) const
+{
+	// Lists of different size or with a different set of addresses can be told apart without looking at the addresses
+	if (addresses.byteSize() != m_addressBlock.size() || addresses.hash() != m_addressHash)
+		return false;
+
+	// Routers that list the addresses in the same order as we do, like ourselves, send the same block
+	if (m_addressBlock.empty() || std::memcmp(addresses.data(), m_addressBlock.data(), m_addressBlock.size()) == 0)
+		return true;
+
+	// Any other order must still contain only our addresses. With the same count and hash, that means all of them
+	for (IpAddressListView::const_iterator it = addresses.begin(); it != addresses.end(); ++it)
+	{
+		if (m_addresses.find(*it) == m_addresses.end())
+			return false;
+	}
+	return true;
+}
+
 const IpSubnetSet &VrrpService::subnets () const
 {
 	return m_subnets;
@@ -778,7 +1054,7 @@ void VrrpService::setProtocolErrorReason (ProtocolErrorReason reason)
 	// TODO Send SNMP notificaiton
 }
 
-void VrrpService::onIncomingVrrpError (unsigned int, std::uint_fast8_t, VrrpEventListener::Error error)
+void VrrpService::onIncomingVrrpError (unsigned int, std::uint_fast8_t, VrrpEventListener::Error error, std::uint_fast64_t count)
 {
 	switch (error)
 	{
@@ -795,19 +1071,20 @@ void VrrpService::onIncomingVrrpError (unsigned int, std::uint_fast8_t, VrrpEven
 			break;
 			
 		case VrrpEventListener::AdvIntervalError:
-			++m_statsAdvIntervalErrors;
+			m_statsAdvIntervalErrors += count;
 			break;
 
 		case VrrpEventListener::IpTtlError:
+			m_statsIpTtlErrors += count;
 			setProtocolErrorReason(IpTtlError);
 			break;
 
 		case VrrpEventListener::InvalidTypeError:
-			++m_statsRcvdInvalidTypePackets;
+			m_statsRcvdInvalidTypePackets += count;
 			break;
 
 		case VrrpEventListener::PacketLengthError:
-			++m_statsPacketLengthErrors;
+			m_statsPacketLengthErrors += count;
 			break;
 	}
 }
@@ -838,6 +1115,13 @@ void VrrpService::executeScript (const std::string &command)
 	{
 		// Child process
 
+		// The main loop blocks the signals it handles, and the mask is inherited through exec
+		sigset_t signals;
+		sigemptyset(&signals);
+		sigprocmask(SIG_SETMASK, &signals, 0);
+
+		Realtime::resetChild();
+
 		// Setup environment variables
 		// VRRP_IF = Physical network interface
 		// VRRP_VIF = MACVLAN interface
@@ -891,11 +1175,11 @@ void VrrpService::executeScript (const std::string &command)
 
 		// Execute
 		execl("/bin/sh", "sh", "-c", command.c_str(), 0);
-		syslog(LOG_ERR, "Error executing command `%s': %s", command.c_str(), std::strerror(errno));
+		LOG(LOG_ERR, "Error executing command `%s': %s", command.c_str(), std::strerror(errno));
 		_exit(EXIT_FAILURE);
 	}
 	else
 	{
-		syslog(LOG_INFO, "Executed command: %s", command.c_str());
+		LOG(LOG_INFO, "Executed command: %s", command.c_str());
 	}
 }
@@ -19,14 +19,16 @@
 #ifndef INCLUDE_OPENVRRP_VRRPSERVICE_H
 #define INCLUDE_OPENVRRP_VRRPSERVICE_H
 
+#include "histogram.h"
 #include "ipaddress.h"
 #include "ipsubnet.h"
 #include "timer.h"
 #include "vrrpeventlistener.h"
+#include "vrrpsocket.h"
 
 #include <cstdint>
+#include <vector>
 
-class VrrpSocket;
 
 /**
   * VRRP instance
@@ -72,6 +74,22 @@ class VrrpService : private VrrpEventListener
 		VrrpService (int interface, int family, std::uint_fast8_t virtualRouterId, std::uint_fast16_t vlanId);
 		virtual ~VrrpService ();
 
+		/**
+		  * Coalesce the advertisement timers of all routers
+		  *
+		  * Advertisement deadlines are moved forward onto shared ticks, so
+		  * routers with equal intervals send their advertisements in the
+		  * same wakeup. Routers are spread over a number of phases within
+		  * the window, which trades wakeups for smaller bursts. Only routers
+		  * with an advertisement interval that is a multiple of the window
+		  * are coalesced, so once on the grid, advertisements are exactly
+		  * one interval apart. The first one after a restart of the
+		  * schedule may be up to a window late, but never early.
+		  * @param window Distance between ticks in milliseconds, or 0 to disable coalescing
+		  * @param phases Number of tick groups per window
+		  */
+		static void setCoalescing (unsigned int window, unsigned int phases);
+
 		/**
 		  * Get the internal error code
 		  *
@@ -261,6 +279,32 @@ class VrrpService : private VrrpEventListener
 		  */
 		bool acceptMode () const;
 
+		/**
+		  * Set number of gratuitous ARP bursts sent when becoming master
+		  *
+		  * Repeating the announcement covers a lost frame or a switch that is
+		  * slow to relearn the virtual MAC address. Only IPv4 routers send ARPs
+		  * @param count Bursts per takeover, including the first one. Must be at least 1
+		  */
+		void setArpBurstCount (unsigned int count);
+		unsigned int arpBurstCount () const;
+
+		/**
+		  * Set time between the gratuitous ARP bursts of a takeover
+		  * @param msec Spacing in milliseconds
+		  */
+		void setArpBurstSpacing (unsigned int msec);
+		unsigned int arpBurstSpacing () const;
+
+		/**
+		  * Set how often gratuitous ARPs are repeated for as long as we are master
+		  *
+		  * The refresh starts when the bursts of the takeover are done
+		  * @param msec Refresh interval in milliseconds, or 0 to disable refreshing
+		  */
+		void setArpRefreshInterval (unsigned int msec);
+		unsigned int arpRefreshInterval () const;
+
 		/**
 		  * Add IP address to router
 		  *
@@ -312,6 +356,19 @@ class VrrpService : private VrrpEventListener
 		  */
 		void disable ();
 
+		/**
+		  * Announce that the router is leaving
+		  *
+		  * If master, a priority 0 advertisement is sent and no more advertisements
+		  * will follow, but the router stays master until it is disabled or
+		  * destroyed, which won't send another one. This allows all routers to
+		  * announce their departure before any of them starts releasing addresses.
+		  *
+		  * The advertisement is only queued. It's up to the caller to flush the
+		  * socket before the output interface is torn down.
+		  */
+		void resign ();
+
 		/**
 		  * Check if service is enabled
 		  * @return true if VRRP instance is enabled
@@ -429,6 +486,78 @@ class VrrpService : private VrrpEventListener
 		  */
 		std::uint_fast64_t statsPacketLengthErrors () const;
 
+		/**
+		  * Get the number of advertisements skipped because the daemon fell behind
+		  *
+		  * Advertisements are sent on a fixed schedule. If a deadline is
+		  * missed by more than one interval, the missed advertisements are
+		  * skipped rather than sent in a burst.
+		  * @return Number of skipped advertisements
+		  */
+		std::uint_fast64_t statsMissedAdvertisements () const;
+
+		/**
+		  * Get the number of advertisements that found the send buffer full
+		  *
+		  * They wait in the retransmit queue of the socket until there is room,
+		  * and are dropped once the next advertisement is due.
+		  * @return Number of deferred advertisements
+		  */
+		std::uint_fast64_t statsDeferredAdvertisements () const;
+
+		/**
+		  * Get the number of deferred advertisements that were sent in time
+		  * @return Number of late advertisements
+		  */
+		std::uint_fast64_t statsLateAdvertisements () const;
+
+		/**
+		  * Get the number of advertisements that were never sent
+		  * @return Number of dropped advertisements
+		  */
+		std::uint_fast64_t statsDroppedAdvertisements () const;
+
+		/**
+		  * Get the mean deviation of the time between two advertisements from the advertisement interval
+		  * @return Mean jitter in microseconds
+		  */
+		std::uint_fast64_t statsAdvertisementJitterAverage () const;
+
+		/**
+		  * Get the largest deviation of the time between two advertisements from the advertisement interval
+		  * @return Maximum jitter in microseconds
+		  */
+		std::uint_fast64_t statsAdvertisementJitterMax () const;
+
+		/**
+		  * Get the time between advertisements from the master, as stamped by the kernel on arrival
+		  *
+		  * Only consecutive advertisements received as backup from the same
+		  * master are measured.
+		  * @return Histogram of gaps in microseconds
+		  */
+		const Histogram &statsArrivalGaps () const;
+
+		/**
+		  * Get the number of advertisements that arrived more than twice the master's advertisement interval after the previous one
+		  *
+		  * Each of them is a master that got close to being declared dead.
+		  * @return Number of near misses
+		  */
+		std::uint_fast64_t statsNearMisses () const;
+
+		/**
+		  * Get the mean time from the kernel receiving an advertisement to the service processing it
+		  * @return Mean delay in microseconds
+		  */
+		std::uint_fast64_t statsReceiveDelayAverage () const;
+
+		/**
+		  * Get the longest time from the kernel receiving an advertisement to the service processing it
+		  * @return Maximum delay in microseconds
+		  */
+		std::uint_fast64_t statsReceiveDelayMax () const;
+
 	private:
 		virtual void onIncomingVrrpPacket (
 				unsigned int interface,
@@ -436,23 +565,31 @@ class VrrpService : private VrrpEventListener
 				std::uint_fast8_t virtualRouterId,
 				std::uint_fast8_t priority,
 				std::uint_fast16_t maxAdvertisementInterval,
-				const IpAddressList &addresses);
+				const IpAddressListView &addresses,
+				std::uint64_t timestamp);
 
-		virtual void onIncomingVrrpError (unsigned int interface, std::uint_fast8_t virtualRouterId, VrrpEventListener::Error error);
+		virtual void onIncomingVrrpError (unsigned int interface, std::uint_fast8_t virtualRouterId, VrrpEventListener::Error error, std::uint_fast64_t count);
 
 		void startup ();
 		void shutdown (State state);
 
 		void onMasterDownTimer ();
 		void onAdvertisementTimer ();
+		void startAdvertisementTimer ();
+		std::uint64_t alignAdvertisement (std::uint64_t deadline) const;
 
 		bool sendAdvertisement (std::uint_least8_t priority);
 		void sendARPs();
+		void startArpTimer ();
+		void onArpTimer ();
 		bool setVirtualMac();
 		bool setDefaultMac();
 		void setState (State state);
 		bool addIpAddresses ();
 		bool removeIpAddresses ();
+		void updateAddressBlock ();
+		void invalidateAdvertisement ();
+		bool matchesAddressList (const IpAddressListView &addresses) const;
 
 		void setProtocolErrorReason (ProtocolErrorReason reason);
 
@@ -471,9 +608,16 @@ class VrrpService : private VrrpEventListener
 		unsigned int m_masterAdvertisementInterval;
 		bool m_preemptMode;
 		bool m_acceptMode;
+		unsigned int m_arpBurstCount;
+		unsigned int m_arpBurstSpacing;
+		unsigned int m_arpRefreshInterval;
+		unsigned int m_arpBurstsLeft;
 
 		Timer m_masterDownTimer;
 		Timer m_advertisementTimer;
+		Timer m_arpTimer;
+		std::uint64_t m_nextAdvertisement;
+		std::uint64_t m_lastAdvertisementTime;
 
 		State m_state;
 
@@ -488,8 +632,11 @@ class VrrpService : private VrrpEventListener
 
 		IpSubnetSet m_subnets;
 		IpAddressSet m_addresses;
+		std::vector<std::uint8_t> m_addressBlock; // m_addresses in wire format, in order
+		std::uint64_t m_addressHash; // IpAddressListView::hash() of m_addressBlock
 
 		VrrpSocket *m_socket;
+		VrrpSocket::Advertisement m_advertisement; // Rebuilt on the next send after invalidateAdvertisement()
 
 		std::string m_backupCommand;
 		std::string m_masterCommand;
@@ -498,6 +645,7 @@ class VrrpService : private VrrpEventListener
 
 		const char *m_name;
 		int m_error;
+		bool m_arpTransmitter; // Holds a reference from ArpSocket::addInterface()
 
 		std::uint_fast32_t m_statsMasterTransitions;
 		NewMasterReason m_statsNewMasterReason;
@@ -510,9 +658,22 @@ class VrrpService : private VrrpEventListener
 		std::uint_fast64_t m_statsRcvdInvalidTypePackets;
 		std::uint_fast64_t m_statsAddressListErrors;
 		std::uint_fast64_t m_statsPacketLengthErrors;
+		std::uint_fast64_t m_statsMissedAdvertisements;
+		std::uint_fast64_t m_statsAdvertisementJitterTotal;
+		std::uint_fast64_t m_statsAdvertisementJitterCount;
+		std::uint_fast64_t m_statsAdvertisementJitterMax;
+		std::uint64_t m_lastArrival; // Kernel timestamp of the last advertisement from the master in nanoseconds, 0 if none
+		Histogram m_statsArrivalGaps;
+		std::uint_fast64_t m_statsNearMisses;
+		std::uint_fast64_t m_statsReceiveDelayTotal;
+		std::uint_fast64_t m_statsReceiveDelayCount;
+		std::uint_fast64_t m_statsReceiveDelayMax;
 
 		NewMasterReason m_pendingNewMasterReason;
 		bool m_enabled;
+
+		static unsigned int m_coalesceWindow;
+		static unsigned int m_coalescePhases;
 };
 
 #endif // INCLUDE_OPENVRRP_VRRPSERVICE_H
@@ -19,33 +19,88 @@
 #include "mainloop.h"
 #include "util.h"
 #include "vrrpeventlistener.h"
+#include "vrrpcapture.h"
+#include "vrrpfilter.h"
+#include "vrrpring.h"
 #include "vrrpsocket.h"
 #include "vrrpmanager.h"
+#include "log.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <cstdlib>
 
+#include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
-#include <syslog.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/ip6.h>
 #include <sys/socket.h>
+#include <linux/filter.h>
 
 VrrpSocket *VrrpSocket::m_ipv4Instance = 0;
 VrrpSocket *VrrpSocket::m_ipv6Instance = 0;
+unsigned int VrrpSocket::m_receiveBatchSize = 32;
+unsigned int VrrpSocket::m_sendBufferSize = 0;
+bool VrrpSocket::m_kernelFilter = false;
+VrrpCapture *VrrpSocket::m_capture = 0;
+VrrpSocket::Ingest VrrpSocket::m_ingest = VrrpSocket::SocketIngest;
 
 std::uint_fast64_t VrrpSocket::m_routerVersionErrors = 0;
 std::uint_fast64_t VrrpSocket::m_routerChecksumErrors = 0;
 std::uint_fast64_t VrrpSocket::m_routerVrIdErrors = 0;
+std::uint_fast64_t VrrpSocket::m_stageDrops[VrrpSocket::StageCount] = {};
+std::uint_fast64_t VrrpSocket::m_advertisementsQueued = 0;
+std::uint_fast64_t VrrpSocket::m_advertisementsSent = 0;
+std::uint_fast64_t VrrpSocket::m_advertisementsDropped = 0;
+std::uint_fast64_t VrrpSocket::m_advertisementsDeferred = 0;
+std::uint_fast64_t VrrpSocket::m_advertisementsLate = 0;
+std::uint_fast64_t VrrpSocket::m_sendCalls = 0;
 
 VrrpSocket::VrrpSocket (int family) :
 	m_family(family),
 	m_error(0),
-	m_socket(-1)
+	m_socket(-1),
+	m_receiveBuffers(m_receiveBatchSize * ReceiveBufferSize),
+	m_receiveControlBuffers(m_receiveBatchSize * ReceiveControlSize),
+	m_receiveIov(m_receiveBatchSize),
+	m_receiveHeaders(m_receiveBatchSize),
+	m_receiveAddresses(m_receiveBatchSize),
+	m_sendBuffers(SendQueueSize * SendBufferSize),
+	m_sendControlBuffers(SendQueueSize * SendControlSize),
+	m_sendIov(SendQueueSize),
+	m_sendHeaders(SendQueueSize),
+	m_sendOwners(SendQueueSize),
+	m_sendCount(0),
+	m_retransmitBuffers(RetransmitQueueSize * SendBufferSize),
+	m_retransmitControlBuffers(RetransmitQueueSize * SendControlSize),
+	m_retransmitIov(RetransmitQueueSize),
+	m_retransmitHeaders(RetransmitQueueSize),
+	m_retransmitOwners(RetransmitQueueSize),
+	m_retransmitDeadlines(RetransmitQueueSize),
+	m_retransmitHead(0),
+	m_retransmitCount(0),
+	m_writeFd(-1),
+	m_writeMonitored(false),
+	m_retransmitTimer(retransmitTimerCallback, this),
+	m_ring(0),
+	m_filter(0),
+	m_filterTimer(filterTimerCallback, this)
 {
+	for (unsigned int i = 0; i != m_receiveBatchSize; ++i)
+	{
+		m_receiveIov[i].iov_base = &m_receiveBuffers[i * ReceiveBufferSize];
+		m_receiveIov[i].iov_len = ReceiveBufferSize;
+
+		msghdr &hdr = m_receiveHeaders[i].msg_hdr;
+		std::memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_iov = &m_receiveIov[i];
+		hdr.msg_iovlen = 1;
+	}
+
 	if (m_family == AF_INET)
 	{
 		m_multicastAddress = IpAddress("224.0.0.18");
@@ -57,15 +112,58 @@ VrrpSocket::VrrpSocket (int family) :
 		m_name = "VRRP IPv6";
 	}
 
-	if (createSocket())
-		MainLoop::addMonitor(m_socket, socketCallback, this);
-	else
+	for (unsigned int i = 0; i != SendQueueSize; ++i)
+	{
+		m_sendIov[i].iov_base = &m_sendBuffers[i * SendBufferSize];
+
+		msghdr &hdr = m_sendHeaders[i].msg_hdr;
+		std::memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name = m_multicastAddress.socketAddress();
+		hdr.msg_namelen = m_multicastAddress.socketAddressSize();
+		hdr.msg_iov = &m_sendIov[i];
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = &m_sendControlBuffers[i * SendControlSize];
+	}
+
+	for (unsigned int i = 0; i != RetransmitQueueSize; ++i)
+	{
+		m_retransmitIov[i].iov_base = &m_retransmitBuffers[i * SendBufferSize];
+
+		msghdr &hdr = m_retransmitHeaders[i].msg_hdr;
+		std::memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name = m_multicastAddress.socketAddress();
+		hdr.msg_namelen = m_multicastAddress.socketAddressSize();
+		hdr.msg_iov = &m_retransmitIov[i];
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = &m_retransmitControlBuffers[i * SendControlSize];
+	}
+
+	MainLoop::addFlushCallback(flushCallback, this);
+
+	if (m_ingest == ReplayIngest)
+		return;
+
+	if (!createSocket())
 		closeSocket();
+	else if (m_ring != 0)
+		MainLoop::addMonitor(m_ring->fd(), ringCallback, this, MainLoop::VrrpPriority);
+	else
+		MainLoop::addMonitor(m_socket, socketCallback, this, MainLoop::VrrpPriority);
 }
 
 VrrpSocket::~VrrpSocket ()
 {
+	// Priority 0 advertisements of services that were just shut down may still be queued
+	flush();
+	MainLoop::removeFlushCallback(flushCallback, this);
+
+	if (m_retransmitCount != 0)
+		LOG(LOG_WARNING, "%s: Dropped %u deferred advertisements", m_name, m_retransmitCount);
+	for (; m_retransmitCount != 0; --m_retransmitCount, m_retransmitHead = (m_retransmitHead + 1) % RetransmitQueueSize)
+		countDrop(m_retransmitOwners[m_retransmitHead]);
+
 	closeSocket();
+	delete m_filter;
 }
 
 bool VrrpSocket::createSocket ()
@@ -74,7 +172,7 @@ bool VrrpSocket::createSocket ()
 	if (m_socket == -1)
 	{
 		m_error = errno;
-		syslog(LOG_ERR, "%s: Error creating socket: %s", m_name, std::strerror(m_error));
+		LOG(LOG_ERR, "%s: Error creating socket: %s", m_name, std::strerror(m_error));
 		return false;
 	}
 
@@ -86,7 +184,7 @@ bool VrrpSocket::createSocket ()
 		if (setsockopt(m_socket, SOL_IP, IP_MULTICAST_LOOP, &val, sizeof(val)) == -1)
 		{
 			m_error = errno;
-			syslog(LOG_ERR, "%s: Error disabling multicast loopback: %s", m_name, std::strerror(m_error));
+			LOG(LOG_ERR, "%s: Error disabling multicast loopback: %s", m_name, std::strerror(m_error));
 			return false;
 		}
 
@@ -94,7 +192,7 @@ bool VrrpSocket::createSocket ()
 		if (setsockopt(m_socket, SOL_IP, IP_MULTICAST_TTL, &val, sizeof(val)) == -1)
 		{
 			m_error = errno;
-			syslog(LOG_ERR, "%s: Error setting multicast TTL: %s", m_name, std::strerror(m_error));
+			LOG(LOG_ERR, "%s: Error setting multicast TTL: %s", m_name, std::strerror(m_error));
 			return false;
 		}
 
@@ -102,7 +200,7 @@ bool VrrpSocket::createSocket ()
 		if (setsockopt(m_socket, SOL_IP, IP_PKTINFO, &val, sizeof(val)) == -1)
 		{
 			m_error = errno;
-			syslog(LOG_ERR, "%s: Error enabling reception of packet info: %s", m_name, std::strerror(m_error));
+			LOG(LOG_ERR, "%s: Error enabling reception of packet info: %s", m_name, std::strerror(m_error));
 			return false;
 		}
 	}
@@ -114,7 +212,7 @@ bool VrrpSocket::createSocket ()
 		if (setsockopt(m_socket, SOL_IPV6, IPV6_RECVPKTINFO, &val, sizeof(val)) == -1)
 		{
 			m_error = errno;
-			syslog(LOG_ERR, "%s: Error enabling reception of packet info: %s", m_name, std::strerror(m_error));
+			LOG(LOG_ERR, "%s: Error enabling reception of packet info: %s", m_name, std::strerror(m_error));
 			return false;
 		}
 
@@ -122,7 +220,7 @@ bool VrrpSocket::createSocket ()
 		if (setsockopt(m_socket, SOL_IPV6, IPV6_MULTICAST_LOOP, &val, sizeof(val)) == -1)
 		{
 			m_error = errno;
-			syslog(LOG_ERR, "%s: Error disabling multicast loopback: %s", m_name, std::strerror(m_error));
+			LOG(LOG_ERR, "%s: Error disabling multicast loopback: %s", m_name, std::strerror(m_error));
 			return false;
 		}
 
@@ -130,21 +228,84 @@ bool VrrpSocket::createSocket ()
 		if (setsockopt(m_socket, SOL_IPV6, IPV6_MULTICAST_HOPS, &val, sizeof(val)) == -1)
 		{
 			m_error = errno;
-			syslog(LOG_ERR, "%s: Error setting multicast hop limit: %s", m_name, std::strerror(m_error));
+			LOG(LOG_ERR, "%s: Error setting multicast hop limit: %s", m_name, std::strerror(m_error));
 			return false;
 		}
 	}
 
+	// Kernel receive times let the services tell network jitter from our own scheduling delay
+	int val = 1;
+	if (setsockopt(m_socket, SOL_SOCKET, SO_TIMESTAMPNS, &val, sizeof(val)) == -1)
+		LOG(LOG_WARNING, "%s: Error enabling receive timestamps: %s", m_name, std::strerror(errno));
+
+	if (m_sendBufferSize != 0)
+	{
+		// SO_SNDBUFFORCE may exceed net.core.wmem_max, but needs CAP_NET_ADMIN
+		val = m_sendBufferSize;
+		if (setsockopt(m_socket, SOL_SOCKET, SO_SNDBUFFORCE, &val, sizeof(val)) == -1 && setsockopt(m_socket, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val)) == -1)
+			LOG(LOG_WARNING, "%s: Error setting send buffer size: %s", m_name, std::strerror(errno));
+	}
+
+	// Reading and writing readiness are watched separately, and the main loop has one monitor per file descriptor
+	m_writeFd = fcntl(m_socket, F_DUPFD_CLOEXEC, 0);
+	if (m_writeFd == -1)
+		LOG(LOG_WARNING, "%s: Error duplicating socket. Deferred advertisements are retried on a timer: %s", m_name, std::strerror(errno));
+
+	if (m_ingest == RingIngest)
+	{
+		m_ring = new VrrpRing(m_family);
+		if (m_ring->open())
+		{
+			// The raw socket is still used for sending and for joining multicast groups, but nobody reads it
+			sock_filter code[] = {BPF_STMT(BPF_RET | BPF_K, 0)};
+			sock_fprog program;
+			program.len = 1;
+			program.filter = code;
+			if (setsockopt(m_socket, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == -1)
+				LOG(LOG_WARNING, "%s: Error attaching socket filter: %s", m_name, std::strerror(errno));
+		}
+		else
+		{
+			LOG(LOG_WARNING, "%s: Receiving packets with the raw socket", m_name);
+			delete m_ring;
+			m_ring = 0;
+		}
+	}
+
+	if (m_kernelFilter)
+	{
+		m_filter = new VrrpFilter(m_family, m_ring != 0);
+		if (m_filter->attach(m_ring != 0 ? m_ring->fd() : m_socket))
+			m_filterTimer.start(1000);
+		else
+		{
+			LOG(LOG_WARNING, "%s: Filtering packets in user space", m_name);
+			delete m_filter;
+			m_filter = 0;
+		}
+	}
+
 	return true;
 }
 
 void VrrpSocket::closeSocket ()
 {
+	m_retransmitTimer.stop();
+	if (m_writeFd != -1)
+	{
+		if (m_writeMonitored)
+			MainLoop::removeMonitor(m_writeFd);
+		m_writeMonitored = false;
+		while (close(m_writeFd) == -1 && errno == EINTR);
+		m_writeFd = -1;
+	}
 	if (m_socket != -1)
 	{
 		while (close(m_socket) == -1 && errno == EINTR);
 		m_socket = -1;
 	}
+	delete m_ring;
+	m_ring = 0;
 }
 
 bool VrrpSocket::addInterface (int interface)
@@ -161,7 +322,7 @@ bool VrrpSocket::addInterface (int interface)
 		if (setsockopt(m_socket, SOL_IP, IP_ADD_MEMBERSHIP, &req, sizeof(req)) == -1)
 		{
 			m_error = errno;
-			syslog(LOG_ERR, "%s: Error joining multicast address: %s", m_name, std::strerror(m_error));
+			LOG(LOG_ERR, "%s: Error joining multicast address: %s", m_name, std::strerror(m_error));
 			return false;
 		}
 		else
@@ -175,7 +336,7 @@ bool VrrpSocket::addInterface (int interface)
 		if (setsockopt(m_socket, SOL_IPV6, IPV6_ADD_MEMBERSHIP, &req, sizeof(req)) == -1)
 		{
 			m_error = errno;
-			syslog(LOG_ERR, "%s: Error joining multicast address: %s", m_name, std::strerror(m_error));
+			LOG(LOG_ERR, "%s: Error joining multicast address: %s", m_name, std::strerror(m_error));
 			return false;
 		}
 		else
@@ -201,7 +362,7 @@ bool VrrpSocket::removeInterface (int interface)
 			if (setsockopt(m_socket, SOL_IP, IP_DROP_MEMBERSHIP, &req, sizeof(req)) == -1)
 			{
 				m_error = errno;
-				syslog(LOG_ERR, "%s: Error joining multicast address: %s", m_name, std::strerror(m_error));
+				LOG(LOG_ERR, "%s: Error joining multicast address: %s", m_name, std::strerror(m_error));
 				return false;
 			}
 		}
@@ -213,7 +374,7 @@ bool VrrpSocket::removeInterface (int interface)
 			if (setsockopt(m_socket, SOL_IPV6, IPV6_DROP_MEMBERSHIP, &req, sizeof(req)) == -1)
 			{
 				m_error = errno;
-				syslog(LOG_ERR, "%s: Error joining multicast address: %s", m_name, std::strerror(m_error));
+				LOG(LOG_ERR, "%s: Error joining multicast address: %s", m_name, std::strerror(m_error));
 				return false;
 			}
 		}
@@ -229,19 +390,20 @@ bool VrrpSocket::removeInterface (int interface)
 
 void VrrpSocket::addEventListener (unsigned int interface, std::uint_fast8_t virtualRouterId, VrrpEventListener *eventListener)
 {
-	m_listeners[interface][virtualRouterId] = eventListener;
+	m_listeners.add(interface, virtualRouterId, eventListener);
+	if (m_filter != 0)
+		m_filter->addListener(interface, virtualRouterId);
 }
 
 void VrrpSocket::removeEventListener (unsigned int interface, std::uint_fast8_t virtualRouterId)
 {
-	EventListenerMap::iterator interfaceListenerMap = m_listeners.find(interface);
-	if (interfaceListenerMap != m_listeners.end())
+	if (m_listeners.find(interface, virtualRouterId) != 0)
 	{
-		EventListenerMap::mapped_type::iterator listener = interfaceListenerMap->second.find(virtualRouterId);
-		if (listener != interfaceListenerMap->second.end())
-			interfaceListenerMap->second.erase(listener);
-		if (interfaceListenerMap->second.size() == 0)
-			m_listeners.erase(interfaceListenerMap);
+		// Count what the filter dropped for the listener while it's still around
+		collectFilterDrops();
+		bool lastOnInterface = m_listeners.remove(interface, virtualRouterId);
+		if (m_filter != 0)
+			m_filter->removeListener(interface, virtualRouterId, lastOnInterface);
 	}
 }
 
@@ -279,6 +441,105 @@ void VrrpSocket::cleanup ()
 		delete m_ipv6Instance;
 		m_ipv6Instance = 0;
 	}
+	setCaptureFile(0);
+}
+
+void VrrpSocket::flushAll ()
+{
+	if (m_ipv4Instance != 0)
+		m_ipv4Instance->flush();
+	if (m_ipv6Instance != 0)
+		m_ipv6Instance->flush();
+}
+
+const char *VrrpSocket::stageName (Stage stage)
+{
+	static const char *names[] = {"Interface", "Header", "Version", "Type", "VRID", "TTL", "Length", "Checksum"};
+	return names[stage];
+}
+
+void VrrpSocket::setReceiveBatchSize (unsigned int size)
+{
+	m_receiveBatchSize = (size == 0 ? 1 : size);
+}
+
+void VrrpSocket::setSendBufferSize (unsigned int size)
+{
+	m_sendBufferSize = size;
+}
+
+void VrrpSocket::setIngest (Ingest ingest)
+{
+	m_ingest = ingest;
+}
+
+void VrrpSocket::setKernelFilter (bool enabled)
+{
+	m_kernelFilter = enabled;
+}
+
+bool VrrpSocket::setCaptureFile (const char *fileName)
+{
+	delete m_capture;
+	m_capture = 0;
+
+	if (fileName == 0)
+		return true;
+
+	m_capture = new VrrpCapture();
+	if (!m_capture->open(fileName))
+	{
+		delete m_capture;
+		m_capture = 0;
+		return false;
+	}
+	return true;
+}
+
+void VrrpSocket::updateStatistics ()
+{
+	if (m_ipv4Instance != 0)
+		m_ipv4Instance->collectFilterDrops();
+	if (m_ipv6Instance != 0)
+		m_ipv6Instance->collectFilterDrops();
+}
+
+void VrrpSocket::filterTimerCallback (Timer *timer, void *userData)
+{
+	VrrpSocket *socket = reinterpret_cast<VrrpSocket *>(userData);
+	socket->collectFilterDrops();
+	timer->start(1000);
+}
+
+void VrrpSocket::collectFilterDrops ()
+{
+	if (m_filter == 0 || !m_filter->pendingDrops())
+		return;
+
+	std::vector<VrrpFilter::Drop> drops;
+	m_filter->collectDrops(drops);
+	for (std::vector<VrrpFilter::Drop>::const_iterator drop = drops.begin(); drop != drops.end(); ++drop)
+	{
+		// Account for the packets like processPacket() would have
+		if (drop->reason == VrrpFilter::VrIdDrop)
+		{
+			const VrrpListenerTable::Interface *listeners = m_listeners.find(drop->interface);
+			if (listeners != 0)
+				notifyAll(*listeners, VrrpEventListener::VrIdError, drop->count);
+
+			m_routerVrIdErrors += drop->count;
+			m_stageDrops[VrIdStage] += drop->count;
+		}
+		else if (drop->reason == VrrpFilter::TtlDrop)
+		{
+			LOG(LOG_NOTICE, "%s: Discarded %llu VRRP packets with wrong TTL in the kernel", m_name, (unsigned long long int)drop->count);
+			m_stageDrops[TtlStage] += drop->count;
+
+			VrrpEventListener *listener = m_listeners.find(drop->interface, drop->virtualRouterId);
+			if (listener != 0)
+				listener->onIncomingVrrpError(drop->interface, drop->virtualRouterId, VrrpEventListener::IpTtlError, drop->count);
+		}
+	}
 }
 
 void VrrpSocket::socketCallback (int, void *userData)
@@ -287,89 +548,180 @@ void VrrpSocket::socketCallback (int, void *userData)
 	socket->onSocketPacket();
 }
 
-bool VrrpSocket::onSocketPacket ()
+void VrrpSocket::onSocketPacket ()
 {
-	// Prepare data structures
-	iovec iov;
-	iov.iov_base = m_buffer;
-	iov.iov_len = sizeof(m_buffer);
+	// Account for packets dropped by the filter first, so the protocol error reason of the services is as if they had arrived
+	collectFilterDrops();
+
+	// Drain the socket a batch at a time. A short batch means it was empty
+	for (unsigned int batch = 0; batch != MaxReceiveBatches; ++batch)
+	{
+		for (unsigned int i = 0; i != m_receiveBatchSize; ++i)
+		{
+			// The kernel overwrites the lengths
+			msghdr &hdr = m_receiveHeaders[i].msg_hdr;
+			hdr.msg_name = m_receiveAddresses[i].socketAddress();
+			hdr.msg_namelen = m_receiveAddresses[i].socketAddressSize();
+			hdr.msg_control = &m_receiveControlBuffers[i * ReceiveControlSize];
+			hdr.msg_controllen = ReceiveControlSize;
+		}
+
+		int count;
+		while ((count = recvmmsg(m_socket, &m_receiveHeaders[0], m_receiveBatchSize, MSG_DONTWAIT, 0)) == -1 && errno == EINTR);
+		if (count == -1)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				m_error = errno;
+				LOG(LOG_WARNING, "%s: Error receiving packet: %s", m_name, std::strerror(m_error));
+			}
+			return;
+		}
+
+		for (int i = 0; i != count; ++i)
+		{
+			// Parse through control message, receiving destination address, source interface and receive time
+			int interface = 0;
+			IpAddress dstAddress;
+			std::uint64_t timestamp = 0;
+			decodeControlMessage(m_receiveHeaders[i].msg_hdr, interface, dstAddress, timestamp);
 
-	IpAddress srcAddress;
+			processPacket(&m_receiveBuffers[i * ReceiveBufferSize], m_receiveHeaders[i].msg_len, interface, m_receiveAddresses[i], dstAddress, timestamp);
+		}
 
-	msghdr hdr;
-	hdr.msg_name = srcAddress.socketAddress();
-	hdr.msg_namelen = srcAddress.socketAddressSize();
-	hdr.msg_iov = &iov;
-	hdr.msg_iovlen = 1;
-	hdr.msg_control = m_controlBuffer;
-	hdr.msg_controllen = sizeof(m_controlBuffer);
+		if (static_cast<unsigned int>(count) < m_receiveBatchSize)
+			return;
+	}
+}
 
-	// Receive packet
-	ssize_t size;
-	while ((size = recvmsg(m_socket, &hdr, MSG_DONTWAIT)) == -1 && errno == EINTR);
-	if (size == -1)
+void VrrpSocket::ringCallback (int, void *userData)
+{
+	VrrpSocket *socket = reinterpret_cast<VrrpSocket *>(userData);
+	socket->onRingPacket();
+}
+
+void VrrpSocket::ringPacketCallback (const std::uint8_t *packet, std::size_t size, int interface, std::uint64_t timestamp, void *userData)
+{
+	VrrpSocket *socket = reinterpret_cast<VrrpSocket *>(userData);
+
+	// The ring carries all IP packets and no control message, so filter and take the addresses from the IP header
+	if (socket->m_family == AF_INET)
 	{
-		m_error = errno;
-		syslog(LOG_WARNING, "%s: Error receiving packet: %s", m_name, std::strerror(m_error));
-		return false;
+		if (size < sizeof(iphdr))
+			return;
+		const iphdr *ip = reinterpret_cast<const iphdr *>(packet);
+		if (ip->protocol != 112) // VRRP
+			return;
+		socket->processPacket(packet, size, interface, IpAddress(&ip->saddr, AF_INET), IpAddress(&ip->daddr, AF_INET), timestamp);
 	}
+	else // if (socket->m_family == AF_INET6)
+	{
+		if (size < sizeof(ip6_hdr))
+			return;
+		const ip6_hdr *ip = reinterpret_cast<const ip6_hdr *>(packet);
+		if (ip->ip6_nxt != 112) // VRRP
+			return;
+		socket->processPacket(packet, size, interface, IpAddress(&ip->ip6_src, AF_INET6), IpAddress(&ip->ip6_dst, AF_INET6), timestamp);
+	}
+}
+
+void VrrpSocket::onRingPacket ()
+{
+	collectFilterDrops();
+	m_ring->receive(ringPacketCallback, this);
+}
 
-	// Parse through control message, receiving TTL/HOPLIMIT, destination address and source interface
-	int interface = 0;
-	IpAddress dstAddress;
-	decodeControlMessage(hdr, interface, dstAddress);
+bool VrrpSocket::injectPacket (const std::uint8_t *buffer, std::size_t bufferSize, int interface, const IpAddress &srcAddress, const IpAddress &dstAddress, std::uint64_t timestamp)
+{
+	return processPacket(buffer, bufferSize, interface, srcAddress, dstAddress, timestamp);
+}
+
+bool VrrpSocket::processPacket (const std::uint8_t *buffer, std::size_t bufferSize, int interface, const IpAddress &srcAddress, const IpAddress &dstAddress, std::uint64_t timestamp)
+{
+	if (m_capture != 0)
+		m_capture->write(m_family, buffer, bufferSize, interface, srcAddress, dstAddress, timestamp);
 
-	syslog(LOG_DEBUG, "Packet from interface %i", interface);
+	LOG(LOG_DEBUG, "Packet from interface %i", interface);
 
-	// Find event listener list for interface
-	EventListenerMap::const_iterator interfaceListenerMap = m_listeners.find(interface);
-	if (interfaceListenerMap == m_listeners.end())
+	// The stages run from cheapest to most expensive, so the checksum is only computed for packets that would be accepted.
+	// A packet with a single defect is counted exactly like RFC 5798 / VRRPV3-MIB says. With several defects, it's counted
+	// by the first stage that rejects it, so e.g. a foreign VRID with a bad checksum is a VRID error rather than a checksum error
+
+	// Stage 1: Find event listener list for interface
+	const VrrpListenerTable::Interface *listeners = m_listeners.find(interface);
+	if (listeners == 0)
+	{
+		++m_stageDrops[InterfaceStage];
 		return false;
+	}
 
+	// Stage 2: Headers
 	const std::uint8_t *packet;
 	std::uint8_t ttl;
+	ssize_t size;
 	if (m_family == AF_INET)
 	{
-		const iphdr *ip = reinterpret_cast<const iphdr *>(m_buffer);
-		packet = m_buffer + ip->ihl * 4;
+		const iphdr *ip = reinterpret_cast<const iphdr *>(buffer);
+		if (bufferSize < sizeof(iphdr) || ip->ihl * 4U > bufferSize || ntohs(ip->tot_len) > bufferSize)
+		{
+			++m_stageDrops[HeaderStage];
+			return false;
+		}
+		packet = buffer + ip->ihl * 4;
 		size = ntohs(ip->tot_len) - ip->ihl * 4;
 		ttl = ip->ttl;
 	}
 	else // if (m_family == AF_INET6)
 	{
-		const ip6_hdr *ip = reinterpret_cast<const ip6_hdr *>(m_buffer);
+		const ip6_hdr *ip = reinterpret_cast<const ip6_hdr *>(buffer);
+		if (bufferSize < sizeof(ip6_hdr))
+		{
+			++m_stageDrops[HeaderStage];
+			return false;
+		}
+		if (sizeof(ip6_hdr) + ntohs(ip->ip6_plen) > bufferSize)
+		{
+			LOG(LOG_NOTICE, "%s: Discarded truncated VRRP packet", m_name);
+			notifyAll(*listeners, VrrpEventListener::PacketLengthError);
+			++m_stageDrops[HeaderStage];
+			return false;
+		}
 		size = ntohs(ip->ip6_plen);
 		ttl = ip->ip6_hops;
-		packet = m_buffer + sizeof(ip6_hdr);
-		if (ip->ip6_nxt != 112) // VRRP
+		packet = buffer + sizeof(ip6_hdr);
+
+		// Skip extension headers. Each one must fit in what's left of the payload
+		std::uint8_t next = ip->ip6_nxt;
+		while (next != 112) // VRRP
 		{
 			const ip6_ext *ext = reinterpret_cast<const ip6_ext *>(packet);
-			while (ext->ip6e_nxt != 112)
+			if (size < static_cast<ssize_t>(sizeof(ip6_ext)) || size < (ext->ip6e_len + 1) * 8)
 			{
-				packet += ext->ip6e_len + 2;
-				size -= ext->ip6e_len + 2;
-				ext = reinterpret_cast<const ip6_ext *>(packet);
+				LOG(LOG_NOTICE, "%s: Discarded VRRP packet with truncated extension header", m_name);
+				notifyAll(*listeners, VrrpEventListener::PacketLengthError);
+				++m_stageDrops[HeaderStage];
+				return false;
 			}
+			next = ext->ip6e_nxt;
+			packet += (ext->ip6e_len + 1) * 8;
+			size -= (ext->ip6e_len + 1) * 8;
 		}
 	}
 
-	// Verify VRRP header
 	if (size < 8)
 	{
-		syslog(LOG_NOTICE, "%s: Discarded VRRP packet smaller than 8 bytes", m_name);
+		LOG(LOG_NOTICE, "%s: Discarded VRRP packet smaller than 8 bytes", m_name);
 
 		// Since packet is too small, we cannot know the router id for sure. VRRPV3-MIB requires us to update vrrpv3StatisticsPacketLengthError, so we'll notify all services
-		for (EventListenerMap::mapped_type::const_iterator listener = interfaceListenerMap->second.begin(); listener != interfaceListenerMap->second.end(); ++listener)
-		{
-			listener->second->onIncomingVrrpError(interface, listener->first, VrrpEventListener::PacketLengthError);
-		}
+		notifyAll(*listeners, VrrpEventListener::PacketLengthError);
+		++m_stageDrops[HeaderStage];
 		return false;
 	}
 
-	// Verify VRRP version
+	// Stage 3: VRRP version
 	if ((packet[0] & 0xF0) != 0x30)
 	{
-		syslog(LOG_NOTICE, "%s: Discarded unknown VRRP packet", m_name);
+		LOG(LOG_NOTICE, "%s: Discarded unknown VRRP packet", m_name);
 
 		if (packet[0] == 0x21)
 		{
@@ -378,39 +730,25 @@ bool VrrpSocket::onSocketPacket ()
 
 			// TODO - Verify checksum 
 
-			EventListenerMap::mapped_type::const_iterator listener = interfaceListenerMap->second.find(virtualRouterId);
-			if (listener != interfaceListenerMap->second.end())
-				listener->second->onIncomingVrrpError(interface, listener->first, VrrpEventListener::VersionError);
+			VrrpEventListener *listener = listeners->find(virtualRouterId);
+			if (listener != 0)
+				listener->onIncomingVrrpError(interface, virtualRouterId, VrrpEventListener::VersionError, 1);
 		}
 
 		// Also increment global statistics
 		++m_routerVersionErrors;
+		++m_stageDrops[VersionStage];
 		return false;
 	}
 
-	// Verify VRRP checksum
-	if (dstAddress.family() == AF_UNSPEC)
-		syslog(LOG_WARNING, "%s: Unable to get destination address. Checksum will not be verified", m_name);
-	else if (Util::checksum(packet, size, srcAddress, dstAddress, 112) != 0)
-	{
-		syslog(LOG_NOTICE, "%s: Discarded VRRP packet with invalid checksum", m_name);
-
-		// Increment global statistics
-		++m_routerChecksumErrors;
-		return false;
-	}
-
-	// Verify VRRP type
+	// Stage 4: VRRP type
 	if ((packet[0] & 0x0F) != 0x01)
 	{
-		syslog(LOG_NOTICE, "%s: Discarded VRRP packet with unknown type", m_name);
+		LOG(LOG_NOTICE, "%s: Discarded VRRP packet with unknown type", m_name);
 		
 		// Since packet type is wrong, we cannot know the router id for sure. VRRPV3-MIB requires us to update vrrpv3StatisticsRcvdInvalidTypePackets, so we'll notify all services
-		for (EventListenerMap::mapped_type::const_iterator listener = interfaceListenerMap->second.begin(); listener != interfaceListenerMap->second.end(); ++listener)
-		{
-			listener->second->onIncomingVrrpError(interface, listener->first, VrrpEventListener::InvalidTypeError);
-		}
-
+		notifyAll(*listeners, VrrpEventListener::InvalidTypeError);
+		++m_stageDrops[TypeStage];
 		return false;
 	}
 
@@ -420,88 +758,107 @@ bool VrrpSocket::onSocketPacket ()
 	std::uint_fast8_t addressCount = packet[3];
 	std::uint_fast16_t maxAdvertisementInterval = ((std::uint_fast16_t)(packet[4] & 0x0F) << 8) | packet[5];
 
-	// Find event listener for virtual router id
-	EventListenerMap::mapped_type::const_iterator listener = interfaceListenerMap->second.find(virtualRouterId);
-	if (listener == interfaceListenerMap->second.end())
+	// Stage 5: Find event listener for virtual router id
+	VrrpEventListener *listener = listeners->find(virtualRouterId);
+	if (listener == 0)
 	{
 		// We are not associated with the virtual router id in mind, but VRRPV3-MIB requires us to set vrrpv3StatisticsProtoErrReason to VrIdError, so we'll notify all services
-		for (EventListenerMap::mapped_type::const_iterator listener = interfaceListenerMap->second.begin(); listener != interfaceListenerMap->second.end(); ++listener)
-		{
-			listener->second->onIncomingVrrpError(interface, listener->first, VrrpEventListener::VrIdError);
-		}
+		notifyAll(*listeners, VrrpEventListener::VrIdError);
 
 		++m_routerVrIdErrors;
+		++m_stageDrops[VrIdStage];
 		return false;
 	}
 
-	// Verify TTL
+	// Stage 6: TTL
 	if (ttl != 255)
 	{
-		syslog(LOG_NOTICE, "%s: Discarded VRRP packet with TTL %hhu", m_name, ttl);
+		LOG(LOG_NOTICE, "%s: Discarded VRRP packet with TTL %hhu", m_name, ttl);
 
 		// VRRPV3-MIB requires us to update vrrpv3StatisticsIpTtlErrors and set vrrpv3StatisticsProtoErrReason to VrId, so we'll notify the service
-		listener->second->onIncomingVrrpError(interface, virtualRouterId, VrrpEventListener::IpTtlError);
+		listener->onIncomingVrrpError(interface, virtualRouterId, VrrpEventListener::IpTtlError, 1);
+		++m_stageDrops[TtlStage];
 		return false;
 	}
 
-	// Verify VRRP packet size
+	// Stage 7: VRRP packet size
 	unsigned int addressSize = IpAddress::familySize(m_family);
 	if (size < 8 + addressCount * addressSize)
 	{
-		syslog(LOG_NOTICE, "%s: Discarded incomplete VRRP packet", m_name);
+		LOG(LOG_NOTICE, "%s: Discarded incomplete VRRP packet", m_name);
 
 		// VRRPV3-MIB specifies vrrpv3StatisticsPacketLengthErrors to be the number of packets received less than the length of the VRRP header, but it makes more sense to
 		// register all packets with invalid lengths, so we'll notify the service
-		listener->second->onIncomingVrrpError(interface, virtualRouterId, VrrpEventListener::PacketLengthError); // Expected to increment vrrpv3StatisticsPacketLengthErrors
+		listener->onIncomingVrrpError(interface, virtualRouterId, VrrpEventListener::PacketLengthError, 1); // Expected to increment vrrpv3StatisticsPacketLengthErrors
+		++m_stageDrops[LengthStage];
 		return false;
 	}
 
-	// Create address list
-	IpAddressList addresses;
-	const std::uint8_t *ptr = packet + 8;
-	for (std::uint_fast8_t i = 0; i != addressCount; ++i, ptr += addressSize)
-		addresses.push_back(IpAddress(ptr, m_family));
+	// Stage 8: VRRP checksum, only paid for by packets for our own virtual routers
+	if (dstAddress.family() == AF_UNSPEC)
+		LOG(LOG_WARNING, "%s: Unable to get destination address. Checksum will not be verified", m_name);
+	else if (Util::checksum(packet, size, srcAddress, dstAddress, 112) != 0)
+	{
+		LOG(LOG_NOTICE, "%s: Discarded VRRP packet with invalid checksum", m_name);
+
+		// Increment global statistics
+		++m_routerChecksumErrors;
+		++m_stageDrops[ChecksumStage];
+		return false;
+	}
+
+	// The address list is handed over in place
+	IpAddressListView addresses(packet + 8, addressCount * addressSize, m_family);
 
 	// Call event listener
-	listener->second->onIncomingVrrpPacket(
+	listener->onIncomingVrrpPacket(
 			interface,
 			srcAddress,
 			virtualRouterId,
 			priority,
 			maxAdvertisementInterval,
-			addresses);
+			addresses,
+			timestamp);
 
 	return true;
 }
 
-void VrrpSocket::decodeControlMessage (const msghdr &hdr, int &interface, IpAddress &address)
+void VrrpSocket::notifyAll (const VrrpListenerTable::Interface &listeners, VrrpEventListener::Error error, std::uint_fast64_t count)
 {
-	const std::uint8_t *ptr = reinterpret_cast<const std::uint8_t *>(hdr.msg_control);
-	unsigned int remaining = hdr.msg_controllen;
-	while (remaining >= sizeof(cmsghdr))
+	for (unsigned int i = 0; i != listeners.count; ++i)
 	{
-		const cmsghdr *hdr = reinterpret_cast<const cmsghdr *>(ptr);
-		if (hdr->cmsg_len < sizeof(cmsghdr) || hdr->cmsg_len > remaining)
-		{
-			syslog(LOG_WARNING, "%s: Got invalid control data: %s", m_name, std::strerror(m_error));
-			break;
-		}
+		std::uint_fast8_t virtualRouterId = listeners.ids[i];
+		listeners.listeners[virtualRouterId]->onIncomingVrrpError(listeners.interface, virtualRouterId, error, count);
+	}
+}
 
-		if (m_family == AF_INET && hdr->cmsg_level == SOL_IP && hdr->cmsg_type == IP_PKTINFO && hdr->cmsg_len >= sizeof(cmsghdr) + sizeof(in_pktinfo))
+void VrrpSocket::decodeControlMessage (const msghdr &hdr, int &interface, IpAddress &address, std::uint64_t &timestamp)
+{
+	// CMSG_NXTHDR() doesn't take a const msghdr, but doesn't modify it either
+	msghdr *msg = const_cast<msghdr *>(&hdr);
+	for (const cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != 0; cmsg = CMSG_NXTHDR(msg, const_cast<cmsghdr *>(cmsg)))
+	{
+		if (m_family == AF_INET && cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_PKTINFO && cmsg->cmsg_len >= CMSG_LEN(sizeof(in_pktinfo)))
 		{
-			const in_pktinfo *pktinfo = reinterpret_cast<const in_pktinfo *>(ptr + sizeof(cmsghdr));
+			const in_pktinfo *pktinfo = reinterpret_cast<const in_pktinfo *>(CMSG_DATA(cmsg));
 			interface = pktinfo->ipi_ifindex;
 			address = IpAddress(&pktinfo->ipi_addr, AF_INET);
 		}
-		else if (m_family == AF_INET6 && hdr->cmsg_level == SOL_IPV6 && hdr->cmsg_type == IPV6_PKTINFO && hdr->cmsg_len >= sizeof(cmsghdr) + sizeof(in_pktinfo))
+		else if (m_family == AF_INET6 && cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO && cmsg->cmsg_len >= CMSG_LEN(sizeof(in6_pktinfo)))
 		{
-			const in6_pktinfo *pktinfo = reinterpret_cast<const in6_pktinfo *>(ptr + sizeof(cmsghdr));
+			const in6_pktinfo *pktinfo = reinterpret_cast<const in6_pktinfo *>(CMSG_DATA(cmsg));
 			interface = pktinfo->ipi6_ifindex;
 			address = IpAddress(&pktinfo->ipi6_addr, AF_INET6);
 		}
-
-		remaining -= hdr->cmsg_len;
+		else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS && cmsg->cmsg_len >= CMSG_LEN(sizeof(timespec)))
+		{
+			const timespec *ts = reinterpret_cast<const timespec *>(CMSG_DATA(cmsg));
+			timestamp = ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+		}
 	}
+
+	if (hdr.msg_flags & MSG_CTRUNC)
+		LOG(LOG_WARNING, "%s: Control data was truncated", m_name);
 }
 
 bool VrrpSocket::sendPacket (
@@ -516,80 +873,352 @@ bool VrrpSocket::sendPacket (
 	if (address.family() != m_family)
 		return false;
 
+	if (m_sendCount == SendQueueSize)
+		flush();
+
+	unsigned int packetSize = writePacket(&m_sendBuffers[m_sendCount * SendBufferSize], address, virtualRouterId, priority, maxAdvertisementInterval, addresses);
+	if (packetSize == 0)
+		return false;
+
+	queue(packetSize, writeControl(&m_sendControlBuffers[m_sendCount * SendControlSize], interface, address), 0);
+	return true;
+}
+
+bool VrrpSocket::buildAdvertisement (
+		Advertisement &advertisement,
+		unsigned int interface,
+		const IpAddress &address,
+		std::uint_fast8_t virtualRouterId,
+		std::uint_fast8_t priority,
+		std::uint_fast16_t maxAdvertisementInterval,
+		const IpAddressSet &addresses)
+{
+	advertisement.packet.clear();
+	advertisement.control.clear();
+
+	// Sanity
+	if (address.family() != m_family)
+		return false;
+
+	std::uint8_t packet[SendBufferSize];
+	unsigned int packetSize = writePacket(packet, address, virtualRouterId, priority, maxAdvertisementInterval, addresses);
+	if (packetSize == 0)
+		return false;
+
+	std::uint8_t control[SendControlSize];
+	unsigned int controlSize = writeControl(control, interface, address);
+
+	advertisement.packet.assign(packet, packet + packetSize);
+	advertisement.control.assign(control, control + controlSize);
+	return true;
+}
+
+bool VrrpSocket::sendAdvertisement (Advertisement &advertisement, std::uint_fast8_t priority)
+{
+	if (advertisement.packet.empty())
+		return false;
+
+	if (m_sendCount == SendQueueSize)
+		flush();
+
+	std::uint8_t *buffer = &m_sendBuffers[m_sendCount * SendBufferSize];
+	std::memcpy(buffer, &advertisement.packet[0], advertisement.packet.size());
+	std::memcpy(&m_sendControlBuffers[m_sendCount * SendControlSize], &advertisement.control[0], advertisement.control.size());
+
+	if (buffer[2] != priority)
+	{
+		// Priority shares a checksummed word with the address count
+		std::uint16_t oldWord = *reinterpret_cast<const std::uint16_t *>(buffer + 2);
+		buffer[2] = priority;
+		std::uint16_t newWord = *reinterpret_cast<const std::uint16_t *>(buffer + 2);
+
+		std::uint16_t *checksum = reinterpret_cast<std::uint16_t *>(buffer + 6);
+		*checksum = Util::updateChecksum(*checksum, oldWord, newWord);
+	}
+
+	queue(advertisement.packet.size(), advertisement.control.size(), &advertisement);
+	return true;
+}
+
+void VrrpSocket::forgetAdvertisement (const Advertisement &advertisement)
+{
+	for (unsigned int i = 0; i != m_sendCount; ++i)
+	{
+		if (m_sendOwners[i] == &advertisement)
+			m_sendOwners[i] = 0;
+	}
+	for (unsigned int i = 0; i != RetransmitQueueSize; ++i)
+	{
+		if (m_retransmitOwners[i] == &advertisement)
+			m_retransmitOwners[i] = 0;
+	}
+}
+
+unsigned int VrrpSocket::writePacket (
+		std::uint8_t *buffer,
+		const IpAddress &address,
+		std::uint_fast8_t virtualRouterId,
+		std::uint_fast8_t priority,
+		std::uint_fast16_t maxAdvertisementInterval,
+		const IpAddressSet &addresses)
+{
 	// Create VRRP header
-	m_buffer[0] = 0x31; // VRRPv3 ADVERTISEMENT
-	m_buffer[1] = virtualRouterId;
-	m_buffer[2] = priority;
-	m_buffer[3] = addresses.size();
-	m_buffer[4] = (maxAdvertisementInterval >> 8) & 0x0F;
-	m_buffer[5] = (maxAdvertisementInterval & 0xFF);
-	m_buffer[6] = 0; // Checksum
-	m_buffer[7] = 0; // Checksum
+	buffer[0] = 0x31; // VRRPv3 ADVERTISEMENT
+	buffer[1] = virtualRouterId;
+	buffer[2] = priority;
+	buffer[3] = addresses.size();
+	buffer[4] = (maxAdvertisementInterval >> 8) & 0x0F;
+	buffer[5] = (maxAdvertisementInterval & 0xFF);
+	buffer[6] = 0; // Checksum
+	buffer[7] = 0; // Checksum
 
 	// Add IP addresses
-	std::uint8_t *ptr = m_buffer + 8;
+	std::uint8_t *ptr = buffer + 8;
 	unsigned int addressSize = IpAddress::familySize(m_family);
 	for (IpAddressSet::const_iterator it = addresses.begin(); it != addresses.end(); ++it, ptr += addressSize)
 	{
 		if (it->family() != m_family)
-			return false;
+			return 0;
 		std::memcpy(ptr, it->data(), addressSize);
 	}
 
 	// Calculate checksum
 	unsigned int packetSize = 8 + addresses.size() * addressSize;
-	*reinterpret_cast<std::uint16_t *>(m_buffer + 6) = Util::checksum(m_buffer, packetSize, address, m_multicastAddress, 112);
+	*reinterpret_cast<std::uint16_t *>(buffer + 6) = Util::checksum(buffer, packetSize, address, m_multicastAddress, 112);
 
-	// Fill control structure
-	unsigned int controlSize;
+	return packetSize;
+}
+
+unsigned int VrrpSocket::writeControl (std::uint8_t *buffer, unsigned int interface, const IpAddress &address)
+{
 	if (m_family == AF_INET)
 	{
-		cmsghdr *cmsg = reinterpret_cast<cmsghdr *>(m_controlBuffer);
+		cmsghdr *cmsg = reinterpret_cast<cmsghdr *>(buffer);
 		cmsg->cmsg_len = sizeof(cmsghdr) + sizeof(in_pktinfo);
 		cmsg->cmsg_level = SOL_IP;
 		cmsg->cmsg_type = IP_PKTINFO;
 		
-		in_pktinfo *pktinfo = reinterpret_cast<in_pktinfo *>(m_controlBuffer + sizeof(cmsghdr));
+		in_pktinfo *pktinfo = reinterpret_cast<in_pktinfo *>(buffer + sizeof(cmsghdr));
 		pktinfo->ipi_ifindex = interface;
 		std::memcpy(&pktinfo->ipi_spec_dst, address.data(), address.size());
 		std::memcpy(&pktinfo->ipi_addr, m_multicastAddress.data(), address.size());
 
-		controlSize = cmsg->cmsg_len;
+		return cmsg->cmsg_len;
 	}
 	else // if (m_family == AF_INET6)
 	{
-		cmsghdr *cmsg = reinterpret_cast<cmsghdr *>(m_controlBuffer);
+		cmsghdr *cmsg = reinterpret_cast<cmsghdr *>(buffer);
 		cmsg->cmsg_len = sizeof(cmsghdr) + sizeof(in6_pktinfo);
 		cmsg->cmsg_level = SOL_IPV6;
 		cmsg->cmsg_type = IPV6_PKTINFO;
 
-		in6_pktinfo *pktinfo = reinterpret_cast<in6_pktinfo *>(m_controlBuffer + sizeof(cmsghdr));
+		in6_pktinfo *pktinfo = reinterpret_cast<in6_pktinfo *>(buffer + sizeof(cmsghdr));
 		std::memcpy(&pktinfo->ipi6_addr, address.data(), address.size());
 		pktinfo->ipi6_ifindex = interface;
 
-		controlSize = cmsg->cmsg_len;
+		return cmsg->cmsg_len;
 	}
+}
+
+void VrrpSocket::queue (unsigned int packetSize, unsigned int controlSize, Advertisement *owner)
+{
+	// Everything else in the message header was set up by the constructor
+	m_sendIov[m_sendCount].iov_len = packetSize;
+	m_sendHeaders[m_sendCount].msg_hdr.msg_controllen = controlSize;
+	m_sendOwners[m_sendCount] = owner;
+	++m_sendCount;
+	++m_advertisementsQueued;
+}
 
-	// Prepare data structures
-	iovec iov;
-	iov.iov_base = m_buffer;
-	iov.iov_len = packetSize;
+void VrrpSocket::flush ()
+{
+	if (m_sendCount == 0)
+		return;
 
-	msghdr hdr;
-	hdr.msg_name = m_multicastAddress.socketAddress();
-	hdr.msg_namelen = m_multicastAddress.socketAddressSize();
-	hdr.msg_iov = &iov;
-	hdr.msg_iovlen = 1;
-	hdr.msg_control = m_controlBuffer;
-	hdr.msg_controllen = controlSize;
-	hdr.msg_flags = 0;
-	
-	if (sendmsg(m_socket, &hdr, MSG_DONTWAIT) == -1)
+	if (m_socket == -1)
 	{
-		m_error = errno;
-		syslog(LOG_WARNING, "%s: Error sending packet: %s", m_name, std::strerror(m_error));
-		return false;
+		for (unsigned int i = 0; i != m_sendCount; ++i)
+			countDrop(m_sendOwners[i]);
+		m_sendCount = 0;
+		return;
+	}
+
+	// Deferred advertisements go first, and if they can't, the new ones can't either
+	if (m_retransmitCount != 0)
+		retransmit();
+
+	unsigned int sent = 0;
+	while (sent != m_sendCount && m_retransmitCount == 0)
+	{
+		// sendmmsg() stops at the first message that fails, and only reports the error if that is the first message
+		int count = sendmmsg(m_socket, &m_sendHeaders[sent], m_sendCount - sent, MSG_DONTWAIT);
+		++m_sendCalls;
+		if (count > 0)
+		{
+			sent += count;
+			m_advertisementsSent += count;
+			continue;
+		}
+
+		// Logging may overwrite errno
+		int error = errno;
+		if (error == EINTR)
+			continue;
+		else if (error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS)
+		{
+			// The send buffer is full, so the rest would fail as well
+			LOG(LOG_NOTICE, "%s: Deferring %u advertisements: %s", m_name, m_sendCount - sent, std::strerror(error));
+			for (; sent != m_sendCount; ++sent)
+				defer(sent);
+			scheduleRetransmit(error != ENOBUFS);
+		}
+		else
+		{
+			// Only this advertisement is affected, e.g. because its interface went down
+			m_error = error;
+			LOG(LOG_WARNING, "%s: Error sending packet: %s", m_name, std::strerror(m_error));
+			countDrop(m_sendOwners[sent]);
+			++sent;
+		}
+	}
+
+	// Still waiting for room, so queue up behind the deferred ones to keep advertisements in order
+	for (; sent != m_sendCount; ++sent)
+		defer(sent);
+
+	m_sendCount = 0;
+}
+
+void VrrpSocket::defer (unsigned int index)
+{
+	// The oldest advertisement is the one closest to going stale, so a full queue drops it
+	if (m_retransmitCount == RetransmitQueueSize)
+	{
+		countDrop(m_retransmitOwners[m_retransmitHead]);
+		m_retransmitHead = (m_retransmitHead + 1) % RetransmitQueueSize;
+		--m_retransmitCount;
+	}
+
+	unsigned int slot = (m_retransmitHead + m_retransmitCount) % RetransmitQueueSize;
+	const msghdr &hdr = m_sendHeaders[index].msg_hdr;
+	std::memcpy(&m_retransmitBuffers[slot * SendBufferSize], m_sendIov[index].iov_base, m_sendIov[index].iov_len);
+	std::memcpy(&m_retransmitControlBuffers[slot * SendControlSize], hdr.msg_control, hdr.msg_controllen);
+	m_retransmitIov[slot].iov_len = m_sendIov[index].iov_len;
+	m_retransmitHeaders[slot].msg_hdr.msg_controllen = hdr.msg_controllen;
+	m_retransmitOwners[slot] = m_sendOwners[index];
+
+	// Once the next advertisement is due, this one is useless
+	const std::uint8_t *packet = &m_retransmitBuffers[slot * SendBufferSize];
+	unsigned int interval = ((packet[4] & 0x0F) << 8) | packet[5];
+	m_retransmitDeadlines[slot] = Timer::now() + interval * 10;
+
+	++m_retransmitCount;
+	++m_advertisementsDeferred;
+	if (m_retransmitOwners[slot] != 0)
+		++m_retransmitOwners[slot]->deferred;
+}
+
+void VrrpSocket::retransmit ()
+{
+	std::uint64_t now = Timer::now();
+	bool bufferFull = false;
+	while (m_retransmitCount != 0)
+	{
+		if (m_retransmitDeadlines[m_retransmitHead] <= now)
+		{
+			countDrop(m_retransmitOwners[m_retransmitHead]);
+			m_retransmitHead = (m_retransmitHead + 1) % RetransmitQueueSize;
+			--m_retransmitCount;
+			continue;
+		}
+
+		// Entries are sent in order up to the end of the ring, so a wrapped queue takes two calls. Stale ones are dropped when they reach the head
+		unsigned int length = 1;
+		unsigned int maxLength = std::min<unsigned int>(m_retransmitCount, RetransmitQueueSize - m_retransmitHead);
+		while (length != maxLength && m_retransmitDeadlines[m_retransmitHead + length] > now)
+			++length;
+
+		int count = sendmmsg(m_socket, &m_retransmitHeaders[m_retransmitHead], length, MSG_DONTWAIT);
+		++m_sendCalls;
+		if (count > 0)
+		{
+			for (int i = 0; i != count; ++i)
+			{
+				Advertisement *owner = m_retransmitOwners[(m_retransmitHead + i) % RetransmitQueueSize];
+				if (owner != 0)
+					++owner->late;
+			}
+			m_retransmitHead = (m_retransmitHead + count) % RetransmitQueueSize;
+			m_retransmitCount -= count;
+			m_advertisementsSent += count;
+			m_advertisementsLate += count;
+			continue;
+		}
+
+		int error = errno;
+		if (error == EINTR)
+			continue;
+		else if (error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS)
+		{
+			bufferFull = (error != ENOBUFS);
+			break;
+		}
+		else
+		{
+			m_error = error;
+			LOG(LOG_WARNING, "%s: Error sending packet: %s", m_name, std::strerror(m_error));
+			countDrop(m_retransmitOwners[m_retransmitHead]);
+			m_retransmitHead = (m_retransmitHead + 1) % RetransmitQueueSize;
+			--m_retransmitCount;
+		}
+	}
+
+	scheduleRetransmit(bufferFull);
+}
+
+void VrrpSocket::scheduleRetransmit (bool bufferFull)
+{
+	// ENOBUFS means the packet was dropped further down the stack, so the socket stays writable and
+	// EPOLLOUT would fire right away. A short timer retries without spinning
+	bool monitor = (m_retransmitCount != 0 && bufferFull && m_writeFd != -1);
+	if (monitor != m_writeMonitored)
+	{
+		if (monitor)
+			m_writeMonitored = MainLoop::addWriteMonitor(m_writeFd, writeCallback, this, MainLoop::VrrpPriority);
+		else
+		{
+			MainLoop::removeMonitor(m_writeFd);
+			m_writeMonitored = false;
+		}
+	}
+
+	if (m_retransmitCount != 0 && !m_writeMonitored)
+	{
+		if (!m_retransmitTimer.armed())
+			m_retransmitTimer.start(1);
 	}
 	else
-		return true;
+		m_retransmitTimer.stop();
+}
+
+void VrrpSocket::countDrop (Advertisement *owner)
+{
+	++m_advertisementsDropped;
+	if (owner != 0)
+		++owner->dropped;
+}
+
+void VrrpSocket::writeCallback (int, void *userData)
+{
+	reinterpret_cast<VrrpSocket *>(userData)->retransmit();
+}
+
+void VrrpSocket::retransmitTimerCallback (Timer *, void *userData)
+{
+	reinterpret_cast<VrrpSocket *>(userData)->retransmit();
+}
+
+void VrrpSocket::flushCallback (void *userData)
+{
+	reinterpret_cast<VrrpSocket *>(userData)->flush();
 }
@@ -20,17 +20,33 @@
 #define INCLUDE_OPENVRRP_VRRPSOCKET_H
 
 #include "ipaddress.h"
+#include "timer.h"
+#include "vrrpeventlistener.h"
+#include "vrrplistenertable.h"
 
 #include <cstdint>
 #include <map>
+#include <vector>
 
-class VrrpEventListener;
+#include <sys/socket.h>
+
+class VrrpCapture;
+class VrrpFilter;
+class VrrpRing;
 
 class VrrpSocket
 {
 	public:
 		void addEventListener (unsigned int interface, std::uint_fast8_t virtualRouterId, VrrpEventListener *eventListener);
 		void removeEventListener (unsigned int interface, std::uint_fast8_t virtualRouterId);
+
+		/**
+		  * Queue an advertisement
+		  *
+		  * Queued advertisements are sent with a single sendmmsg() when the
+		  * main loop is about to wait for events, or when the queue is full
+		  * @return false if the advertisement couldn't be built
+		  */
 		bool sendPacket (
 				unsigned int interface,
 				const IpAddress &address,
@@ -38,6 +54,62 @@ class VrrpSocket
 				std::uint_fast8_t priority,
 				std::uint_fast16_t maxAdvertisementInterval,
 				const IpAddressSet &addresses);
+
+		/**
+		  * Advertisement serialized ahead of time, with its control message
+		  */
+		struct Advertisement
+		{
+			Advertisement () :
+				deferred(0),
+				late(0),
+				dropped(0)
+			{
+			}
+
+			std::vector<std::uint8_t> packet; // Empty until built
+			std::vector<std::uint8_t> control;
+
+			// Copies queued by sendAdvertisement() that found the send buffer full
+			std::uint_fast64_t deferred; // Moved to the retransmit queue
+			std::uint_fast64_t late;     // Sent from the retransmit queue
+			std::uint_fast64_t dropped;  // Never sent, including deferred ones that went stale
+		};
+
+		/**
+		  * Serialize an advertisement for sendAdvertisement()
+		  * @return false if the advertisement couldn't be built, in which case it is left empty
+		  */
+		bool buildAdvertisement (
+				Advertisement &advertisement,
+				unsigned int interface,
+				const IpAddress &address,
+				std::uint_fast8_t virtualRouterId,
+				std::uint_fast8_t priority,
+				std::uint_fast16_t maxAdvertisementInterval,
+				const IpAddressSet &addresses);
+
+		/**
+		  * Queue a serialized advertisement like sendPacket() does
+		  *
+		  * If priority differs from the one it was built with, the queued copy
+		  * gets the new priority, and its checksum is updated incrementally
+		  * @return false if the advertisement is empty
+		  */
+		bool sendAdvertisement (Advertisement &advertisement, std::uint_fast8_t priority);
+
+		/**
+		  * Stop counting queued copies of an advertisement in it
+		  *
+		  * Must be called before destroying an advertisement that has been sent.
+		  * The copies are still sent
+		  */
+		void forgetAdvertisement (const Advertisement &advertisement);
+
+		/**
+		  * Send queued advertisements now
+		  */
+		void flush ();
 		
 		inline int error () const
 		{
@@ -47,9 +119,75 @@ class VrrpSocket
 		bool addInterface (int interface);
 		bool removeInterface (int interface);
 
+		/**
+		  * Run a packet through validation and dispatch as if it was received
+		  * @param buffer Packet as received from the socket
+		  * @return true if it was passed to an event listener
+		  */
+		bool injectPacket (const std::uint8_t *buffer, std::size_t bufferSize, int interface, const IpAddress &srcAddress, const IpAddress &dstAddress, std::uint64_t timestamp);
+
 		static VrrpSocket *instance (int family);
 		static void cleanup ();
 
+		/**
+		  * Send the queued advertisements of all sockets now
+		  */
+		static void flushAll ();
+
+		/**
+		  * Set number of packets received per system call
+		  *
+		  * Only sockets created afterwards are affected
+		  * @param size Batch size. 1 receives packets one at a time
+		  */
+		static void setReceiveBatchSize (unsigned int size);
+
+		/**
+		  * Set size of the socket send buffer
+		  *
+		  * Only sockets created afterwards are affected
+		  * @param size Size in bytes, or 0 for the system default
+		  */
+		static void setSendBufferSize (unsigned int size);
+
+		enum Ingest
+		{
+			SocketIngest, // recvmmsg() on the raw socket
+			RingIngest,   // TPACKET_V3 ring of an AF_PACKET socket
+			ReplayIngest  // No socket at all. Packets only come from injectPacket()
+		};
+
+		/**
+		  * Select how packets are received
+		  *
+		  * Only sockets created afterwards are affected. If the ring can't be
+		  * set up, the raw socket is used
+		  */
+		static void setIngest (Ingest ingest);
+
+		/**
+		  * Drop unwanted packets in the kernel with an eBPF socket filter
+		  *
+		  * Only sockets created afterwards are affected. If the filter can't
+		  * be loaded, packets are filtered in user space as usual
+		  */
+		static void setKernelFilter (bool enabled);
+
+		/**
+		  * Record every received packet to a pcapng file
+		  * @param fileName File to write, or 0 to stop capturing
+		  * @return true on success
+		  */
+		static bool setCaptureFile (const char *fileName);
+
+		/**
+		  * Add packets dropped by the kernel filters to the statistics
+		  *
+		  * This happens every second anyway, but should be done before
+		  * presenting statistics.
+		  */
+		static void updateStatistics ();
+
 		static std::uint_fast64_t routerChecksumErrors ()
 		{
 			return m_routerChecksumErrors;
@@ -65,6 +203,74 @@ class VrrpSocket
 			return m_routerVrIdErrors;
 		}
 
+		static std::uint_fast64_t advertisementsQueued ()
+		{
+			return m_advertisementsQueued;
+		}
+
+		static std::uint_fast64_t advertisementsSent ()
+		{
+			return m_advertisementsSent;
+		}
+
+		/**
+		  * Get number of queued advertisements that couldn't be sent
+		  */
+		static std::uint_fast64_t advertisementsDropped ()
+		{
+			return m_advertisementsDropped;
+		}
+
+		/**
+		  * Get number of advertisements that found the send buffer full and were retransmitted or dropped later
+		  */
+		static std::uint_fast64_t advertisementsDeferred ()
+		{
+			return m_advertisementsDeferred;
+		}
+
+		/**
+		  * Get number of deferred advertisements that were sent before going stale
+		  */
+		static std::uint_fast64_t advertisementsLate ()
+		{
+			return m_advertisementsLate;
+		}
+
+		/**
+		  * Get number of sendmmsg() calls
+		  */
+		static std::uint_fast64_t sendCalls ()
+		{
+			return m_sendCalls;
+		}
+
+		/**
+		  * Validation stages of received packets, cheapest first
+		  */
+		enum Stage
+		{
+			InterfaceStage, // No virtual router on the receiving interface
+			HeaderStage,    // Truncated IP or VRRP header
+			VersionStage,   // Not VRRPv3
+			TypeStage,      // Not an advertisement
+			VrIdStage,      // No virtual router with the VRID on the interface
+			TtlStage,       // TTL or hop limit isn't 255
+			LengthStage,    // Address list doesn't fit in the packet
+			ChecksumStage,  // Invalid checksum
+			StageCount
+		};
+
+		/**
+		  * Get number of packets rejected by a stage, including those dropped by the kernel filter
+		  */
+		static std::uint_fast64_t stageDrops (Stage stage)
+		{
+			return m_stageDrops[stage];
+		}
+
+		static const char *stageName (Stage stage);
+
 	private:
 		explicit VrrpSocket (int family);
 		~VrrpSocket ();
@@ -72,14 +278,32 @@ class VrrpSocket
 		bool createSocket ();
 		void closeSocket ();
 
-		bool onSocketPacket ();
+		void onSocketPacket ();
+		void onRingPacket ();
+		bool processPacket (const std::uint8_t *buffer, std::size_t bufferSize, int interface, const IpAddress &srcAddress, const IpAddress &dstAddress, std::uint64_t timestamp);
+
+		unsigned int writePacket (std::uint8_t *buffer, const IpAddress &address, std::uint_fast8_t virtualRouterId, std::uint_fast8_t priority, std::uint_fast16_t maxAdvertisementInterval, const IpAddressSet &addresses);
+		unsigned int writeControl (std::uint8_t *buffer, unsigned int interface, const IpAddress &address);
+		void queue (unsigned int packetSize, unsigned int controlSize, Advertisement *owner);
+		void defer (unsigned int index);
+		void retransmit ();
+		void scheduleRetransmit (bool bufferFull);
+		void countDrop (Advertisement *owner);
 
-		void decodeControlMessage (const msghdr &hdr, int &interface, IpAddress &address);
+		void decodeControlMessage (const msghdr &hdr, int &interface, IpAddress &address, std::uint64_t &timestamp);
+
+		void notifyAll (const VrrpListenerTable::Interface &listeners, VrrpEventListener::Error error, std::uint_fast64_t count = 1);
+		void collectFilterDrops ();
 
 		static void socketCallback (int fd, void *userData);
+		static void ringCallback (int fd, void *userData);
+		static void ringPacketCallback (const std::uint8_t *packet, std::size_t size, int interface, std::uint64_t timestamp, void *userData);
+		static void filterTimerCallback (Timer *timer, void *userData);
+		static void flushCallback (void *userData);
+		static void writeCallback (int fd, void *userData);
+		static void retransmitTimerCallback (Timer *timer, void *userData);
 
 	private:
-		typedef std::map<unsigned int, std::map<std::uint_fast8_t, VrrpEventListener *> > EventListenerMap;
 		typedef std::map<int, unsigned int> InterfaceMap;
 
 		int m_family;
@@ -87,17 +311,66 @@ class VrrpSocket
 		int m_socket;
 		const char *m_name;
 		IpAddress m_multicastAddress;
-		EventListenerMap m_listeners;
-		std::uint8_t m_buffer[2048];
-		std::uint8_t m_controlBuffer[1024];
+		VrrpListenerTable m_listeners;
+
+		enum
+		{
+			ReceiveBufferSize = 2048,
+			ReceiveControlSize = 256,
+			MaxReceiveBatches = 8, // Per wakeup, so a flood can't keep the loop away from timers
+			SendBufferSize = 2048,
+			SendControlSize = 64,
+			SendQueueSize = 64,
+			RetransmitQueueSize = 64
+		};
+
+		std::vector<std::uint8_t> m_receiveBuffers;
+		std::vector<std::uint8_t> m_receiveControlBuffers;
+		std::vector<iovec> m_receiveIov;
+		std::vector<mmsghdr> m_receiveHeaders;
+		std::vector<IpAddress> m_receiveAddresses;
+		std::vector<std::uint8_t> m_sendBuffers;
+		std::vector<std::uint8_t> m_sendControlBuffers;
+		std::vector<iovec> m_sendIov;
+		std::vector<mmsghdr> m_sendHeaders;
+		std::vector<Advertisement *> m_sendOwners;
+		unsigned int m_sendCount;
+
+		// Ring of advertisements waiting for room in the send buffer, oldest first
+		std::vector<std::uint8_t> m_retransmitBuffers;
+		std::vector<std::uint8_t> m_retransmitControlBuffers;
+		std::vector<iovec> m_retransmitIov;
+		std::vector<mmsghdr> m_retransmitHeaders;
+		std::vector<Advertisement *> m_retransmitOwners;
+		std::vector<std::uint64_t> m_retransmitDeadlines; // Timer::now() when the next advertisement supersedes it
+		unsigned int m_retransmitHead;
+		unsigned int m_retransmitCount;
+		int m_writeFd; // dup() of m_socket, watched for writability while the retransmit queue waits for EPOLLOUT
+		bool m_writeMonitored;
+		Timer m_retransmitTimer;
 		std::map<int,unsigned int> m_interfaceCount;
+		VrrpRing *m_ring;
+		VrrpFilter *m_filter;
+		Timer m_filterTimer;
 		static std::uint_fast64_t m_routerChecksumErrors;
 		static std::uint_fast64_t m_routerVersionErrors;
 		static std::uint_fast64_t m_routerVrIdErrors;
+		static std::uint_fast64_t m_stageDrops[StageCount];
+		static std::uint_fast64_t m_advertisementsQueued;
+		static std::uint_fast64_t m_advertisementsSent;
+		static std::uint_fast64_t m_advertisementsDropped;
+		static std::uint_fast64_t m_advertisementsDeferred;
+		static std::uint_fast64_t m_advertisementsLate;
+		static std::uint_fast64_t m_sendCalls;
 
 	private:
 		static VrrpSocket *m_ipv4Instance;
 		static VrrpSocket *m_ipv6Instance;
+		static unsigned int m_receiveBatchSize;
+		static unsigned int m_sendBufferSize;
+		static bool m_kernelFilter;
+		static VrrpCapture *m_capture;
+		static Ingest m_ingest;
 };
 
 #endif // INCLUDE_OPENVRRP_VRRPSOCKET_H
@@ -0,0 +1,240 @@
+/*
+ * Allocation test
+ *
+ * Runs a backup VRRP router on one end of a temporary veth pair and feeds
+ * it valid advertisements from a master with a higher priority through the
+ * other end, counting heap allocations. After a warm-up, receiving and
+ * handling advertisements must not allocate.
+ *
+ * Usage: allocation-test [PACKETS]
+ *
+ * Needs root and the ip command.
+ */
+
+#include "mainloop.h"
+#include "timer.h"
+#include "util.h"
+#include "ipaddress.h"
+#include "ipsubnet.h"
+#include "netlink.h"
+#include "vrrpmanager.h"
+#include "vrrpservice.h"
+
+#include <iostream>
+#include <new>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+#include <signal.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+
+static bool counting = false;
+static unsigned long long allocations = 0;
+
+void *operator new (std::size_t size)
+{
+	if (counting)
+		++allocations;
+	void *ptr = std::malloc(size == 0 ? 1 : size);
+	if (ptr == 0)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new[] (std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete (void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[] (void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete (void *ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[] (void *ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+#define ROUTER_INTERFACE "vrrpalloc0"
+#define MASTER_INTERFACE "vrrpalloc1"
+
+static const unsigned int virtualRouterId = 1;
+static const char *routerAddress = "10.77.0.1";
+static const char *masterAddress = "10.77.0.2";
+static const char *addresses[] = {"10.77.0.100", "10.77.0.101", "10.77.0.102"};
+static const unsigned int addressCount = sizeof(addresses) / sizeof(addresses[0]);
+
+static int sendSocket = -1;
+static sockaddr_ll sendAddress;
+static std::uint8_t packet[sizeof(iphdr) + 8 + 4 * addressCount];
+static unsigned int remaining = 0;
+static unsigned int warmup = 0;
+static VrrpService *service = 0;
+static std::uint_fast64_t received = 0;
+
+static void buildPacket ()
+{
+	IpAddress source(masterAddress);
+	IpAddress destination("224.0.0.18");
+
+	std::uint8_t *vrrp = packet + sizeof(iphdr);
+	vrrp[0] = 0x31;
+	vrrp[1] = virtualRouterId;
+	vrrp[2] = 200;
+	vrrp[3] = addressCount;
+	vrrp[4] = 0;
+	vrrp[5] = 100;
+	vrrp[6] = 0;
+	vrrp[7] = 0;
+	for (unsigned int i = 0; i != addressCount; ++i)
+		std::memcpy(vrrp + 8 + 4 * i, IpAddress(addresses[i]).data(), 4);
+	*reinterpret_cast<std::uint16_t *>(vrrp + 6) = Util::checksum(vrrp, sizeof(packet) - sizeof(iphdr), source, destination, 112);
+
+	iphdr *ip = reinterpret_cast<iphdr *>(packet);
+	std::memset(ip, 0, sizeof(iphdr));
+	ip->version = 4;
+	ip->ihl = sizeof(iphdr) / 4;
+	ip->tot_len = htons(sizeof(packet));
+	ip->ttl = 255;
+	ip->protocol = 112;
+	std::memcpy(&ip->saddr, source.data(), 4);
+	std::memcpy(&ip->daddr, destination.data(), 4);
+
+	std::uint32_t sum = 0;
+	const std::uint16_t *words = reinterpret_cast<const std::uint16_t *>(ip);
+	for (unsigned int i = 0; i != sizeof(iphdr) / 2; ++i)
+		sum += words[i];
+	while (sum > 0xFFFF)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	ip->check = ~sum;
+}
+
+static bool createInterfaces ()
+{
+	return std::system(
+			"ip link add " ROUTER_INTERFACE " type veth peer name " MASTER_INTERFACE " && "
+			"ip link set " MASTER_INTERFACE " up && "
+			"ip link set " ROUTER_INTERFACE " up") == 0;
+}
+
+static void removeInterfaces ()
+{
+	std::system("ip link del " ROUTER_INTERFACE " 2> /dev/null");
+}
+
+static void sendCallback (Timer *timer, void *)
+{
+	if (warmup != 0 && --warmup == 0)
+	{
+		received = service->statsRcvdAdvertisements();
+		counting = true;
+	}
+
+	if (remaining == 0)
+	{
+		counting = false;
+		raise(SIGINT);
+		return;
+	}
+
+	for (unsigned int i = 0; i != 10 && remaining != 0; ++i, --remaining)
+		sendto(sendSocket, packet, sizeof(packet), 0, reinterpret_cast<const sockaddr *>(&sendAddress), sizeof(sendAddress));
+
+	timer->start(1);
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int packets = (argc > 1 ? std::atoi(argv[1]) : 10000);
+
+	openlog("allocation-test", LOG_PERROR, LOG_USER);
+	setlogmask(LOG_UPTO(LOG_INFO));
+
+	removeInterfaces();
+	if (!createInterfaces())
+	{
+		std::cerr << "Unable to create veth pair" << std::endl;
+		return 1;
+	}
+	std::atexit(removeInterfaces);
+	std::system((std::string("ip addr add ") + routerAddress + "/24 dev " ROUTER_INTERFACE).c_str());
+
+	// Send advertisements as raw frames, since the kernel wouldn't deliver packets between two local addresses over the wire
+	sendSocket = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+	if (sendSocket == -1)
+	{
+		std::cerr << "Unable to create packet socket" << std::endl;
+		return 1;
+	}
+	std::memset(&sendAddress, 0, sizeof(sendAddress));
+	sendAddress.sll_family = AF_PACKET;
+	sendAddress.sll_protocol = htons(ETH_P_IP);
+	sendAddress.sll_ifindex = if_nametoindex(MASTER_INTERFACE);
+	sendAddress.sll_halen = 6;
+	static const std::uint8_t multicastMac[] = {0x01, 0x00, 0x5E, 0x00, 0x00, 0x12};
+	std::memcpy(sendAddress.sll_addr, multicastMac, sizeof(multicastMac));
+	buildPacket();
+
+	// Wait for the link to come up
+	int interface = if_nametoindex(ROUTER_INTERFACE);
+	for (unsigned int i = 0; i != 50 && !Netlink::isInterfaceUp(interface); ++i)
+		usleep(20000);
+
+	service = VrrpManager::getService(interface, virtualRouterId, 0, AF_INET, true);
+	if (service == 0)
+	{
+		std::cerr << "Unable to create router" << std::endl;
+		return 1;
+	}
+	for (unsigned int i = 0; i != addressCount; ++i)
+		service->addIpAddress(IpSubnet(IpAddress(addresses[i])));
+	service->setPriority(100);
+	service->enable();
+	if (service->state() != VrrpService::Backup)
+	{
+		std::cerr << "Router didn't become backup" << std::endl;
+		return 1;
+	}
+
+	// Let the first advertisements settle anything that is allocated once
+	warmup = 20;
+	remaining = packets + warmup * 10;
+
+	Timer sendTimer(sendCallback, 0);
+	sendTimer.start(1);
+	MainLoop::run();
+
+	received = service->statsRcvdAdvertisements() - received;
+	VrrpManager::cleanup();
+
+	std::cout << "Advertisements handled: " << received << std::endl;
+	std::cout << "Heap allocations:       " << allocations << std::endl;
+
+	if (received == 0 || allocations != 0)
+	{
+		std::cout << "FAILED" << std::endl;
+		return 1;
+	}
+	std::cout << "OK" << std::endl;
+	return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Checksum test
+ *
+ * Checks that changing the priority of an advertisement with an incremental
+ * checksum update gives the same checksum as computing it from scratch, for
+ * every pair of priorities and a range of address lists in both families.
+ *
+ * Usage: checksum-test
+ */
+
+#include "ipaddress.h"
+#include "util.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+static int failures = 0;
+
+static void check (bool condition, const char *what, unsigned int value)
+{
+	if (!condition)
+	{
+		std::cerr << "FAIL: " << what << " (" << value << ")" << std::endl;
+		++failures;
+	}
+}
+
+static unsigned int buildPacket (std::uint8_t *packet, const IpAddress &src, const IpAddress &dst, std::uint8_t priority, unsigned int addresses)
+{
+	unsigned int addressSize = IpAddress::familySize(src.family());
+	packet[0] = 0x31;
+	packet[1] = 42;
+	packet[2] = priority;
+	packet[3] = addresses;
+	packet[4] = 0;
+	packet[5] = 100;
+	packet[6] = 0;
+	packet[7] = 0;
+	for (unsigned int i = 0; i != addresses * addressSize; ++i)
+		packet[8 + i] = std::rand();
+
+	unsigned int size = 8 + addresses * addressSize;
+	*reinterpret_cast<std::uint16_t *>(packet + 6) = Util::checksum(packet, size, src, dst, 112);
+	return size;
+}
+
+static void testFamily (const IpAddress &src, const IpAddress &dst)
+{
+	std::uint8_t packet[8 + 255 * 16];
+	std::uint8_t expected[sizeof(packet)];
+
+	for (unsigned int addresses = 0; addresses <= 255; addresses += 17)
+	{
+		for (unsigned int from = 0; from <= 255; ++from)
+		{
+			unsigned int size = buildPacket(packet, src, dst, from, addresses);
+			for (unsigned int to = 0; to <= 255; ++to)
+			{
+				std::uint8_t copy[sizeof(packet)];
+				std::memcpy(copy, packet, size);
+
+				std::uint16_t oldWord = *reinterpret_cast<const std::uint16_t *>(copy + 2);
+				copy[2] = to;
+				std::uint16_t newWord = *reinterpret_cast<const std::uint16_t *>(copy + 2);
+				std::uint16_t *checksum = reinterpret_cast<std::uint16_t *>(copy + 6);
+				*checksum = Util::updateChecksum(*checksum, oldWord, newWord);
+
+				// Same packet computed from scratch
+				std::memcpy(expected, copy, size);
+				expected[6] = 0;
+				expected[7] = 0;
+				std::uint16_t full = Util::checksum(expected, size, src, dst, 112);
+
+				check(*checksum == full, "incremental checksum differs", from << 8 | to);
+				check(Util::checksum(copy, size, src, dst, 112) == 0, "incremental checksum doesn't verify", from << 8 | to);
+			}
+		}
+	}
+}
+
+int main ()
+{
+	testFamily(IpAddress("10.0.0.1"), IpAddress("224.0.0.18"));
+	testFamily(IpAddress("fe80::1"), IpAddress("ff02::12"));
+
+	check(Util::updateChecksum(0x1234, 0xABCD, 0xABCD) == 0x1234, "unchanged word", 0);
+
+	if (failures == 0)
+		std::cout << "All tests passed" << std::endl;
+	return failures == 0 ? 0 : 1;
+}
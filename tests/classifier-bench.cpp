@@ -0,0 +1,139 @@
+/*
+ * VRRP validation benchmark
+ *
+ * Runs generated IPv4 advertisements through the validation stages of
+ * VrrpSocket without a socket: a mix of advertisements for virtual routers
+ * we run and for foreign virtual routers on the same segment, like a
+ * shared LAN with many VRRP deployments. Reports the time per packet for
+ * each kind of traffic and for the mix, and the stage drop counters.
+ *
+ * Usage: classifier-bench [FOREIGN_PERCENT] [ADDRESSES] [PACKETS]
+ *
+ * ADDRESSES is the number of addresses per advertisement, which is what
+ * the checksum costs scale with.
+ */
+
+#include "ipaddress.h"
+#include "util.h"
+#include "vrrpsocket.h"
+#include "vrrpeventlistener.h"
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#include <syslog.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+
+class Listener : public VrrpEventListener
+{
+	public:
+		virtual void onIncomingVrrpPacket (unsigned int, const IpAddress &, std::uint_fast8_t, std::uint_fast8_t, std::uint_fast16_t, const IpAddressListView &, std::uint64_t)
+		{
+		}
+
+		virtual void onIncomingVrrpError (unsigned int, std::uint_fast8_t, Error, std::uint_fast64_t)
+		{
+		}
+};
+
+static const IpAddress srcAddress("10.0.0.2");
+static const IpAddress dstAddress("224.0.0.18");
+
+static std::vector<std::uint8_t> advertisement (std::uint8_t virtualRouterId, unsigned int addresses, std::uint8_t ttl)
+{
+	std::vector<std::uint8_t> packet(sizeof(iphdr) + 8 + addresses * 4);
+	iphdr *ip = reinterpret_cast<iphdr *>(&packet[0]);
+	ip->version = 4;
+	ip->ihl = 5;
+	ip->tot_len = htons(packet.size());
+	ip->ttl = ttl;
+	ip->protocol = 112;
+	std::memcpy(&ip->saddr, srcAddress.data(), 4);
+	std::memcpy(&ip->daddr, dstAddress.data(), 4);
+
+	std::uint8_t *vrrp = &packet[sizeof(iphdr)];
+	vrrp[0] = 0x31;
+	vrrp[1] = virtualRouterId;
+	vrrp[2] = 100;
+	vrrp[3] = addresses;
+	vrrp[4] = 0;
+	vrrp[5] = 100;
+	for (unsigned int i = 0; i != addresses; ++i)
+	{
+		vrrp[8 + i * 4] = 10;
+		vrrp[9 + i * 4] = virtualRouterId;
+		vrrp[10 + i * 4] = i >> 8;
+		vrrp[11 + i * 4] = i;
+	}
+	*reinterpret_cast<std::uint16_t *>(vrrp + 6) = Util::checksum(vrrp, 8 + addresses * 4, srcAddress, dstAddress, 112);
+	return packet;
+}
+
+static std::uint64_t nanoseconds ()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double run (VrrpSocket *socket, const std::vector<const std::vector<std::uint8_t> *> &packets, unsigned int count)
+{
+	std::uint64_t start = nanoseconds();
+	for (unsigned int i = 0; i != count; ++i)
+	{
+		const std::vector<std::uint8_t> &packet = *packets[i % packets.size()];
+		socket->injectPacket(&packet[0], packet.size(), 1, srcAddress, dstAddress, 0);
+	}
+	return static_cast<double>(nanoseconds() - start) / count;
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int foreignPercent = (argc > 1 ? std::atoi(argv[1]) : 90);
+	unsigned int addresses = (argc > 2 ? std::atoi(argv[2]) : 16);
+	unsigned int count = (argc > 3 ? std::atoi(argv[3]) : 5000000);
+
+	// Discarded packets are logged
+	setlogmask(LOG_UPTO(LOG_WARNING));
+
+	VrrpSocket::setIngest(VrrpSocket::ReplayIngest);
+	VrrpSocket *socket = VrrpSocket::instance(AF_INET);
+
+	// We run VRIDs 1-10, the segment carries 11-200 as well
+	Listener listener;
+	for (unsigned int id = 1; id <= 10; ++id)
+		socket->addEventListener(1, id, &listener);
+
+	std::vector<std::vector<std::uint8_t> > owned;
+	std::vector<std::vector<std::uint8_t> > foreign;
+	for (unsigned int id = 1; id <= 10; ++id)
+		owned.push_back(advertisement(id, addresses, 255));
+	for (unsigned int id = 11; id <= 200; ++id)
+		foreign.push_back(advertisement(id, addresses, 255));
+
+	std::vector<const std::vector<std::uint8_t> *> ownedMix;
+	std::vector<const std::vector<std::uint8_t> *> foreignMix;
+	std::vector<const std::vector<std::uint8_t> *> mix;
+	for (unsigned int i = 0; i != owned.size(); ++i)
+		ownedMix.push_back(&owned[i]);
+	for (unsigned int i = 0; i != foreign.size(); ++i)
+		foreignMix.push_back(&foreign[i]);
+	for (unsigned int i = 0; i != 1000; ++i)
+		mix.push_back(i % 100 < foreignPercent ? &foreign[i % foreign.size()] : &owned[i % owned.size()]);
+
+	std::cout << "Addresses per advertisement: " << addresses << ", foreign traffic: " << foreignPercent << "%" << std::endl;
+	std::cout << "Owned:   " << run(socket, ownedMix, count) << " ns/packet" << std::endl;
+	std::cout << "Foreign: " << run(socket, foreignMix, count) << " ns/packet" << std::endl;
+	std::cout << "Mix:     " << run(socket, mix, count) << " ns/packet" << std::endl;
+
+	std::cout << std::endl << "Drops by stage:" << std::endl;
+	for (int stage = 0; stage != VrrpSocket::StageCount; ++stage)
+		std::cout << " " << VrrpSocket::stageName(static_cast<VrrpSocket::Stage>(stage)) << ": " << VrrpSocket::stageDrops(static_cast<VrrpSocket::Stage>(stage)) << std::endl;
+
+	VrrpSocket::cleanup();
+	return 0;
+}
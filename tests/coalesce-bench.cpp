@@ -0,0 +1,156 @@
+/*
+ * Advertisement coalescing benchmark
+ *
+ * Simulates a number of VRRP masters with equal advertisement intervals and
+ * random start phases, scheduled like VrrpService does it, and reports
+ * wakeups, CPU usage, the largest number of advertisements sent in one
+ * wakeup and the longest time between two advertisements of a master.
+ *
+ * Usage: coalesce-bench [MASTERS] [SECONDS] [WINDOW] [PHASES]
+ *
+ * A WINDOW of 0 disables coalescing.
+ */
+
+#include "mainloop.h"
+#include "timer.h"
+
+#include <iostream>
+#include <vector>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+static const unsigned int advertisementInterval = 1000;
+
+static unsigned int window = 0;
+static unsigned int phases = 1;
+static int sinkFd = -1;
+
+static unsigned long long advertisements = 0;
+static unsigned int burst = 0;
+static unsigned int maxBurst = 0;
+static std::uint64_t burstTime = 0;
+static std::uint64_t maxGap = 0;
+
+struct Master
+{
+	Master (unsigned int index) :
+		timer(callback, this),
+		phase(index % phases),
+		last(0)
+	{
+		std::uint64_t now = Timer::now();
+		next = align(now + std::rand() % advertisementInterval + 1);
+		timer.startAt(next);
+	}
+
+	std::uint64_t align (std::uint64_t deadline) const
+	{
+		if (window == 0 || advertisementInterval % window != 0)
+			return deadline;
+		return Timer::alignDeadline(deadline, window, phase * window / phases);
+	}
+
+	static void callback (Timer *, void *userData)
+	{
+		Master *self = reinterpret_cast<Master *>(userData);
+		std::uint64_t now = Timer::now();
+
+		char packet[40] = {0};
+		send(sinkFd, packet, sizeof(packet), MSG_DONTWAIT);
+		++advertisements;
+
+		if (now != burstTime)
+		{
+			burstTime = now;
+			burst = 0;
+		}
+		if (++burst > maxBurst)
+			maxBurst = burst;
+
+		if (self->last != 0 && now - self->last > maxGap)
+			maxGap = now - self->last;
+		self->last = now;
+
+		self->next += advertisementInterval;
+		if (self->next <= now)
+			self->next += ((now - self->next) / advertisementInterval + 1) * advertisementInterval;
+		self->next = self->align(self->next);
+		self->timer.startAt(self->next);
+	}
+
+	Timer timer;
+	unsigned int phase;
+	std::uint64_t next;
+	std::uint64_t last;
+};
+
+static void drainCallback (int fd, void *)
+{
+	char buffer[64];
+	while (recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+}
+
+static void stopCallback (Timer *, void *)
+{
+	raise(SIGINT);
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int masters = (argc > 1 ? std::atoi(argv[1]) : 2000);
+	unsigned int seconds = (argc > 2 ? std::atoi(argv[2]) : 10);
+	window = (argc > 3 ? std::atoi(argv[3]) : 0);
+	phases = (argc > 4 ? std::atoi(argv[4]) : 1);
+	if (phases == 0)
+		phases = 1;
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1)
+	{
+		std::cerr << "socketpair failed: " << std::strerror(errno) << std::endl;
+		return 1;
+	}
+	sinkFd = fds[0];
+	MainLoop::addMonitor(fds[1], drainCallback, 0, MainLoop::AdminPriority);
+
+	std::cout << "Masters: " << masters << ", " << seconds << " seconds, ";
+	if (window == 0)
+		std::cout << "no coalescing" << std::endl;
+	else
+		std::cout << window << " ms window, " << phases << " phases" << std::endl;
+
+	std::vector<Master *> list;
+	for (unsigned int i = 0; i != masters; ++i)
+		list.push_back(new Master(i));
+
+	Timer stopTimer(stopCallback, 0);
+	stopTimer.start(seconds * 1000);
+
+	rusage before;
+	getrusage(RUSAGE_SELF, &before);
+
+	MainLoop::run();
+
+	rusage after;
+	getrusage(RUSAGE_SELF, &after);
+
+	for (std::vector<Master *>::const_iterator it = list.begin(); it != list.end(); ++it)
+		delete *it;
+
+	double cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_stime.tv_sec - before.ru_stime.tv_sec)
+		+ ((after.ru_utime.tv_usec - before.ru_utime.tv_usec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec)) / 1000000.0;
+
+	std::cout << "Advertisements/sec:    " << advertisements / seconds << std::endl;
+	std::cout << "Wakeups/sec:           " << (after.ru_nvcsw - before.ru_nvcsw) / seconds << std::endl;
+	std::cout << "CPU usage:             " << cpu * 100 / seconds << "%" << std::endl;
+	std::cout << "Largest burst:         " << maxBurst << " advertisements" << std::endl;
+	std::cout << "Longest interval:      " << maxGap << " ms" << std::endl;
+
+	return 0;
+}
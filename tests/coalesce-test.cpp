@@ -0,0 +1,244 @@
+/*
+ * Coalescing test
+ *
+ * Runs a number of VRRP masters on one end of a temporary veth pair with
+ * advertisement coalescing enabled, records the kernel receive time of
+ * every advertisement on the other end and checks that no two consecutive
+ * advertisements of a router are closer than the advertisement interval.
+ * Timers have a resolution of a millisecond, and the advertisement before a
+ * gap may have been late, so gaps may be short by that much.
+ * One run uses a window the interval is a multiple of, the other one a
+ * window it isn't.
+ *
+ * Usage: coalesce-test [ROUTERS] [SECONDS]
+ *
+ * Needs root and the ip command.
+ */
+
+#include "mainloop.h"
+#include "timer.h"
+#include "ipaddress.h"
+#include "ipsubnet.h"
+#include "netlink.h"
+#include "vrrpmanager.h"
+#include "vrrpservice.h"
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#include <signal.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+
+#define ROUTER_INTERFACE "vrrpcoal0"
+#define CAPTURE_INTERFACE "vrrpcoal1"
+
+static const unsigned int interval = 100; // msec
+
+static bool createInterfaces ()
+{
+	return std::system(
+			"ip link add " ROUTER_INTERFACE " type veth peer name " CAPTURE_INTERFACE " && "
+			"ip link set " CAPTURE_INTERFACE " up && "
+			"ip link set " ROUTER_INTERFACE " up && "
+			"ip addr add 10.78.0.1/24 dev " ROUTER_INTERFACE) == 0;
+}
+
+static void removeInterfaces ()
+{
+	std::system("ip link del " ROUTER_INTERFACE " 2> /dev/null");
+}
+
+static std::vector<VrrpService *> pending;
+
+static void stopCallback (Timer *, void *)
+{
+	raise(SIGINT);
+}
+
+// Spread the routers over the interval, like routers that became master at different times
+static void enableCallback (Timer *timer, void *)
+{
+	pending.back()->enable();
+	pending.pop_back();
+	if (!pending.empty())
+		timer->start(interval / pending.size() + 1);
+}
+
+static int openCapture ()
+{
+	int fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+	if (fd == -1)
+		return -1;
+
+	sockaddr_ll addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_IP);
+	addr.sll_ifindex = if_nametoindex(CAPTURE_INTERFACE);
+	int size = 8 * 1024 * 1024;
+	int on = 1;
+	if (bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1
+			|| setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1
+			|| setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Receive times of the advertisements of each router, in nanoseconds
+static std::map<unsigned int, std::vector<std::uint64_t> > collect (int fd)
+{
+	std::map<unsigned int, std::vector<std::uint64_t> > times;
+	for (;;)
+	{
+		std::uint8_t packet[1500];
+		char control[256];
+		iovec iov = {packet, sizeof(packet)};
+		msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		ssize_t size = recvmsg(fd, &msg, MSG_DONTWAIT);
+		if (size < 0)
+			break;
+
+		const iphdr *ip = reinterpret_cast<const iphdr *>(packet);
+		if (size < static_cast<ssize_t>(sizeof(iphdr) + 8) || ip->protocol != 112)
+			continue;
+		const std::uint8_t *vrrp = packet + ip->ihl * 4;
+		if (vrrp[2] == 0) // Priority 0 when shutting down
+			continue;
+
+		for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != 0; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+			{
+				timespec ts;
+				std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				times[vrrp[1]].push_back(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+			}
+		}
+	}
+	return times;
+}
+
+static bool run (int interface, unsigned int routers, unsigned int seconds, unsigned int window, unsigned int phases)
+{
+	int fd = openCapture();
+	if (fd == -1)
+	{
+		std::cerr << "Unable to create packet socket" << std::endl;
+		return false;
+	}
+
+	VrrpService::setCoalescing(window, phases);
+	std::vector<VrrpService *> services;
+	for (unsigned int id = 1; id <= routers; ++id)
+	{
+		VrrpService *service = VrrpManager::getService(interface, id, 0, AF_INET, true);
+		if (service == 0)
+		{
+			std::cerr << "Unable to create router" << std::endl;
+			close(fd);
+			return false;
+		}
+		char address[32];
+		std::sprintf(address, "10.78.1.%u", id);
+		service->addIpAddress(IpSubnet(IpAddress(address)));
+		service->setAdvertisementInterval(interval / 10);
+		service->setPriority(255);
+		services.push_back(service);
+	}
+	pending = services;
+
+	Timer enableTimer(enableCallback, 0);
+	enableTimer.start(interval / routers + 1);
+	Timer stopTimer(stopCallback, 0);
+	stopTimer.start(seconds * 1000);
+	MainLoop::run();
+	for (std::vector<VrrpService *>::const_iterator service = services.begin(); service != services.end(); ++service)
+		VrrpManager::removeService(*service);
+
+	std::map<unsigned int, std::vector<std::uint64_t> > times = collect(fd);
+	close(fd);
+
+	std::uint64_t minGap = ~0ULL;
+	std::uint64_t maxGap = 0;
+	unsigned int count = 0;
+	std::set<std::uint64_t> ticks;
+	for (std::map<unsigned int, std::vector<std::uint64_t> >::const_iterator router = times.begin(); router != times.end(); ++router)
+	{
+		for (std::size_t i = 0; i != router->second.size(); ++i)
+		{
+			++count;
+			ticks.insert(router->second[i] / 1000000);
+			if (i == 0)
+				continue;
+			std::uint64_t gap = router->second[i] - router->second[i - 1];
+			if (gap < minGap)
+				minGap = gap;
+			if (gap > maxGap)
+				maxGap = gap;
+		}
+	}
+
+	std::uint64_t tolerance = 1000000 + Timer::lateness().max();
+
+	std::cout << "Window " << window << " msec, " << phases << " phase(s): " << count << " advertisements in " << ticks.size() << " milliseconds, gap min / max: "
+		<< minGap / 1000 << " / " << maxGap / 1000 << " usec, tolerance " << tolerance / 1000 << " usec" << std::endl;
+
+	if (times.size() != routers || count < routers * seconds * 1000 / interval / 2)
+	{
+		std::cout << "Not all routers advertised" << std::endl;
+		return false;
+	}
+	if (minGap + tolerance < interval * 1000000ULL)
+	{
+		std::cout << "Advertisements closer than the interval" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int routers = (argc > 1 ? std::atoi(argv[1]) : 20);
+	unsigned int seconds = (argc > 2 ? std::atoi(argv[2]) : 3);
+
+	openlog("coalesce-test", LOG_PERROR, LOG_USER);
+	setlogmask(LOG_UPTO(LOG_WARNING));
+
+	removeInterfaces();
+	if (!createInterfaces())
+	{
+		std::cerr << "Unable to create veth pair" << std::endl;
+		return 1;
+	}
+	std::atexit(removeInterfaces);
+
+	int interface = if_nametoindex(ROUTER_INTERFACE);
+	for (unsigned int i = 0; i != 50 && !Netlink::isInterfaceUp(interface); ++i)
+		usleep(20000);
+
+	bool ok = run(interface, routers, seconds, 50, 2); // Interval is a multiple of the window
+	ok &= run(interface, routers, seconds, 30, 1); // It isn't
+
+	std::cout << (ok ? "OK" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
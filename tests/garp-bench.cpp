@@ -0,0 +1,100 @@
+/*
+ * Gratuitous ARP benchmark
+ *
+ * Measures how long it takes a new master to announce its virtual addresses,
+ * which is on the critical path of every failover.
+ *
+ * Usage: garp-bench INTERFACE [ADDRESSES] [ROUNDS] [oneshot]
+ *
+ * The addresses are announced the way VRRP services do it, through a
+ * transmitter kept open with ArpSocket::addInterface(). With "oneshot", every
+ * address is sent on its own socket, as it was done before.
+ *
+ * Must be run as root.
+ */
+
+#include "arpsocket.h"
+#include "ipaddress.h"
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#include <syslog.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+static std::uint64_t nanoseconds ()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main (int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " INTERFACE [ADDRESSES] [ROUNDS] [oneshot]" << std::endl;
+		return 1;
+	}
+
+	unsigned int interface = if_nametoindex(argv[1]);
+	unsigned int addressCount = (argc > 2 ? std::atoi(argv[2]) : 200);
+	unsigned int rounds = (argc > 3 ? std::atoi(argv[3]) : 100);
+	bool oneshot = (argc > 4 && std::strcmp(argv[4], "oneshot") == 0);
+	if (interface == 0)
+	{
+		std::cerr << "Invalid interface" << std::endl;
+		return 1;
+	}
+
+	setlogmask(LOG_UPTO(LOG_ERR));
+
+	IpAddressSet addresses;
+	for (unsigned int i = 0; i != addressCount; ++i)
+	{
+		in_addr address;
+		address.s_addr = htonl(0x0A0A0001 + i);
+		addresses.insert(IpAddress(&address, AF_INET));
+	}
+
+	if (!oneshot && !ArpSocket::addInterface(interface))
+	{
+		std::cerr << "Unable to open ARP socket" << std::endl;
+		return 1;
+	}
+
+	std::vector<std::uint64_t> durations;
+	for (unsigned int round = 0; round != rounds; ++round)
+	{
+		std::uint64_t start = nanoseconds();
+		if (oneshot)
+		{
+			for (IpAddressSet::const_iterator address = addresses.begin(); address != addresses.end(); ++address)
+				ArpSocket::sendGratuitiousArp(interface, *address);
+		}
+		else
+			ArpSocket::sendGratuitiousArps(interface, addresses);
+		durations.push_back(nanoseconds() - start);
+	}
+
+	std::uint64_t total = 0;
+	std::uint64_t max = 0;
+	for (std::vector<std::uint64_t>::const_iterator it = durations.begin(); it != durations.end(); ++it)
+	{
+		total += *it;
+		if (*it > max)
+			max = *it;
+	}
+
+	if (!oneshot)
+		ArpSocket::removeInterface(interface);
+
+	std::cout << addressCount << " addresses, " << rounds << " rounds, " << (oneshot ? "socket per address" : "persistent socket") << std::endl;
+	std::cout << "Time to announce all addresses (avg / max): " << total / rounds / 1000 << " / " << max / 1000 << " usec" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Histogram test
+ *
+ * Checks that recorded values land in buckets whose bounds are within the
+ * promised relative error, and that percentiles of known distributions come
+ * out right.
+ *
+ * Usage: histogram-test
+ */
+
+#include "histogram.h"
+
+#include <iostream>
+#include <cstdlib>
+
+static int failures = 0;
+
+static void check (bool condition, const char *what, std::uint64_t value)
+{
+	if (!condition)
+	{
+		std::cerr << "FAIL: " << what << " (" << value << ")" << std::endl;
+		++failures;
+	}
+}
+
+int main ()
+{
+	// Every value must come back as a bound no smaller than itself and at most 1/8 larger
+	for (std::uint64_t value = 1; value < (static_cast<std::uint64_t>(1) << 62); value = value * 3 / 2 + 1)
+	{
+		Histogram histogram;
+		histogram.add(value);
+		histogram.add(value * 2); // Keeps max from clamping the bound
+		std::uint64_t bound = histogram.percentile(50);
+		check(bound >= value, "bound below value", value);
+		check(bound - value <= value / 8, "bound too far above value", value);
+	}
+
+	Histogram uniform;
+	for (std::uint64_t value = 1; value <= 100000; ++value)
+		uniform.add(value);
+	check(uniform.count() == 100000, "count", uniform.count());
+	check(uniform.max() == 100000, "max", uniform.max());
+	check(uniform.percentile(50) >= 50000 && uniform.percentile(50) <= 50000 * 9 / 8, "p50", uniform.percentile(50));
+	check(uniform.percentile(99) >= 99000 && uniform.percentile(99) <= 100000, "p99", uniform.percentile(99));
+	check(uniform.percentile(100) == 100000, "p100", uniform.percentile(100));
+
+	Histogram empty;
+	check(empty.percentile(99) == 0, "empty percentile", empty.percentile(99));
+
+	uniform.reset();
+	check(uniform.count() == 0 && uniform.max() == 0, "reset", uniform.count());
+
+	if (failures == 0)
+		std::cout << "All tests passed" << std::endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+/*
+ * Listener lookup benchmark
+ *
+ * Compares the nested std::map that VrrpSocket used to find the listener of
+ * a packet with VrrpListenerTable, for both single lookups and the "notify
+ * all listeners of the interface" error paths.
+ *
+ * Usage: listener-bench [INTERFACES] [VRIDS] [LOOKUPS]
+ */
+
+#include "vrrpeventlistener.h"
+#include "vrrplistenertable.h"
+
+#include <iostream>
+#include <map>
+#include <vector>
+#include <cstdlib>
+
+#include <time.h>
+
+typedef std::map<unsigned int, std::map<std::uint_fast8_t, VrrpEventListener *> > EventListenerMap;
+
+class Listener : public VrrpEventListener
+{
+	public:
+		virtual void onIncomingVrrpPacket (unsigned int, const IpAddress &, std::uint_fast8_t, std::uint_fast8_t, std::uint_fast16_t, const IpAddressListView &, std::uint64_t)
+		{
+		}
+
+		virtual void onIncomingVrrpError (unsigned int, std::uint_fast8_t, Error, std::uint_fast64_t)
+		{
+			++errors;
+		}
+
+		unsigned long long errors;
+};
+
+static double now ()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int interfaces = (argc > 1 ? std::atoi(argv[1]) : 64);
+	unsigned int vrids = (argc > 2 ? std::atoi(argv[2]) : 255);
+	unsigned int lookups = (argc > 3 ? std::atoi(argv[3]) : 10000000);
+
+	std::cout << "Interfaces: " << interfaces << ", VRIDs: " << vrids << ", lookups: " << lookups << std::endl;
+
+	// Interface indexes are sparse in practice
+	std::vector<unsigned int> indexes;
+	for (unsigned int i = 0; i != interfaces; ++i)
+		indexes.push_back(2 + i * 3);
+
+	std::vector<Listener> listeners(interfaces * vrids);
+	EventListenerMap map;
+	VrrpListenerTable table;
+	for (unsigned int i = 0; i != interfaces; ++i)
+	{
+		for (unsigned int vrid = 1; vrid <= vrids; ++vrid)
+		{
+			Listener *listener = &listeners[i * vrids + vrid - 1];
+			listener->errors = 0;
+			map[indexes[i]][vrid] = listener;
+			table.add(indexes[i], vrid, listener);
+		}
+	}
+
+	// Packets from random interfaces for random virtual routers
+	std::vector<std::pair<unsigned int, std::uint_fast8_t> > packets(4096);
+	for (std::size_t i = 0; i != packets.size(); ++i)
+		packets[i] = std::make_pair(indexes[std::rand() % interfaces], 1 + std::rand() % vrids);
+
+	std::size_t mask = packets.size() - 1;
+	std::uintptr_t sum = 0;
+
+	double start = now();
+	for (unsigned int i = 0; i != lookups; ++i)
+	{
+		const std::pair<unsigned int, std::uint_fast8_t> &packet = packets[i & mask];
+		EventListenerMap::const_iterator interfaceListenerMap = map.find(packet.first);
+		if (interfaceListenerMap == map.end())
+			continue;
+		EventListenerMap::mapped_type::const_iterator listener = interfaceListenerMap->second.find(packet.second);
+		if (listener != interfaceListenerMap->second.end())
+			sum += reinterpret_cast<std::uintptr_t>(listener->second);
+	}
+	double mapLookup = (now() - start) * 1e9 / lookups;
+
+	start = now();
+	for (unsigned int i = 0; i != lookups; ++i)
+	{
+		const std::pair<unsigned int, std::uint_fast8_t> &packet = packets[i & mask];
+		VrrpEventListener *listener = table.find(packet.first, packet.second);
+		if (listener != 0)
+			sum += reinterpret_cast<std::uintptr_t>(listener);
+	}
+	double tableLookup = (now() - start) * 1e9 / lookups;
+
+	unsigned int notifications = lookups / vrids;
+
+	start = now();
+	for (unsigned int i = 0; i != notifications; ++i)
+	{
+		EventListenerMap::const_iterator interfaceListenerMap = map.find(packets[i & mask].first);
+		for (EventListenerMap::mapped_type::const_iterator listener = interfaceListenerMap->second.begin(); listener != interfaceListenerMap->second.end(); ++listener)
+			listener->second->onIncomingVrrpError(interfaceListenerMap->first, listener->first, VrrpEventListener::VrIdError, 1);
+	}
+	double mapNotify = (now() - start) * 1e9 / notifications;
+
+	start = now();
+	for (unsigned int i = 0; i != notifications; ++i)
+	{
+		const VrrpListenerTable::Interface *interface = table.find(packets[i & mask].first);
+		for (unsigned int j = 0; j != interface->count; ++j)
+			interface->listeners[interface->ids[j]]->onIncomingVrrpError(interface->interface, interface->ids[j], VrrpEventListener::VrIdError, 1);
+	}
+	double tableNotify = (now() - start) * 1e9 / notifications;
+
+	std::cout << "Lookup (ns):           map " << mapLookup << ", table " << tableLookup << std::endl;
+	std::cout << "Notify all (ns):       map " << mapNotify << ", table " << tableNotify << std::endl;
+
+	return (sum == 0 ? 1 : 0);
+}
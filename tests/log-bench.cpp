@@ -0,0 +1,60 @@
+/*
+ * Logging benchmark
+ *
+ * Logs a flood of messages from one call site, like a flood of malformed
+ * packets does, and reports the time spent in the caller per message: with
+ * syslog() directly, with Log without rate limiting and with Log at its
+ * default rate limit. Messages go to stderr as well, so run it with
+ * 2>/dev/null.
+ *
+ * Usage: log-bench [MESSAGES]
+ */
+
+#include "log.h"
+
+#include <iostream>
+#include <cstdlib>
+
+#include <time.h>
+
+static double seconds ()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void report (const char *name, unsigned int messages, double elapsed)
+{
+	std::cout << name << elapsed * 1000000000 / messages << " ns/message in caller, " << Log::dropped() << " dropped so far" << std::endl;
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int messages = (argc > 1 ? std::atoi(argv[1]) : 100000);
+	std::cout << "Messages: " << messages << std::endl;
+
+	openlog("log-bench", LOG_PERROR, LOG_USER);
+	double start = seconds();
+	for (unsigned int i = 0; i != messages; ++i)
+		syslog(LOG_DEBUG, "Packet from interface %i", static_cast<int>(i));
+	report("syslog():        ", messages, seconds() - start);
+
+	Log::open("log-bench", LOG_PERROR, LOG_USER);
+	Log::setRateLimit(0, 0);
+	start = seconds();
+	for (unsigned int i = 0; i != messages; ++i)
+		LOG(LOG_DEBUG, "Packet from interface %i", static_cast<int>(i));
+	report("Log, no limit:   ", messages, seconds() - start);
+	Log::close();
+
+	Log::open("log-bench", LOG_PERROR, LOG_USER);
+	Log::setRateLimit(50, 500);
+	start = seconds();
+	for (unsigned int i = 0; i != messages; ++i)
+		LOG(LOG_DEBUG, "Packet from interface %i", static_cast<int>(i));
+	report("Log, 50/s limit: ", messages, seconds() - start);
+	Log::close();
+
+	return 0;
+}
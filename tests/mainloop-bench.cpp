@@ -0,0 +1,108 @@
+/*
+ * Main loop benchmark
+ *
+ * Measures the cost of adding and removing monitors and of dispatching
+ * events with a large number of file descriptors registered.
+ *
+ * Usage: mainloop-bench [FDS] [ROUNDS]
+ */
+
+#include "mainloop.h"
+
+#include <iostream>
+#include <vector>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+static unsigned long long dispatched = 0;
+static unsigned long long dispatchLimit = 0;
+
+static double now ()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void idleCallback (int, void *)
+{
+}
+
+static void readyCallback (int, void *)
+{
+	// The eventfd is never read, so it stays readable and is reported on every epoll_wait
+	if (++dispatched == dispatchLimit)
+		raise(SIGINT);
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int fdCount = (argc > 1 ? std::atoi(argv[1]) : 10000);
+	unsigned int rounds = (argc > 2 ? std::atoi(argv[2]) : 10);
+
+	rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	std::vector<int> fds(fdCount);
+	for (unsigned int i = 0; i != fdCount; ++i)
+	{
+		fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fds[i] == -1)
+		{
+			std::cerr << "eventfd failed: " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+	}
+
+	// Add / remove
+	double addTime = 0;
+	double removeTime = 0;
+	for (unsigned int round = 0; round != rounds; ++round)
+	{
+		double start = now();
+		for (unsigned int i = 0; i != fdCount; ++i)
+			MainLoop::addMonitor(fds[i], idleCallback, 0);
+		addTime += now() - start;
+
+		start = now();
+		for (unsigned int i = 0; i != fdCount; ++i)
+			MainLoop::removeMonitor(fds[i]);
+		removeTime += now() - start;
+	}
+
+	std::cout << "Monitors:         " << fdCount << std::endl;
+	std::cout << "Add:              " << addTime * 1e9 / (double(fdCount) * rounds) << " ns/monitor" << std::endl;
+	std::cout << "Remove:           " << removeTime * 1e9 / (double(fdCount) * rounds) << " ns/monitor" << std::endl;
+
+	// Dispatch
+	for (unsigned int i = 0; i != fdCount; ++i)
+	{
+		std::uint64_t value = 1;
+		write(fds[i], &value, sizeof(value));
+		MainLoop::addMonitor(fds[i], readyCallback, 0);
+	}
+
+	dispatchLimit = static_cast<unsigned long long>(fdCount) * rounds;
+	double start = now();
+	MainLoop::run();
+	double dispatchTime = now() - start;
+
+	std::cout << "Dispatch:         " << dispatchTime * 1e9 / dispatched << " ns/event" << std::endl;
+
+	for (unsigned int i = 0; i != fdCount; ++i)
+	{
+		MainLoop::removeMonitor(fds[i]);
+		close(fds[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Malformed packet test
+ *
+ * Feeds truncated and inconsistent IPv6 packets through the validation
+ * stages of VrrpSocket, the way the packet ring and the replay tool do, and
+ * checks that each one is dropped as a header error without reading past the
+ * end of the buffer. Build with -fsanitize=address to catch overreads.
+ *
+ * Usage: malformed-test
+ */
+
+#include "ipaddress.h"
+#include "util.h"
+#include "vrrpsocket.h"
+#include "vrrpeventlistener.h"
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+
+#include <syslog.h>
+#include <arpa/inet.h>
+#include <netinet/ip6.h>
+
+class Listener : public VrrpEventListener
+{
+	public:
+		Listener () :
+			packets(0),
+			lengthErrors(0)
+		{
+		}
+
+		virtual void onIncomingVrrpPacket (unsigned int, const IpAddress &, std::uint_fast8_t, std::uint_fast8_t, std::uint_fast16_t, const IpAddressListView &, std::uint64_t)
+		{
+			++packets;
+		}
+
+		virtual void onIncomingVrrpError (unsigned int, std::uint_fast8_t, Error error, std::uint_fast64_t count)
+		{
+			if (error == PacketLengthError)
+				lengthErrors += count;
+		}
+
+		unsigned int packets;
+		unsigned int lengthErrors;
+};
+
+static const IpAddress srcAddress("fe80::2");
+static const IpAddress dstAddress("ff02::12");
+
+static int failures = 0;
+
+static void check (bool condition, const char *what)
+{
+	if (!condition)
+	{
+		std::cerr << "FAIL: " << what << std::endl;
+		++failures;
+	}
+}
+
+// IPv6 header, the given extension headers and an advertisement with one address
+static std::vector<std::uint8_t> packet (const std::vector<std::uint8_t> &extensions, std::uint8_t firstHeader)
+{
+	std::vector<std::uint8_t> vrrp(8 + 16);
+	vrrp[0] = 0x31;
+	vrrp[1] = 1;
+	vrrp[2] = 100;
+	vrrp[3] = 1;
+	vrrp[5] = 100;
+	std::memcpy(&vrrp[8], IpAddress("fe80::1").data(), 16);
+	*reinterpret_cast<std::uint16_t *>(&vrrp[6]) = Util::checksum(&vrrp[0], vrrp.size(), srcAddress, dstAddress, 112);
+
+	std::vector<std::uint8_t> buffer(sizeof(ip6_hdr) + extensions.size() + vrrp.size());
+	if (!extensions.empty())
+		std::memcpy(&buffer[sizeof(ip6_hdr)], &extensions[0], extensions.size());
+	std::memcpy(&buffer[sizeof(ip6_hdr) + extensions.size()], &vrrp[0], vrrp.size());
+
+	ip6_hdr *ip = reinterpret_cast<ip6_hdr *>(&buffer[0]);
+	ip->ip6_flow = htonl(0x60000000);
+	ip->ip6_plen = htons(buffer.size() - sizeof(ip6_hdr));
+	ip->ip6_nxt = firstHeader;
+	ip->ip6_hops = 255;
+	std::memcpy(&ip->ip6_src, srcAddress.data(), 16);
+	std::memcpy(&ip->ip6_dst, dstAddress.data(), 16);
+	return buffer;
+}
+
+// Hop-by-hop options header of (length + 1) * 8 bytes, padded with PadN
+static std::vector<std::uint8_t> hopByHop (std::uint8_t next, std::uint8_t length)
+{
+	std::vector<std::uint8_t> header((length + 1) * 8);
+	header[0] = next;
+	header[1] = length;
+	header[2] = 1; // PadN
+	header[3] = header.size() - 4;
+	return header;
+}
+
+static void expectDrop (VrrpSocket *socket, Listener &listener, const std::vector<std::uint8_t> &buffer, std::size_t size, bool lengthError, const char *what)
+{
+	std::uint_fast64_t drops = VrrpSocket::stageDrops(VrrpSocket::HeaderStage);
+	unsigned int packets = listener.packets;
+	unsigned int lengthErrors = listener.lengthErrors;
+
+	// Copy to a buffer of exactly the given size, so overreads leave the allocation
+	std::uint8_t *copy = new std::uint8_t[size];
+	std::memcpy(copy, &buffer[0], size);
+	bool accepted = socket->injectPacket(copy, size, 1, srcAddress, dstAddress, 0);
+	delete[] copy;
+
+	check(!accepted && listener.packets == packets, what);
+	check(VrrpSocket::stageDrops(VrrpSocket::HeaderStage) == drops + 1, what);
+	check(listener.lengthErrors == lengthErrors + (lengthError ? 1 : 0), what);
+}
+
+int main ()
+{
+	setlogmask(LOG_UPTO(LOG_WARNING));
+
+	VrrpSocket::setIngest(VrrpSocket::ReplayIngest);
+	VrrpSocket *socket = VrrpSocket::instance(AF_INET6);
+
+	Listener listener;
+	socket->addEventListener(1, 1, &listener);
+
+	// Well-formed packets, with and without an extension header, must still pass
+	std::vector<std::uint8_t> plain = packet(std::vector<std::uint8_t>(), 112);
+	socket->injectPacket(&plain[0], plain.size(), 1, srcAddress, dstAddress, 0);
+	check(listener.packets == 1, "valid packet rejected");
+
+	std::vector<std::uint8_t> extended = packet(hopByHop(112, 0), 0);
+	socket->injectPacket(&extended[0], extended.size(), 1, srcAddress, dstAddress, 0);
+	check(listener.packets == 2, "valid packet with extension header rejected");
+
+	std::vector<std::uint8_t> longExtension = packet(hopByHop(112, 2), 0);
+	socket->injectPacket(&longExtension[0], longExtension.size(), 1, srcAddress, dstAddress, 0);
+	check(listener.packets == 3, "valid packet with 24 byte extension header rejected");
+
+	// Shorter than the fixed header
+	expectDrop(socket, listener, plain, 20, false, "truncated IPv6 header");
+
+	// Payload length beyond the end of the buffer
+	expectDrop(socket, listener, plain, plain.size() - 1, true, "payload length beyond buffer");
+
+	// Extension header longer than the payload
+	std::vector<std::uint8_t> overlong = packet(hopByHop(112, 0), 0);
+	overlong[sizeof(ip6_hdr) + 1] = 200;
+	expectDrop(socket, listener, overlong, overlong.size(), true, "extension header beyond payload");
+
+	// Chain of extension headers that never reaches VRRP
+	std::vector<std::uint8_t> chain;
+	for (int i = 0; i != 8; ++i)
+	{
+		std::vector<std::uint8_t> header = hopByHop(0, 0);
+		chain.insert(chain.end(), header.begin(), header.end());
+	}
+	std::vector<std::uint8_t> endless = packet(chain, 0);
+	endless.resize(sizeof(ip6_hdr) + chain.size());
+	reinterpret_cast<ip6_hdr *>(&endless[0])->ip6_plen = htons(chain.size());
+	expectDrop(socket, listener, endless, endless.size(), true, "extension headers without VRRP");
+
+	// Payload ends in the middle of the two byte extension header prefix
+	std::vector<std::uint8_t> split = packet(hopByHop(112, 0), 0);
+	split.resize(sizeof(ip6_hdr) + 1);
+	reinterpret_cast<ip6_hdr *>(&split[0])->ip6_plen = htons(1);
+	expectDrop(socket, listener, split, split.size(), true, "split extension header");
+
+	VrrpSocket::cleanup();
+
+	if (failures == 0)
+		std::cout << "All tests passed" << std::endl;
+	return failures == 0 ? 0 : 1;
+}
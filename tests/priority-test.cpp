@@ -0,0 +1,347 @@
+/*
+ * Main loop priority test
+ *
+ * Runs a number of VRRP masters on one end of a temporary veth pair while
+ * telnet clients on loopback keep the admin class busy with "show router"
+ * commands, each client sending the next command as soon as the prompt of
+ * the previous one arrives. The kernel receive time of every advertisement
+ * is recorded on the other end of the pair, and its lateness is measured
+ * against the schedule of its router.
+ *
+ * With the low priority budget, an advertisement can only wait for the
+ * budget, the admin callback that was running when it ran out, and the
+ * millisecond resolution of the timers. The 99th percentile of the lateness
+ * must stay within that. The flood is repeated without a budget for
+ * comparison, which is what arrival order dispatch used to give.
+ *
+ * Usage: priority-test [CONNECTIONS] [SECONDS]
+ *
+ * Needs root and the ip command.
+ */
+
+#include "mainloop.h"
+#include "timer.h"
+#include "ipaddress.h"
+#include "ipsubnet.h"
+#include "netlink.h"
+#include "telnetserver.h"
+#include "vrrpmanager.h"
+#include "vrrpservice.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <poll.h>
+#include <signal.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define ROUTER_INTERFACE "vrrpprio0"
+#define CAPTURE_INTERFACE "vrrpprio1"
+#define TELNET_ADDRESS "127.0.0.1:17777"
+#define PROMPT "OpenVRRP> "
+
+static const unsigned int routers = 10;
+static const unsigned int interval = 100; // msec
+static const unsigned int budget = 2000; // usec
+
+static bool createInterfaces ()
+{
+	return std::system(
+			"ip link add " ROUTER_INTERFACE " type veth peer name " CAPTURE_INTERFACE " && "
+			"ip link set " CAPTURE_INTERFACE " up && "
+			"ip link set " ROUTER_INTERFACE " up && "
+			"ip addr add 10.79.0.1/24 dev " ROUTER_INTERFACE) == 0;
+}
+
+static void removeInterfaces ()
+{
+	std::system("ip link del " ROUTER_INTERFACE " 2> /dev/null");
+}
+
+static void stopCallback (Timer *, void *)
+{
+	raise(SIGINT);
+}
+
+/*
+   Telnet clients, run in a child process. Each connection has one command in
+   flight at a time, so every callback of a session handles a single command.
+   Nothing here allocates, as the parent may have other threads
+*/
+static void flood (unsigned int connections)
+{
+	static pollfd fds[256];
+	static char tail[256][sizeof(PROMPT) - 1];
+	static const char command[] = "show router\n";
+
+	IpAddress address(TELNET_ADDRESS);
+	for (unsigned int i = 0; i != connections; ++i)
+	{
+		fds[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+		fds[i].events = POLLIN;
+		if (fds[i].fd == -1 || connect(fds[i].fd, address.socketAddress(), address.socketAddressSize()) == -1)
+			_exit(1);
+		std::memset(tail[i], 0, sizeof(tail[i]));
+	}
+
+	for (;;)
+	{
+		if (poll(fds, connections, -1) == -1)
+			continue;
+
+		for (unsigned int i = 0; i != connections; ++i)
+		{
+			if ((fds[i].revents & POLLIN) == 0)
+				continue;
+
+			char buffer[16384];
+			ssize_t size = read(fds[i].fd, buffer, sizeof(buffer));
+			if (size <= 0)
+				_exit(0);
+
+			// The session writes its output in small pieces, so acknowledge right away or Nagle holds back the prompt
+			int on = 1;
+			setsockopt(fds[i].fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+
+			// Keep the last bytes received, to spot the prompt even when it is split over reads
+			if (static_cast<std::size_t>(size) >= sizeof(tail[i]))
+				std::memcpy(tail[i], buffer + size - sizeof(tail[i]), sizeof(tail[i]));
+			else
+			{
+				std::memmove(tail[i], tail[i] + size, sizeof(tail[i]) - size);
+				std::memcpy(tail[i] + sizeof(tail[i]) - size, buffer, size);
+			}
+
+			if (std::memcmp(tail[i], PROMPT, sizeof(tail[i])) == 0)
+			{
+				std::memset(tail[i], 0, sizeof(tail[i]));
+				write(fds[i].fd, command, sizeof(command) - 1);
+			}
+		}
+	}
+}
+
+static int openCapture ()
+{
+	int fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+	if (fd == -1)
+		return -1;
+
+	sockaddr_ll addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_IP);
+	addr.sll_ifindex = if_nametoindex(CAPTURE_INTERFACE);
+	int size = 8 * 1024 * 1024;
+	int on = 1;
+	if (bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1
+			|| setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1
+			|| setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Receive times of the advertisements of each router, in nanoseconds
+static std::map<unsigned int, std::vector<std::uint64_t> > collect (int fd)
+{
+	std::map<unsigned int, std::vector<std::uint64_t> > times;
+	for (;;)
+	{
+		std::uint8_t packet[1500];
+		char control[256];
+		iovec iov = {packet, sizeof(packet)};
+		msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		ssize_t size = recvmsg(fd, &msg, MSG_DONTWAIT);
+		if (size < 0)
+			break;
+
+		const iphdr *ip = reinterpret_cast<const iphdr *>(packet);
+		if (size < static_cast<ssize_t>(sizeof(iphdr) + 8) || ip->protocol != 112)
+			continue;
+		const std::uint8_t *vrrp = packet + ip->ihl * 4;
+		if (vrrp[2] == 0) // Priority 0 when disabled
+			continue;
+
+		for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != 0; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+			{
+				timespec ts;
+				std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				times[vrrp[1]].push_back(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+			}
+		}
+	}
+	return times;
+}
+
+/*
+   Advertisements are due on a fixed grid of intervals. Each one is matched to
+   the nearest grid point, and the grid is anchored so the most punctual
+   advertisement of the router is on time
+*/
+static std::vector<std::uint64_t> lateness (const std::map<unsigned int, std::vector<std::uint64_t> > &times)
+{
+	const std::int64_t period = interval * 1000000LL;
+	std::vector<std::uint64_t> result;
+	for (std::map<unsigned int, std::vector<std::uint64_t> >::const_iterator router = times.begin(); router != times.end(); ++router)
+	{
+		const std::vector<std::uint64_t> &list = router->second;
+		std::vector<std::int64_t> offsets;
+		for (std::size_t i = 0; i != list.size(); ++i)
+		{
+			std::int64_t elapsed = list[i] - list[0];
+			offsets.push_back(elapsed - (elapsed + period / 2) / period * period);
+		}
+
+		std::int64_t anchor = *std::min_element(offsets.begin(), offsets.end());
+		for (std::size_t i = 0; i != offsets.size(); ++i)
+			result.push_back(offsets[i] - anchor);
+	}
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+static bool run (const std::vector<VrrpService *> &services, unsigned int connections, unsigned int seconds, unsigned int lowPriorityBudget, std::uint64_t *p99)
+{
+	int fd = openCapture();
+	if (fd == -1)
+	{
+		std::cerr << "Unable to create packet socket" << std::endl;
+		return false;
+	}
+
+	TelnetServer server(IpAddress(TELNET_ADDRESS));
+	if (!server.start())
+	{
+		close(fd);
+		return false;
+	}
+
+	MainLoop::setLowPriorityBudget(lowPriorityBudget);
+	std::uint64_t commands = MainLoop::callbackDurations(MainLoop::AdminPriority).count();
+
+	for (std::vector<VrrpService *>::const_iterator service = services.begin(); service != services.end(); ++service)
+		(*service)->enable();
+
+	pid_t child = fork();
+	if (child == 0)
+		flood(connections);
+
+	Timer stopTimer(stopCallback, 0);
+	stopTimer.start(seconds * 1000);
+	MainLoop::run();
+
+	kill(child, SIGKILL);
+	waitpid(child, 0, 0);
+	server.stop();
+	for (std::vector<VrrpService *>::const_iterator service = services.begin(); service != services.end(); ++service)
+		(*service)->disable();
+
+	commands = MainLoop::callbackDurations(MainLoop::AdminPriority).count() - commands;
+	std::map<unsigned int, std::vector<std::uint64_t> > times = collect(fd);
+	close(fd);
+
+	std::vector<std::uint64_t> late = lateness(times);
+	if (times.size() != services.size() || late.size() < services.size() * seconds * 1000 / interval / 2)
+	{
+		std::cout << "Not all routers advertised" << std::endl;
+		return false;
+	}
+
+	*p99 = late[late.size() * 99 / 100];
+	std::cout << "Budget " << lowPriorityBudget << " usec: " << commands / seconds << " admin callbacks/sec, "
+		<< late.size() << " advertisements, lateness p50 " << late[late.size() / 2] / 1000
+		<< " us, p99 " << *p99 / 1000 << " us, max " << late.back() / 1000 << " us" << std::endl;
+	return true;
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int connections = (argc > 1 ? std::atoi(argv[1]) : 32);
+	unsigned int seconds = (argc > 2 ? std::atoi(argv[2]) : 3);
+	if (connections > 256)
+		connections = 256;
+
+	openlog("priority-test", LOG_PERROR, LOG_USER);
+	setlogmask(LOG_UPTO(LOG_WARNING));
+	signal(SIGPIPE, SIG_IGN);
+
+	removeInterfaces();
+	if (!createInterfaces())
+	{
+		std::cerr << "Unable to create veth pair" << std::endl;
+		return 1;
+	}
+	std::atexit(removeInterfaces);
+
+	int interface = if_nametoindex(ROUTER_INTERFACE);
+	for (unsigned int i = 0; i != 50 && !Netlink::isInterfaceUp(interface); ++i)
+		usleep(20000);
+
+	std::vector<VrrpService *> services;
+	for (unsigned int id = 1; id <= routers; ++id)
+	{
+		VrrpService *service = VrrpManager::getService(interface, id, 0, AF_INET, true);
+		if (service == 0)
+		{
+			std::cerr << "Unable to create router" << std::endl;
+			return 1;
+		}
+		char address[32];
+		std::sprintf(address, "10.79.1.%u", id);
+		service->addIpAddress(IpSubnet(IpAddress(address)));
+		service->setAdvertisementInterval(interval / 10);
+		service->setPriority(255);
+		services.push_back(service);
+	}
+
+	std::cout << "Flooding with " << connections << " telnet connections for " << seconds << " seconds" << std::endl;
+
+	std::uint64_t p99;
+	std::uint64_t unbudgetedP99;
+	bool ok = run(services, connections, seconds, budget, &p99);
+
+	// The longest admin callbacks so far are from the budgeted run, as it went first
+	std::uint64_t longest = MainLoop::callbackDurations(MainLoop::AdminPriority).percentile(99);
+	std::uint64_t bound = budget * 1000ULL + longest + 1000000;
+
+	ok &= run(services, connections, seconds, 1000000, &unbudgetedP99);
+
+	for (std::vector<VrrpService *>::const_iterator service = services.begin(); service != services.end(); ++service)
+		VrrpManager::removeService(*service);
+
+	std::cout << "Lateness bound: budget " << budget << " us + admin callback p99 " << longest / 1000 << " us + 1000 us timer resolution = " << bound / 1000 << " us" << std::endl;
+	if (ok && p99 > bound)
+	{
+		std::cout << "Advertisements later than the budget allows" << std::endl;
+		ok = false;
+	}
+
+	std::cout << (ok ? "OK" : "FAILED") << std::endl;
+	return ok ? 0 : 1;
+}
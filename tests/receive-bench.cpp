@@ -0,0 +1,201 @@
+/*
+ * VRRP receive benchmark
+ *
+ * A child process floods the loopback interface with valid VRRP
+ * advertisements in bursts, while the parent receives them either through
+ * VrrpSocket, with VrrpSocket reading a TPACKET_V3 ring, or with one recvmsg
+ * per wakeup like VrrpSocket used to.
+ * Reports packets processed per second, wakeups and CPU usage of the
+ * receiver.
+ *
+ * Usage: receive-bench [BURST] [SECONDS] [BATCH|single|ring]
+ *
+ * BURST packets are sent every millisecond.
+ */
+
+#include "mainloop.h"
+#include "timer.h"
+#include "util.h"
+#include "ipaddress.h"
+#include "vrrpsocket.h"
+#include "vrrpeventlistener.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <signal.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static unsigned long long packets = 0;
+
+class Listener : public VrrpEventListener
+{
+	public:
+		virtual void onIncomingVrrpPacket (unsigned int, const IpAddress &, std::uint_fast8_t, std::uint_fast8_t, std::uint_fast16_t, const IpAddressListView &, std::uint64_t)
+		{
+			++packets;
+		}
+
+		virtual void onIncomingVrrpError (unsigned int, std::uint_fast8_t, Error, std::uint_fast64_t)
+		{
+		}
+};
+
+static void singleCallback (int fd, void *)
+{
+	// The old receive path: one packet per wakeup
+	std::uint8_t buffer[2048];
+	std::uint8_t control[1024];
+	IpAddress srcAddress;
+
+	iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = sizeof(buffer);
+
+	msghdr hdr;
+	hdr.msg_name = srcAddress.socketAddress();
+	hdr.msg_namelen = srcAddress.socketAddressSize();
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = control;
+	hdr.msg_controllen = sizeof(control);
+
+	if (recvmsg(fd, &hdr, MSG_DONTWAIT) > 0)
+		++packets;
+}
+
+static void sender (unsigned int burst, unsigned int seconds)
+{
+	int fd = socket(AF_INET, SOCK_RAW, 112);
+	int ttl = 255;
+	setsockopt(fd, SOL_IP, IP_TTL, &ttl, sizeof(ttl));
+
+	IpAddress address("127.0.0.1");
+	std::uint8_t packet[12] = {0x31, 1, 100, 1, 0, 100, 0, 0, 10, 0, 0, 1};
+	*reinterpret_cast<std::uint16_t *>(packet + 6) = Util::checksum(packet, sizeof(packet), address, address, 112);
+
+	// Send each burst with one system call, so it arrives back to back like adverts from many masters
+	iovec iov;
+	iov.iov_base = packet;
+	iov.iov_len = sizeof(packet);
+	mmsghdr *msgs = new mmsghdr[burst];
+	std::memset(msgs, 0, sizeof(mmsghdr) * burst);
+	for (unsigned int j = 0; j != burst; ++j)
+	{
+		msgs[j].msg_hdr.msg_name = address.socketAddress();
+		msgs[j].msg_hdr.msg_namelen = address.socketAddressSize();
+		msgs[j].msg_hdr.msg_iov = &iov;
+		msgs[j].msg_hdr.msg_iovlen = 1;
+	}
+
+	timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (unsigned int i = 0; i != seconds * 1000; ++i)
+	{
+		for (unsigned int sent = 0; sent < burst; )
+		{
+			int count = sendmmsg(fd, msgs + sent, burst - sent, 0);
+			if (count <= 0)
+				break;
+			sent += count;
+		}
+
+		next.tv_nsec += 1000000;
+		if (next.tv_nsec >= 1000000000)
+		{
+			next.tv_nsec -= 1000000000;
+			++next.tv_sec;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+	}
+	_exit(0);
+}
+
+static void stopCallback (Timer *, void *)
+{
+	raise(SIGINT);
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int burst = (argc > 1 ? std::atoi(argv[1]) : 20);
+	unsigned int seconds = (argc > 2 ? std::atoi(argv[2]) : 5);
+	bool single = (argc > 3 && std::strcmp(argv[3], "single") == 0);
+	bool ring = (argc > 3 && std::strcmp(argv[3], "ring") == 0);
+	unsigned int batch = (argc > 3 && !single && !ring ? std::atoi(argv[3]) : 32);
+
+	// The receive path logs every packet at debug level
+	setlogmask(LOG_UPTO(LOG_INFO));
+
+	Listener listener;
+	int fd = -1;
+	if (single)
+	{
+		fd = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, 112);
+		int val = 1;
+		setsockopt(fd, SOL_IP, IP_PKTINFO, &val, sizeof(val));
+		MainLoop::addMonitor(fd, singleCallback, 0, MainLoop::VrrpPriority);
+	}
+	else
+	{
+		VrrpSocket::setReceiveBatchSize(batch);
+		if (ring)
+			VrrpSocket::setIngest(VrrpSocket::RingIngest);
+		VrrpSocket *socket = VrrpSocket::instance(AF_INET);
+		if (socket == 0)
+		{
+			std::cerr << "Error creating VRRP socket. Are you root?" << std::endl;
+			return 1;
+		}
+		socket->addEventListener(1, 1, &listener); // Loopback
+	}
+
+	std::cout << "Burst: " << burst << " packets/ms, " << seconds << " seconds, ";
+	if (single)
+		std::cout << "one recvmsg per wakeup" << std::endl;
+	else if (ring)
+		std::cout << "TPACKET_V3 ring" << std::endl;
+	else
+		std::cout << "recvmmsg batches of " << batch << std::endl;
+
+	pid_t pid = fork();
+	if (pid == 0)
+		sender(burst, seconds);
+
+	Timer stopTimer(stopCallback, 0);
+	stopTimer.start(seconds * 1000);
+
+	rusage before;
+	getrusage(RUSAGE_SELF, &before);
+
+	MainLoop::run();
+
+	rusage after;
+	getrusage(RUSAGE_SELF, &after);
+
+	kill(pid, SIGTERM);
+	waitpid(pid, 0, 0);
+
+	double cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_stime.tv_sec - before.ru_stime.tv_sec)
+		+ ((after.ru_utime.tv_usec - before.ru_utime.tv_usec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec)) / 1000000.0;
+
+	std::cout << "Sent/sec:              " << burst * 1000 << std::endl;
+	std::cout << "Received/sec:          " << packets / seconds << std::endl;
+	std::cout << "Wakeups/sec:           " << (after.ru_nvcsw - before.ru_nvcsw) / seconds << std::endl;
+	std::cout << "Receiver CPU usage:    " << cpu * 100 / seconds << "%" << std::endl;
+	std::cout << "CPU per packet:        " << (packets != 0 ? cpu * 1000000000 / packets : 0) << " ns" << std::endl;
+
+	if (fd != -1)
+		close(fd);
+	VrrpSocket::cleanup();
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Advertisement transmission benchmark
+ *
+ * Sends advertisements for a number of virtual routers through the VRRP
+ * socket, flushing the transmit queue after every BATCH advertisements, as
+ * if BATCH advertisement timers expired in the same loop iteration. A batch
+ * of 1 is what sending every advertisement with its own sendmsg() costs.
+ *
+ * Usage: send-bench INTERFACE ADDRESS [ADVERTISEMENTS] [BATCH] [ADDRESSES] [template]
+ *
+ * Must be run as root. ADDRESS is the IPv4 source address to use, and
+ * ADDRESSES the number of virtual addresses per advertisement. With
+ * "template", every virtual router has a prebuilt advertisement like
+ * VrrpService keeps, instead of serializing each one with sendPacket().
+ */
+
+#include "ipaddress.h"
+#include "vrrpsocket.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <syslog.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+static std::uint64_t nanoseconds ()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main (int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " INTERFACE ADDRESS [ADVERTISEMENTS] [BATCH] [ADDRESSES] [template]" << std::endl;
+		return 1;
+	}
+
+	unsigned int interface = if_nametoindex(argv[1]);
+	IpAddress address(argv[2]);
+	unsigned int count = (argc > 3 ? std::atoi(argv[3]) : 100000);
+	unsigned int batch = (argc > 4 ? std::atoi(argv[4]) : 64);
+	unsigned int addressCount = (argc > 5 ? std::atoi(argv[5]) : 1);
+	bool useTemplate = (argc > 6 && std::strcmp(argv[6], "template") == 0);
+	if (interface == 0 || address.family() != AF_INET || batch == 0)
+	{
+		std::cerr << "Invalid interface or address" << std::endl;
+		return 1;
+	}
+
+	setlogmask(LOG_UPTO(LOG_ERR));
+
+	VrrpSocket *socket = VrrpSocket::instance(AF_INET);
+	if (socket == 0)
+	{
+		std::cerr << "Unable to create VRRP socket" << std::endl;
+		return 1;
+	}
+
+	IpAddressSet addresses;
+	for (unsigned int i = 0; i != addressCount; ++i)
+	{
+		in_addr virtualAddress;
+		virtualAddress.s_addr = htonl(0x0A090001 + i);
+		addresses.insert(IpAddress(&virtualAddress, AF_INET));
+	}
+
+	std::vector<VrrpSocket::Advertisement> templates(255);
+	for (unsigned int i = 0; i != templates.size(); ++i)
+		socket->buildAdvertisement(templates[i], interface, address, i + 1, 100, 100, addresses);
+
+	std::uint64_t start = nanoseconds();
+	for (unsigned int i = 0; i != count; ++i)
+	{
+		if (useTemplate)
+			socket->sendAdvertisement(templates[i % 255], 100);
+		else
+			socket->sendPacket(interface, address, i % 255 + 1, 100, 100, addresses);
+		if ((i + 1) % batch == 0)
+			socket->flush();
+	}
+	socket->flush();
+	std::uint64_t elapsed = nanoseconds() - start;
+
+	std::cout << "Batch size: " << batch << ", " << addressCount << " addresses, " << (useTemplate ? "prebuilt" : "serialized per send") << std::endl;
+	std::cout << "Time per advertisement: " << static_cast<double>(elapsed) / count << " ns" << std::endl;
+	std::cout << "sendmmsg calls:         " << VrrpSocket::sendCalls() << std::endl;
+	std::cout << "Queued:                 " << VrrpSocket::advertisementsQueued() << std::endl;
+	std::cout << "Sent:                   " << VrrpSocket::advertisementsSent() << std::endl;
+	std::cout << "Dropped:                " << VrrpSocket::advertisementsDropped() << std::endl;
+
+	VrrpSocket::cleanup();
+	return 0;
+}
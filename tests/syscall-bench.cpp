@@ -0,0 +1,302 @@
+/*
+ * Main loop system call benchmark
+ *
+ * Simulates a number of VRRP services exchanging advertisements over
+ * datagram socket pairs. The services run in a child process traced with
+ * ptrace, and every system call it makes while the loop runs is counted,
+ * like "strace -c" would: the waits of the loop, but also the sends and
+ * receives of the sockets and the timer reads and updates.
+ *
+ * Tracing makes each system call a lot more expensive, so CPU usage and
+ * wakeups are only reported with "notrace", which skips the counting.
+ *
+ * Usage: syscall-bench [SERVICES] [SECONDS] [notrace]
+ */
+
+#include "mainloop.h"
+#include "timer.h"
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+static const unsigned int advertisementInterval = 1000;
+static const unsigned int masterDownInterval = 3 * advertisementInterval + 609;
+
+static unsigned long long advertisements = 0;
+
+// The child writes a byte here right before and right after running the loop, which tells the tracer what to count
+static int markerFds[2] = {-1, -1};
+
+struct Service
+{
+	Service () :
+		advertisementTimer(timerCallback, this),
+		masterDownTimer(timerCallback, this)
+	{
+		if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1)
+		{
+			std::cerr << "socketpair failed: " << std::strerror(errno) << std::endl;
+			std::exit(1);
+		}
+		MainLoop::addMonitor(fds[1], socketCallback, this, MainLoop::VrrpPriority);
+	}
+
+	~Service ()
+	{
+		MainLoop::removeMonitor(fds[1]);
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	static void timerCallback (Timer *timer, void *userData)
+	{
+		Service *self = reinterpret_cast<Service *>(userData);
+		if (timer == &self->advertisementTimer)
+		{
+			char packet[40] = {0};
+			send(self->fds[0], packet, sizeof(packet), 0);
+			self->advertisementTimer.start(advertisementInterval);
+		}
+	}
+
+	static void socketCallback (int fd, void *userData)
+	{
+		Service *self = reinterpret_cast<Service *>(userData);
+		char packet[64];
+		while (recv(fd, packet, sizeof(packet), 0) > 0)
+		{
+			++advertisements;
+			self->masterDownTimer.start(masterDownInterval);
+		}
+	}
+
+	int fds[2];
+	Timer advertisementTimer;
+	Timer masterDownTimer;
+};
+
+static void stopCallback (Timer *, void *)
+{
+	raise(SIGINT);
+}
+
+static const char *syscallName (unsigned long nr)
+{
+	switch (nr)
+	{
+		case SYS_read: return "read";
+		case SYS_write: return "write";
+		case SYS_recvfrom: return "recvfrom";
+		case SYS_recvmsg: return "recvmsg";
+		case SYS_recvmmsg: return "recvmmsg";
+		case SYS_sendto: return "sendto";
+		case SYS_sendmsg: return "sendmsg";
+		case SYS_sendmmsg: return "sendmmsg";
+		case SYS_epoll_wait: return "epoll_wait";
+		case SYS_epoll_pwait: return "epoll_pwait";
+		case SYS_epoll_ctl: return "epoll_ctl";
+		case SYS_timerfd_settime: return "timerfd_settime";
+		case SYS_clock_gettime: return "clock_gettime";
+		case SYS_futex: return "futex";
+		default: return 0;
+	}
+}
+
+static int runServices (unsigned int services, unsigned int seconds)
+{
+	rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	std::vector<Service *> list;
+	for (unsigned int i = 0; i != services; ++i)
+	{
+		Service *service = new Service();
+		service->advertisementTimer.start(std::rand() % advertisementInterval + 1);
+		service->masterDownTimer.start(masterDownInterval);
+		list.push_back(service);
+	}
+
+	Timer stopTimer(stopCallback, 0);
+	stopTimer.start(seconds * 1000);
+
+	std::uint64_t syscallsBefore = MainLoop::syscalls();
+	rusage before;
+	getrusage(RUSAGE_SELF, &before);
+
+	char marker = 0;
+	if (markerFds[1] != -1)
+		write(markerFds[1], &marker, 1);
+
+	MainLoop::run();
+
+	if (markerFds[1] != -1)
+		write(markerFds[1], &marker, 1);
+
+	rusage after;
+	getrusage(RUSAGE_SELF, &after);
+	std::uint64_t syscalls = MainLoop::syscalls() - syscallsBefore;
+
+	for (std::vector<Service *>::const_iterator it = list.begin(); it != list.end(); ++it)
+		delete *it;
+
+	double cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_stime.tv_sec - before.ru_stime.tv_sec)
+		+ ((after.ru_utime.tv_usec - before.ru_utime.tv_usec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec)) / 1000000.0;
+
+	std::cout << "Advertisements/sec:    " << advertisements / seconds << std::endl;
+	std::cout << "epoll syscalls/sec:    " << syscalls / seconds << std::endl;
+	if (markerFds[1] == -1)
+	{
+		std::cout << "Wakeups/sec:           " << (after.ru_nvcsw - before.ru_nvcsw) / seconds << std::endl;
+		std::cout << "CPU usage:             " << cpu * 100 / seconds << "%" << std::endl;
+	}
+
+	return 0;
+}
+
+/*
+   Trace the child and all its threads, counting the system calls made between
+   the two marker writes. The markers themselves are not counted
+*/
+static int countSyscalls (pid_t child, unsigned int seconds)
+{
+	int status;
+	waitpid(child, &status, 0);
+	ptrace(PTRACE_SETOPTIONS, child, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+	ptrace(PTRACE_SYSCALL, child, 0, 0);
+
+	std::map<unsigned long, unsigned long long> counts;
+	unsigned int markers = 0;
+	std::set<pid_t> tracees;
+	tracees.insert(child);
+	int exitStatus = 1;
+
+	while (!tracees.empty())
+	{
+		pid_t pid = waitpid(-1, &status, __WALL);
+		if (pid == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+		{
+			if (pid == child)
+				exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+			tracees.erase(pid);
+			continue;
+		}
+
+		if (!WIFSTOPPED(status))
+			continue;
+
+		int signal = 0;
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+		{
+			__ptrace_syscall_info info;
+			if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY)
+			{
+				if (info.entry.nr == SYS_write && static_cast<int>(info.entry.args[0]) == markerFds[1])
+					++markers;
+				else if (markers == 1)
+					++counts[info.entry.nr];
+			}
+		}
+		else if (status >> 16 != 0)
+		{
+			// Clone events. New threads show up with their own stop
+		}
+		else if (tracees.insert(pid).second && WSTOPSIG(status) == SIGSTOP)
+		{
+			// Initial stop of a new thread
+		}
+		else
+			signal = WSTOPSIG(status);
+
+		ptrace(PTRACE_SYSCALL, pid, 0, signal);
+	}
+
+	if (exitStatus != 0)
+		return exitStatus;
+
+	std::multimap<unsigned long long, unsigned long, std::greater<unsigned long long> > sorted;
+	unsigned long long total = 0;
+	for (std::map<unsigned long, unsigned long long>::const_iterator it = counts.begin(); it != counts.end(); ++it)
+	{
+		sorted.insert(std::make_pair(it->second, it->first));
+		total += it->second;
+	}
+
+	// Calls made less than once a second, like the signal handling set up and torn down by MainLoop::run(), are lumped together
+	std::cout << "All syscalls/sec:      " << total / seconds << std::endl;
+	unsigned long long other = 0;
+	for (std::multimap<unsigned long long, unsigned long>::const_iterator it = sorted.begin(); it != sorted.end(); ++it)
+	{
+		if (it->first < seconds)
+		{
+			other += it->first;
+			continue;
+		}
+
+		const char *name = syscallName(it->second);
+		std::cout << "  " << it->first / seconds << "\t";
+		if (name != 0)
+			std::cout << name;
+		else
+			std::cout << "syscall " << it->second;
+		std::cout << std::endl;
+	}
+	if (other != 0)
+		std::cout << "  " << other << "\tother calls in total" << std::endl;
+
+	return 0;
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int services = (argc > 1 ? std::atoi(argv[1]) : 2000);
+	unsigned int seconds = (argc > 2 ? std::atoi(argv[2]) : 10);
+	bool trace = (argc <= 3 || std::strcmp(argv[3], "notrace") != 0);
+
+	std::cout << "Services: " << services << ", " << seconds << " seconds" << (trace ? "" : ", not traced") << std::endl;
+
+	if (!trace)
+		return runServices(services, seconds);
+
+	if (pipe(markerFds) == -1)
+	{
+		std::cerr << "pipe failed: " << std::strerror(errno) << std::endl;
+		return 1;
+	}
+
+	pid_t child = fork();
+	if (child == -1)
+	{
+		std::cerr << "fork failed: " << std::strerror(errno) << std::endl;
+		return 1;
+	}
+	else if (child == 0)
+	{
+		ptrace(PTRACE_TRACEME, 0, 0, 0);
+		raise(SIGSTOP);
+		std::exit(runServices(services, seconds));
+	}
+
+	return countSyscalls(child, seconds);
+}
@@ -0,0 +1,189 @@
+/*
+ * System call counter
+ *
+ * Runs a command under ptrace and counts the system calls of all its
+ * threads and children, like "strace -c -f". Used to compare the total
+ * system call cost of the daemon and the benchmarks, including the receive
+ * and send calls that follow each readiness event.
+ *
+ * Usage: syscall-count [-s SIGNAL] COMMAND [ARGS]
+ *
+ * SIGINT and SIGTERM sent to the counter are passed on to the command. With
+ * -s, calls made after SIGNAL (a number) was passed on are counted
+ * separately, e.g. -s 15 to see what shutting down on SIGTERM costs. This
+ * also works for programs that take signals from a signalfd.
+ */
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+static pid_t child = 0;
+static int marker = 0;
+static volatile sig_atomic_t marked = 0;
+
+static void forwardSignal (int signal)
+{
+	if (signal == marker)
+		marked = 1;
+	if (child > 0)
+		kill(child, signal);
+}
+
+static const char *syscallName (unsigned long nr)
+{
+	switch (nr)
+	{
+		case SYS_read: return "read";
+		case SYS_write: return "write";
+		case SYS_close: return "close";
+		case SYS_socket: return "socket";
+		case SYS_bind: return "bind";
+		case SYS_setsockopt: return "setsockopt";
+		case SYS_getpid: return "getpid";
+		case SYS_recvfrom: return "recvfrom";
+		case SYS_recvmsg: return "recvmsg";
+		case SYS_recvmmsg: return "recvmmsg";
+		case SYS_sendto: return "sendto";
+		case SYS_sendmsg: return "sendmsg";
+		case SYS_sendmmsg: return "sendmmsg";
+		case SYS_epoll_wait: return "epoll_wait";
+		case SYS_epoll_pwait: return "epoll_pwait";
+		case SYS_epoll_ctl: return "epoll_ctl";
+		case SYS_io_uring_enter: return "io_uring_enter";
+		case SYS_timerfd_settime: return "timerfd_settime";
+		case SYS_clock_gettime: return "clock_gettime";
+		case SYS_ioctl: return "ioctl";
+		case SYS_futex: return "futex";
+		case SYS_getrusage: return "getrusage";
+		default: return 0;
+	}
+}
+
+static void print (const char *title, const std::map<unsigned long, unsigned long long> &counts)
+{
+	std::multimap<unsigned long long, unsigned long, std::greater<unsigned long long> > sorted;
+	unsigned long long total = 0;
+	for (std::map<unsigned long, unsigned long long>::const_iterator it = counts.begin(); it != counts.end(); ++it)
+	{
+		sorted.insert(std::make_pair(it->second, it->first));
+		total += it->second;
+	}
+
+	std::cerr << title << ": " << total << " system calls" << std::endl;
+	for (std::multimap<unsigned long long, unsigned long>::const_iterator it = sorted.begin(); it != sorted.end(); ++it)
+	{
+		const char *name = syscallName(it->second);
+		std::cerr << "  " << it->first << "\t";
+		if (name != 0)
+			std::cerr << name;
+		else
+			std::cerr << "syscall " << it->second;
+		std::cerr << std::endl;
+	}
+}
+
+int main (int argc, char *argv[])
+{
+	int first = 1;
+	if (argc > 2 && std::strcmp(argv[1], "-s") == 0)
+	{
+		marker = std::atoi(argv[2]);
+		first = 3;
+	}
+	if (first >= argc)
+	{
+		std::cerr << "Usage: " << argv[0] << " [-s SIGNAL] COMMAND [ARGS]" << std::endl;
+		return 1;
+	}
+
+	child = fork();
+	if (child == -1)
+	{
+		std::cerr << "fork: " << std::strerror(errno) << std::endl;
+		return 1;
+	}
+	else if (child == 0)
+	{
+		ptrace(PTRACE_TRACEME, 0, 0, 0);
+		raise(SIGSTOP);
+		execvp(argv[first], argv + first);
+		std::cerr << "exec: " << std::strerror(errno) << std::endl;
+		_exit(127);
+	}
+
+	int status;
+	waitpid(child, &status, 0);
+	ptrace(PTRACE_SETOPTIONS, child, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL);
+	ptrace(PTRACE_SYSCALL, child, 0, 0);
+
+	signal(SIGINT, forwardSignal);
+	signal(SIGTERM, forwardSignal);
+
+	std::map<unsigned long, unsigned long long> before;
+	std::map<unsigned long, unsigned long long> after;
+	std::set<pid_t> tracees;
+	tracees.insert(child);
+	int exitStatus = 0;
+
+	while (!tracees.empty())
+	{
+		pid_t pid = waitpid(-1, &status, __WALL);
+		if (pid == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+		{
+			if (pid == child)
+				exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+			tracees.erase(pid);
+			continue;
+		}
+
+		if (!WIFSTOPPED(status))
+			continue;
+
+		int signal = 0;
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+		{
+			__ptrace_syscall_info info;
+			if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY)
+				++(marked ? after : before)[info.entry.nr];
+		}
+		else if (status >> 16 != 0)
+		{
+			// Fork, clone and exec events. New tracees show up with their own stop
+		}
+		else if (tracees.insert(pid).second && WSTOPSIG(status) == SIGSTOP)
+		{
+			// Initial stop of a new thread or child
+		}
+		else
+			signal = WSTOPSIG(status);
+
+		ptrace(PTRACE_SYSCALL, pid, 0, signal);
+	}
+
+	if (marker != 0)
+	{
+		print("Before signal", before);
+		print("After signal", after);
+	}
+	else
+		print("Total", before);
+
+	return exitStatus;
+}
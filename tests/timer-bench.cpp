@@ -0,0 +1,196 @@
+/*
+ * Timer benchmark
+ *
+ * Simulates the timers of a number of VRRP services - an advertisement timer
+ * and a master down timer per service, where every advertisement restarts
+ * the master down timer - and reports file descriptor usage, wakeups and
+ * CPU usage.
+ *
+ * Usage: timer-bench [SERVICES] [SECONDS] [timerfd]
+ *
+ * With "timerfd", the old one-timerfd-per-timer scheme is simulated for
+ * comparison.
+ */
+
+#include "mainloop.h"
+#include "timer.h"
+
+#include <iostream>
+#include <vector>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+
+static const unsigned int advertisementInterval = 1000;
+static const unsigned int masterDownInterval = 3 * advertisementInterval + 609;
+
+static unsigned long long advertisements = 0;
+
+static int countFds ()
+{
+	int count = 0;
+	DIR *dir = opendir("/proc/self/fd");
+	if (dir == 0)
+		return -1;
+	while (readdir(dir) != 0)
+		++count;
+	closedir(dir);
+	return count - 3; // ., .. and the directory itself
+}
+
+struct Service
+{
+	Service () :
+		advertisementTimer(callback, this),
+		masterDownTimer(callback, this)
+	{
+	}
+
+	static void callback (Timer *timer, void *userData)
+	{
+		Service *self = reinterpret_cast<Service *>(userData);
+		if (timer == &self->advertisementTimer)
+		{
+			++advertisements;
+			self->advertisementTimer.start(advertisementInterval);
+			self->masterDownTimer.start(masterDownInterval);
+		}
+	}
+
+	Timer advertisementTimer;
+	Timer masterDownTimer;
+};
+
+static void stopCallback (Timer *, void *)
+{
+	raise(SIGINT);
+}
+
+static void setTimerfd (int fd, unsigned int msec)
+{
+	itimerspec value;
+	std::memset(&value, 0, sizeof(value));
+	value.it_value.tv_sec = msec / 1000;
+	value.it_value.tv_nsec = (msec % 1000) * 1000000;
+	timerfd_settime(fd, 0, &value, 0);
+}
+
+static void runTimerfd (unsigned int services, unsigned int seconds)
+{
+	// Emulates the old Timer: one timerfd per timer, added to and removed from epoll on start and stop
+	int epfd = epoll_create(32);
+	std::vector<int> advertisementFds(services);
+	std::vector<int> masterDownFds(services);
+	for (unsigned int i = 0; i != services; ++i)
+	{
+		advertisementFds[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		masterDownFds[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (advertisementFds[i] == -1 || masterDownFds[i] == -1)
+		{
+			std::cerr << "timerfd_create failed: " << std::strerror(errno) << std::endl;
+			std::exit(1);
+		}
+
+		epoll_event event;
+		event.events = EPOLLIN;
+		event.data.u32 = i;
+		setTimerfd(advertisementFds[i], std::rand() % advertisementInterval + 1);
+		epoll_ctl(epfd, EPOLL_CTL_ADD, advertisementFds[i], &event);
+		event.data.u32 = i | 0x80000000;
+		setTimerfd(masterDownFds[i], masterDownInterval);
+		epoll_ctl(epfd, EPOLL_CTL_ADD, masterDownFds[i], &event);
+	}
+
+	std::cout << "Open file descriptors: " << countFds() << std::endl;
+
+	time_t end = time(0) + seconds;
+	while (time(0) < end)
+	{
+		epoll_event events[16];
+		int count = epoll_wait(epfd, events, 16, 1000);
+		for (int i = 0; i < count; ++i)
+		{
+			unsigned int index = events[i].data.u32 & 0x7FFFFFFF;
+			int fd = (events[i].data.u32 & 0x80000000) ? masterDownFds[index] : advertisementFds[index];
+			std::uint64_t expirations;
+			read(fd, &expirations, sizeof(expirations));
+			epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &events[i]);
+			if (fd == advertisementFds[index])
+			{
+				++advertisements;
+				setTimerfd(advertisementFds[index], advertisementInterval);
+				epoll_ctl(epfd, EPOLL_CTL_ADD, advertisementFds[index], &events[i]);
+
+				epoll_event event;
+				event.events = EPOLLIN;
+				event.data.u32 = index | 0x80000000;
+				epoll_ctl(epfd, EPOLL_CTL_DEL, masterDownFds[index], &event);
+				setTimerfd(masterDownFds[index], masterDownInterval);
+				epoll_ctl(epfd, EPOLL_CTL_ADD, masterDownFds[index], &event);
+			}
+		}
+	}
+}
+
+static void runWheel (unsigned int services, unsigned int seconds)
+{
+	std::vector<Service *> list;
+	for (unsigned int i = 0; i != services; ++i)
+	{
+		Service *service = new Service();
+		service->advertisementTimer.start(std::rand() % advertisementInterval + 1);
+		service->masterDownTimer.start(masterDownInterval);
+		list.push_back(service);
+	}
+
+	Timer stopTimer(stopCallback, 0);
+	stopTimer.start(seconds * 1000);
+
+	std::cout << "Open file descriptors: " << countFds() << std::endl;
+
+	MainLoop::run();
+
+	for (std::vector<Service *>::const_iterator it = list.begin(); it != list.end(); ++it)
+		delete *it;
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int services = (argc > 1 ? std::atoi(argv[1]) : 5000);
+	unsigned int seconds = (argc > 2 ? std::atoi(argv[2]) : 10);
+	bool timerfd = (argc > 3 && std::strcmp(argv[3], "timerfd") == 0);
+
+	rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	std::cout << "Services: " << services << " (" << services * 2 << " timers), " << seconds << " seconds, " << (timerfd ? "timerfd per timer" : "timer wheel") << std::endl;
+
+	rusage before;
+	getrusage(RUSAGE_SELF, &before);
+
+	if (timerfd)
+		runTimerfd(services, seconds);
+	else
+		runWheel(services, seconds);
+
+	rusage after;
+	getrusage(RUSAGE_SELF, &after);
+
+	double cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_stime.tv_sec - before.ru_stime.tv_sec)
+		+ ((after.ru_utime.tv_usec - before.ru_utime.tv_usec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec)) / 1000000.0;
+
+	std::cout << "Advertisements/sec:    " << advertisements / seconds << std::endl;
+	std::cout << "Wakeups/sec:           " << (after.ru_nvcsw - before.ru_nvcsw) / seconds << std::endl;
+	std::cout << "CPU usage:             " << cpu * 100 / seconds << "%" << std::endl;
+
+	return 0;
+}